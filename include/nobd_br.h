@@ -2,9 +2,11 @@
 #define nobd_BR_H
 
 struct net_bridge;
+struct nobd_snap_cur;
 
 int nobd_br_fdb_init(void);
 void nobd_br_fdb_exit(void);
 int nobd_br_reg(struct net_bridge *br);
 int nobd_br_unreg(struct net_bridge *br);
+int nobd_br_snap(struct nobd_snap_cur *c);
 #endif /* nobd_BR_H */
@@ -0,0 +1,15 @@
+#ifndef nobd_CT_H
+#define nobd_CT_H
+
+#include "nobd_ev.h"
+
+int nobd_ct_init(void);
+void nobd_ct_exit(void);
+void nobd_ct_emit(const struct nobd_ev_ct *rec, u16 netns);
+int nobd_ct_coalesce(const void *key, struct nobd_ev_ct *rec, u16 netns);
+void nobd_ct_track_start(const void *key);
+u32 nobd_ct_track_end(const void *key);
+u8 nobd_ct_helper_id(const char *name);
+u8 nobd_ct_helper_get(const char *name);
+const char *nobd_ct_helper_name(u8 id);
+#endif /* nobd_CT_H */
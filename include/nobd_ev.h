@@ -0,0 +1,262 @@
+#ifndef nobd_EV_H
+#define nobd_EV_H
+
+/*
+ * nobd event records, shared between the module and userspace consumers.
+ *
+ * Every CPU owns one ring in the /dev/nobd mapping. A ring is a control
+ * page followed by nr_ev fixed size records. The kernel is the only
+ * writer of head, the consumer is the only writer of tail. The ring a
+ * record sits in is the CPU it was produced on.
+ */
+
+#include <linux/types.h>
+#ifndef __KERNEL__
+#include <sys/ioctl.h>
+#else
+#include <linux/ioctl.h>
+#endif
+
+/*
+ * Bumped when an existing field moves or changes meaning. Consumers must
+ * skip records whose hdr.version they don't know. New fields are appended
+ * inside the fixed NOBD_EV_SIZE slot, older consumers see them as zero.
+ */
+#define NOBD_EV_VERSION		5
+
+#define NOBD_DEV_NAME		"nobd"
+#define NOBD_EV_SIZE		64
+#define NOBD_IFNAMSIZ		16
+
+enum nobd_ev_type {
+	NOBD_EV_NONE,
+	NOBD_EV_CT,
+	NOBD_EV_ROUTE,
+	NOBD_EV_NEIGH,
+	NOBD_EV_LINK,
+	NOBD_EV_FDB,
+	NOBD_EV_VLAN,
+	NOBD_EV_PPPOE,
+	NOBD_EV_DROPS,
+	NOBD_EV_SNAP,
+	NOBD_EV_MAX
+};
+
+/* generic add/remove operation, used by route, neigh, fdb */
+enum nobd_ev_op {
+	NOBD_OP_NEW,
+	NOBD_OP_DEL,
+	NOBD_OP_MOVE,		/* same key, new port or interface */
+	NOBD_OP_CHANGE,		/* same key, flags or state changed */
+};
+
+/*
+ * A conntrack ends with exactly one of DESTROY (removed before its timer
+ * ran out: flushed, deleted, evicted), TIMEOUT (expired idle), CLOSED (a
+ * TCP flow expired in a closing state) or SHORT.
+ */
+enum nobd_ct_op {
+	NOBD_CT_NEW,
+	NOBD_CT_DESTROY,
+	NOBD_CT_RELATED,
+	NOBD_CT_HELPER,
+	NOBD_CT_TIMEOUT,
+	NOBD_CT_SHORT,		/* created and destroyed inside the window */
+	NOBD_CT_CLOSED,
+};
+
+/* netdev events, decoupled from the kernel's NETDEV_* values */
+enum nobd_link_op {
+	NOBD_LINK_REGISTER,
+	NOBD_LINK_UNREGISTER,
+	NOBD_LINK_UP,
+	NOBD_LINK_DOWN,
+	NOBD_LINK_GOING_DOWN,
+	NOBD_LINK_CHANGE,
+	NOBD_LINK_BIND,
+	NOBD_LINK_UNBIND,
+};
+
+enum nobd_link_class {
+	NOBD_CLASS_ETH,
+	NOBD_CLASS_BRIDGE,
+	NOBD_CLASS_BRPORT,
+	NOBD_CLASS_VLAN,
+	NOBD_CLASS_PPP,
+};
+
+/*
+ * A snapshot streams the current state of each stage as ordinary records,
+ * op NEW (or NOBD_LINK_REGISTER, NOBD_CT_NEW), between a BEGIN and an END
+ * marker of that stage, the whole of it between markers of NOBD_EV_NONE.
+ * Live records keep flowing in between, applying everything in seq order
+ * gives the current state.
+ */
+enum nobd_snap_op {
+	NOBD_SNAP_BEGIN,
+	NOBD_SNAP_END,
+	NOBD_SNAP_ABORT,
+};
+
+/* rate limited event classes, see the rl_rate and rl_burst parameters */
+enum nobd_rl_class {
+	NOBD_RL_CT_NEW,		/* new, related, helper */
+	NOBD_RL_CT_DESTROY,	/* destroy, timeout, closed, short */
+	NOBD_RL_ROUTE,
+	NOBD_RL_NEIGH,
+	NOBD_RL_LINK,
+	NOBD_RL_FDB,
+	NOBD_RL_PPPOE,
+	NOBD_RL_VLAN,
+	NOBD_RL_MAX
+};
+
+#define NOBD_FDB_LOCAL		0x01
+#define NOBD_FDB_STATIC		0x02
+
+/*
+ * An IPv4 or IPv6 address as found in the family field next to it. IPv4
+ * addresses sit in the first word and the rest is zero.
+ */
+union nobd_addr {
+	__be32	ip;
+	__be32	ip6[4];
+	__u8	b[16];
+};
+
+struct nobd_ev_hdr {
+	__u8	version;	/* NOBD_EV_VERSION */
+	__u8	type;		/* enum nobd_ev_type */
+	__u16	netns;		/* see /proc/net/nobd, 0 is the initial one */
+	__u32	seq;		/* global, gaps mean dropped records */
+	__u64	ts;		/* CLOCK_REALTIME, ns */
+};
+
+struct nobd_ev_ct {
+	union nobd_addr	src;
+	union nobd_addr	dst;
+	__be16	sport;
+	__be16	dport;
+	__u8	proto;
+	__u8	op;		/* enum nobd_ct_op */
+	__u8	family;		/* AF_INET or AF_INET6 */
+	__u8	helper;		/* line in /proc/nobd/ct_helpers, 0 for none */
+	__u16	count;		/* notifier calls merged, saturates */
+	__u16	sample_n;	/* flow sampled 1 in sample_n, 1 for all */
+	__u32	duration;	/* ms since NEW, end records, 0 if NEW was not seen */
+};
+
+struct nobd_ev_route {
+	union nobd_addr	dst;
+	union nobd_addr	gw;
+	__u32	oif;
+	__u8	dst_len;
+	__u8	op;		/* enum nobd_ev_op */
+	__u8	family;
+	__u8	table;
+};
+
+struct nobd_ev_neigh {
+	union nobd_addr	ip;
+	__u32	ifindex;
+	__u8	lladdr[6];
+	__u8	op;		/* enum nobd_ev_op */
+	__u8	family;
+	__u16	state;		/* NUD_* */
+	__u16	flaps;		/* transitions suppressed since the last record */
+};
+
+struct nobd_ev_link {
+	__u32	ifindex;
+	__u32	master;		/* bridge ifindex of a port */
+	__u8	op;		/* enum nobd_link_op */
+	__u8	class;		/* enum nobd_link_class */
+	__u8	pad[2];
+	char	name[NOBD_IFNAMSIZ];
+};
+
+struct nobd_ev_fdb {
+	__u32	br_ifindex;
+	__u32	port_ifindex;
+	__u32	age;		/* clock_t since last seen */
+	__u8	mac[6];
+	__u8	flags;		/* NOBD_FDB_* */
+	__u8	op;		/* enum nobd_ev_op */
+	__u32	old_port_ifindex; /* NOBD_OP_MOVE only */
+};
+
+struct nobd_ev_vlan {
+	__u32	ifindex;
+	__u32	real_ifindex;
+	__u16	vid;
+	__u8	op;		/* enum nobd_link_op */
+	__u8	pad;
+	char	name[NOBD_IFNAMSIZ];
+};
+
+struct nobd_ev_pppoe {
+	__u32	ifindex;	/* ppp unit */
+	__u32	pppoe_ifindex;	/* underlying ethernet */
+	__u32	chan;
+	__u32	pid;
+	__be16	sid;
+	__u8	remote[6];
+	__u8	op;		/* enum nobd_link_op */
+	__u8	pad[3];
+};
+
+/* records the rate limiter suppressed since the previous NOBD_EV_DROPS */
+struct nobd_ev_drops {
+	__u32	interval_ms;
+	__u32	dropped[NOBD_RL_MAX];	/* enum nobd_rl_class */
+};
+
+/* snapshot marker, see enum nobd_snap_op */
+struct nobd_ev_snap {
+	__u32	id;		/* snapshots started since load */
+	__u32	count;		/* records of the stage, END only */
+	__u32	lost;		/* records of the stage the ring had no room for */
+	__u8	op;		/* enum nobd_snap_op */
+	__u8	what;		/* enum nobd_ev_type of the stage */
+	__u8	pad[2];
+};
+
+struct nobd_ev {
+	struct nobd_ev_hdr hdr;
+	union {
+		struct nobd_ev_ct	ct;
+		struct nobd_ev_route	route;
+		struct nobd_ev_neigh	neigh;
+		struct nobd_ev_link	link;
+		struct nobd_ev_fdb	fdb;
+		struct nobd_ev_vlan	vlan;
+		struct nobd_ev_pppoe	pppoe;
+		struct nobd_ev_drops	drops;
+		struct nobd_ev_snap	snap;
+		__u8			raw[NOBD_EV_SIZE -
+					    sizeof(struct nobd_ev_hdr)];
+	};
+};
+
+/* first page of every ring, head and tail live on separate cache lines */
+struct nobd_ring_ctl {
+	__u32	head;
+	__u32	drops;
+	__u8	pad0[56];
+	__u32	tail;
+	__u8	pad1[60];
+};
+
+struct nobd_geometry {
+	__u32	version;	/* NOBD_EV_VERSION of the module */
+	__u32	nr_rings;	/* one per possible cpu */
+	__u32	ring_bytes;	/* stride between rings in the mapping */
+	__u32	ev_offset;	/* first record, from the start of a ring */
+	__u32	nr_ev;		/* records per ring, power of two */
+	__u32	ev_size;
+};
+
+#define NOBD_IOC_MAGIC		0xb0
+#define NOBD_IOC_GEOMETRY	_IOR(NOBD_IOC_MAGIC, 1, struct nobd_geometry)
+
+#endif /* nobd_EV_H */
@@ -0,0 +1,9 @@
+#ifndef nobd_FILTER_H
+#define nobd_FILTER_H
+
+#include "nobd_ev.h"
+
+int nobd_flt_init(void);
+void nobd_flt_exit(void);
+int nobd_flt_pass(u8 type, u16 netns, const void *body);
+#endif /* nobd_FILTER_H */
@@ -0,0 +1,38 @@
+#ifndef nobd_IF_H
+#define nobd_IF_H
+
+#include <linux/list.h>
+#include "nobd_ev.h"
+
+struct net;
+struct net_device;
+
+#define NOBD_IF_NONE	0xff	/* class of a device nobd does not watch */
+#define NOBD_IF_UNKNOWN	0xff	/* up/carrier not reported yet */
+
+/*
+ * What nobd last knew and reported of a device, keyed by namespace and
+ * ifindex. Only touched under rtnl, like the notifier calls that feed it.
+ */
+struct nobd_if {
+	struct hlist_node hnode;
+	struct net *net;
+	int ifindex;
+	int master;		/* bridge ifindex of a port */
+	int lower;		/* real device of a vlan */
+	u16 vid;
+	u8 base;		/* class leaving bridge ports aside */
+	u8 class;		/* enum nobd_link_class or NOBD_IF_NONE */
+	u8 up;
+	u8 carrier;
+};
+
+int nobd_if_init(void);
+void nobd_if_exit(void);
+u8 nobd_if_class(struct net_device *dev);
+struct nobd_if *nobd_if_get(struct net_device *dev);
+int nobd_if_transition(struct nobd_if *ifc, struct net_device *dev,
+		       unsigned long event);
+void nobd_if_del(struct net_device *dev);
+void nobd_if_purge(struct net *net);
+#endif /* nobd_IF_H */
@@ -1,6 +1,10 @@
 #ifndef nobd_NC_H
 #define nobd_NC_H
 
+struct nobd_snap_cur;
+
 int nobd_nc_init(void);
 void nobd_nc_exit(void);
+int nobd_nc_snap_links(struct nobd_snap_cur *c);
+int nobd_ct_snap(struct nobd_snap_cur *c);
 #endif
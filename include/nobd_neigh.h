@@ -0,0 +1,15 @@
+#ifndef nobd_NEIGH_H
+#define nobd_NEIGH_H
+
+#include "nobd_ev.h"
+
+struct nobd_snap_cur;
+
+int nobd_neigh_init(void);
+void nobd_neigh_exit(void);
+int nobd_neigh_update(const struct nobd_ev_neigh *rec, u16 netns, u32 gen,
+		      int report);
+unsigned int nobd_neigh_sweep(u16 netns, u32 gen);
+void nobd_neigh_purge(u16 netns);
+int nobd_neigh_snap(struct nobd_snap_cur *c);
+#endif /* nobd_NEIGH_H */
@@ -0,0 +1,10 @@
+#ifndef nobd_NET_H
+#define nobd_NET_H
+
+struct net;
+
+int nobd_net_init(void);
+void nobd_net_exit(void);
+int nobd_net_id(struct net *net);
+struct net *nobd_net_next(int *id);
+#endif /* nobd_NET_H */
@@ -1,6 +1,14 @@
 #ifndef nobd_NL_H
 #define nobd_NL_H
 
+struct net;
+struct nobd_nl;
+struct delayed_work;
+
 int nobd_nl_open(void);
 void nobd_nl_close(void);
+struct nobd_nl *nobd_nl_start(struct net *net, u16 netns);
+void nobd_nl_stop(struct nobd_nl *nl);
+int nobd_nl_queue(struct delayed_work *dw, unsigned long delay);
+int nobd_nl_seeding(void);
 #endif /* nobd_NL_H */
@@ -0,0 +1,32 @@
+#ifndef nobd_NL_PARSE_H
+#define nobd_NL_PARSE_H
+
+/*
+ * rtnetlink messages to nobd records. Nothing here touches the kernel
+ * beyond the uapi netlink headers, tools/nobd-nlreplay builds the same
+ * file in userspace.
+ */
+
+#include "nobd_ev.h"
+
+struct nlmsghdr;
+
+/* what nobd_nl_parse() made of a message */
+enum nobd_nl_msg {
+	NOBD_NL_SKIP,		/* of no interest, or malformed */
+	NOBD_NL_DONE,
+	NOBD_NL_ERROR,
+	NOBD_NL_ROUTE,		/* ev->route */
+	NOBD_NL_LINK,		/* ev->link, a bridge port */
+	NOBD_NL_NEIGH,		/* ev->neigh */
+	NOBD_NL_MAX,
+};
+
+/* nobd_nl_parse() flags */
+#define NOBD_NL_NO_NEIGH	0x01	/* skip neighbour messages unparsed */
+
+int nobd_nl_parse_route(struct nlmsghdr *nlh, struct nobd_ev *ev);
+int nobd_nl_parse_link(struct nlmsghdr *nlh, struct nobd_ev *ev);
+int nobd_nl_parse_neigh(struct nlmsghdr *nlh, struct nobd_ev_neigh *rec);
+int nobd_nl_parse(struct nlmsghdr *nlh, struct nobd_ev *ev, int flags);
+#endif /* nobd_NL_PARSE_H */
@@ -0,0 +1,17 @@
+#ifndef nobd_NL_STATE_H
+#define nobd_NL_STATE_H
+
+#include "nobd_ev.h"
+
+struct nobd_snap_cur;
+
+int nobd_nl_state_init(void);
+void nobd_nl_state_exit(void);
+int nobd_nl_state_is_del(const struct nobd_ev *ev);
+int nobd_nl_state_set(const struct nobd_ev *ev, u32 gen);
+int nobd_nl_state_del(const struct nobd_ev *ev);
+unsigned int nobd_nl_state_sweep(u16 netns, u8 type, u32 gen);
+void nobd_nl_state_purge(u16 netns);
+unsigned int nobd_nl_state_count(void);
+int nobd_nl_state_snap(struct nobd_snap_cur *c);
+#endif /* nobd_NL_STATE_H */
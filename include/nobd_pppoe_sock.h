@@ -2,5 +2,8 @@
 #define nobd_PPPOE_SOCK_H
 
 struct net_device;
-void find_dev_pppoe_socks(struct net_device *);
+int nobd_pppoe_init(void);
+void nobd_pppoe_exit(void);
+void find_dev_pppoe_socks(struct net_device *, int op);
+void nobd_pppoe_dev_gone(struct net_device *);
 #endif /* nobd_PPPOE_SOCK_H */
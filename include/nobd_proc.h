@@ -0,0 +1,10 @@
+#ifndef nobd_PROC_H
+#define nobd_PROC_H
+
+struct proc_dir_entry;
+
+extern struct proc_dir_entry *nobd_proc_dir;
+
+int nobd_proc_init(void);
+void nobd_proc_exit(void);
+#endif /* nobd_PROC_H */
@@ -0,0 +1,17 @@
+#ifndef nobd_RING_H
+#define nobd_RING_H
+
+#include "nobd_ev.h"
+
+int nobd_ring_init(void);
+void nobd_ring_exit(void);
+struct nobd_ev *nobd_ev_reserve(u8 type, unsigned long *flags);
+int nobd_ev_commit(struct nobd_ev *ev, unsigned long flags);
+void nobd_ev_emit(const struct nobd_ev *src);
+int nobd_ev_emit_snap(const struct nobd_ev *src);
+int nobd_ring_room(void);
+int nobd_ring_claim(void);
+void nobd_ring_unclaim(void);
+const struct nobd_ev *nobd_ring_oldest(int *cpu);
+void nobd_ring_consume(int cpu);
+#endif /* nobd_RING_H */
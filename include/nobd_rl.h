@@ -0,0 +1,11 @@
+#ifndef nobd_RL_H
+#define nobd_RL_H
+
+#include "nobd_ev.h"
+
+int nobd_rl_init(void);
+void nobd_rl_exit(void);
+int nobd_rl_admit(int class);
+int nobd_rl_class(const struct nobd_ev *ev);
+const char *nobd_rl_name(int class);
+#endif /* nobd_RL_H */
@@ -0,0 +1,26 @@
+#ifndef nobd_RT_H
+#define nobd_RT_H
+
+#include "nobd_ev.h"
+
+struct in6_addr;
+
+/* a route of a mirrored main table, addresses in network order */
+struct nobd_rt_route {
+	union nobd_addr dst;
+	union nobd_addr gw;
+	u32 oif;
+	u8 dst_len;
+	u8 family;
+};
+
+int nobd_rt_init(void);
+void nobd_rt_exit(void);
+void nobd_rt_update(const struct nobd_ev_route *rec);
+
+/* exported to offload agents, all return 0 or -ENOENT */
+int nobd_rt_lookup(__be32 daddr, struct nobd_rt_route *rt);
+int nobd_rt6_lookup(const struct in6_addr *daddr, struct nobd_rt_route *rt);
+int nobd_rt_get(u8 family, const union nobd_addr *dst, u8 dst_len,
+		struct nobd_rt_route *rt);
+#endif /* nobd_RT_H */
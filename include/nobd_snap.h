@@ -0,0 +1,25 @@
+#ifndef nobd_SNAP_H
+#define nobd_SNAP_H
+
+#include "nobd_ev.h"
+
+/*
+ * Where a stage walker stands. Walkers return 1 once their stage is done,
+ * 0 when the run's budget is spent and -ENOSPC when the ring has no room,
+ * the next run resumes from the cursor.
+ */
+struct nobd_snap_cur {
+	u32 id;			/* of the snapshot */
+	int netns;		/* namespace walked, see nobd_net_next() */
+	unsigned int pos;	/* bucket within the table */
+	unsigned long table;	/* identity of the table pos indexes */
+	unsigned int budget;	/* buckets left in this run */
+	u32 count;		/* records of the stage */
+	u32 lost;
+};
+
+int nobd_snap_init(void);
+void nobd_snap_exit(void);
+int nobd_snap_next(struct nobd_snap_cur *c);
+void nobd_snap_emit(struct nobd_snap_cur *c, const struct nobd_ev *ev);
+#endif /* nobd_SNAP_H */
@@ -0,0 +1,30 @@
+#ifndef nobd_STAT_H
+#define nobd_STAT_H
+
+#include <linux/sched.h>
+
+/* instrumented handlers, see /sys/kernel/debug/nobd/handlers */
+enum nobd_stat_id {
+	NOBD_ST_CT_EVENT,
+	NOBD_ST_NETDEV_EVENT,
+	NOBD_ST_NETDEV_VLAN,
+	NOBD_ST_NETDEV_BR_DEV,
+	NOBD_ST_NETDEV_BR_IF,
+	NOBD_ST_NETDEV_ETH,
+	NOBD_ST_NETDEV_PPPOX,
+	NOBD_ST_NL_DATA_READY,
+	NOBD_ST_NL_WORK,
+	NOBD_ST_FDB_SCAN,
+	NOBD_ST_PPPOE_FIND,
+	NOBD_ST_MAX
+};
+
+static inline u64 nobd_stat_start(void)
+{
+	return sched_clock();
+}
+
+int nobd_stat_init(void);
+void nobd_stat_exit(void);
+void nobd_stat_end(int id, u64 start);
+#endif /* nobd_STAT_H */
@@ -0,0 +1,9 @@
+#ifndef nobd_TOP_H
+#define nobd_TOP_H
+
+#include "nobd_ev.h"
+
+int nobd_top_init(void);
+void nobd_top_exit(void);
+void nobd_top_add(const struct nobd_ev_ct *rec, u16 netns);
+#endif /* nobd_TOP_H */
@@ -1,152 +1,349 @@
 #include <linux/list.h>
-#include <linux/timer.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
+#include <linux/etherdevice.h>
+#include <linux/jhash.h>
 #include <br_private.h>
 #include "include/nobd_br.h"
+#include "include/nobd_ring.h"
+#include "include/nobd_stat.h"
+#include "include/nobd_net.h"
+#include "include/nobd_snap.h"
 
 #undef pr_fmt
 #define pr_fmt(fmt) "nobd_br: " fmt
 
-/* sample rate of Linux br */
+/* sample rate of Linux br, a full sweep of every bridge takes this long */
 #define nobd_FDB_TO (5 *HZ)
 
-DEFINE_SPINLOCK(nobd_fdb_lock);
+static unsigned int fdb_scan_budget = 16;
+module_param(fdb_scan_budget, uint, 0644);
+MODULE_PARM_DESC(fdb_scan_budget, "fdb buckets scanned per bridge per tick");
 
-static struct timer_list nobd_fdb_timer;
+static DEFINE_MUTEX(nobd_fdb_lock);
+
+static void nobd_fdb_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(nobd_fdb_work, nobd_fdb_work_fn);
 static struct list_head nobd_br_list = LIST_HEAD_INIT(nobd_br_list);
+/*
+ * The shadow is what was last reported, hashed on our own as br_fdb.c's
+ * salt is private to it. A sweep walks br->hash a few buckets a tick
+ * marking what it sees with gen, entries left unmarked once it wraps are
+ * gone.
+ */
 struct br_element {
 	struct list_head list;
 	struct net_bridge *br;
+	u32 gen;		/* of the running sweep */
+	unsigned int cursor;	/* next bucket to diff */
+	u32 snap_id;		/* last snapshot that walked it all */
+	u32 walk_id;		/* snapshot snap_pos belongs to */
+	unsigned int snap_pos;	/* next bucket of that one */
+	struct hlist_head shadow[BR_HASH_SIZE];
 };
 
-#define MAC_ADDR(mac) \
-	mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]
-#ifndef MAC_FMT
-#define MAC_FMT "%02x:%02x:%02x:%02x:%02x:%02x"
-#endif
+struct nobd_fdb_shadow {
+	struct hlist_node hnode;
+	u32 port;
+	u32 gen;
+	u8 mac[ETH_ALEN];
+	u8 flags;
+};
 
-/* taken from br_fbd.c br_fdb_fillbuf() */
-static int nobd_br_fdb_read(struct net_bridge *br)
+static void nobd_br_fdb_record(struct net_bridge *br, u16 netns,
+			       struct nobd_fdb_shadow *s, u8 op, u32 old_port,
+			       u32 age)
 {
-	unsigned int i;
+	struct nobd_ev *ev;
+	unsigned long flags;
+
+	ev = nobd_ev_reserve(NOBD_EV_FDB, &flags);
+	if (!ev)
+		return;
+	ev->hdr.netns = netns;
+	ev->fdb.br_ifindex = br->dev->ifindex;
+	ev->fdb.port_ifindex = s->port;
+	ev->fdb.old_port_ifindex = old_port;
+	memcpy(ev->fdb.mac, s->mac, sizeof(ev->fdb.mac));
+	ev->fdb.flags = s->flags;
+	ev->fdb.age = age;
+	ev->fdb.op = op;
+	nobd_ev_commit(ev, flags);
+}
+
+static struct hlist_head *nobd_fdb_bucket(struct br_element *el,
+					  const unsigned char *mac)
+{
+	return &el->shadow[jhash(mac, ETH_ALEN, 0) & (BR_HASH_SIZE - 1)];
+}
+
+static struct nobd_fdb_shadow *nobd_fdb_shadow_find(struct hlist_head *head,
+						    const unsigned char *mac)
+{
+	struct nobd_fdb_shadow *s;
 	struct hlist_node *h;
+
+	hlist_for_each_entry(s, h, head, hnode) {
+		if (!compare_ether_addr(s->mac, mac))
+			return s;
+	}
+	return NULL;
+}
+
+static void nobd_fdb_shadow_flush(struct br_element *el)
+{
+	struct nobd_fdb_shadow *s;
+	struct hlist_node *h, *tmp;
+	unsigned int i;
+
+	for (i = 0; i < BR_HASH_SIZE; i++) {
+		hlist_for_each_entry_safe(s, h, tmp, &el->shadow[i], hnode) {
+			hlist_del(&s->hnode);
+			kfree(s);
+		}
+	}
+}
+
+/* reports the entry if it is new or differs from the shadow, and marks it */
+static void nobd_br_fdb_apply(struct br_element *el, int netns,
+			      const unsigned char *mac, u32 port, u8 flags,
+			      u32 age)
+{
+	struct hlist_head *head = nobd_fdb_bucket(el, mac);
+	struct nobd_fdb_shadow *s;
+	u32 old;
+
+	s = nobd_fdb_shadow_find(head, mac);
+	if (!s) {
+		s = kmalloc(sizeof(*s), GFP_ATOMIC);
+		if (!s)
+			return;
+		memcpy(s->mac, mac, ETH_ALEN);
+		s->port = port;
+		s->flags = flags;
+		hlist_add_head(&s->hnode, head);
+		nobd_br_fdb_record(el->br, netns, s, NOBD_OP_NEW, 0, age);
+	} else if (s->port != port) {
+		old = s->port;
+		s->port = port;
+		s->flags = flags;
+		nobd_br_fdb_record(el->br, netns, s, NOBD_OP_MOVE, old, age);
+	} else if (s->flags != flags) {
+		s->flags = flags;
+		nobd_br_fdb_record(el->br, netns, s, NOBD_OP_CHANGE, 0, age);
+	}
+	s->gen = el->gen;
+}
+
+static void nobd_br_fdb_forget(struct br_element *el, int netns,
+			       struct nobd_fdb_shadow *s)
+{
+	nobd_br_fdb_record(el->br, netns, s, NOBD_OP_DEL, 0, 0);
+	hlist_del(&s->hnode);
+	kfree(s);
+}
+
+/* report learned, moved and changed entries of one bucket of br->hash */
+static void nobd_br_fdb_diff(struct br_element *el, int netns, unsigned int i)
+{
+	struct net_bridge *br = el->br;
 	struct net_bridge_fdb_entry *f;
+	struct hlist_node *h;
 
-	pr_info("%s\n", __func__);
 	rcu_read_lock();
+	hlist_for_each_entry_rcu(f, h, &br->hash[i], hlist) {
+		u32 age = f->is_static ? 0 :
+			jiffies_to_clock_t(jiffies - f->ageing_timer);
+
+		nobd_br_fdb_apply(el, netns, f->addr.addr,
+				  f->dst ? f->dst->dev->ifindex : 0,
+				  (f->is_local ? NOBD_FDB_LOCAL : 0) |
+				  (f->is_static ? NOBD_FDB_STATIC : 0),
+				  age);
+	}
+	rcu_read_unlock();
+}
+
+/* end of a sweep, what it did not see has aged out */
+static void nobd_br_fdb_sweep(struct br_element *el, int netns)
+{
+	struct nobd_fdb_shadow *s;
+	struct hlist_node *h, *tmp;
+	unsigned int i;
+
 	for (i = 0; i < BR_HASH_SIZE; i++) {
-		hlist_for_each_entry_rcu(f, h, &br->hash[i], hlist) {
-/*      		if (has_expired(br, f))
-				continue;
-
-			if (!f->is_static)
-				fe->ageing_timer_value = jiffies_to_clock_t(jiffies - f->ageing_timer);
-*/
-			pr_info("br %s fdb[%u]: " MAC_FMT ", port:%s, local:%u, "
-				"static:%u, timeout:%lu\n",
-			       br->dev->name, i, MAC_ADDR(f->addr.addr), f->dst->dev->name,
-			       f->is_local, f->is_static,
-			       f->is_static ? 0 : 
-				(jiffies_to_clock_t(jiffies - f->ageing_timer)));
+		hlist_for_each_entry_safe(s, h, tmp, &el->shadow[i], hnode) {
+			if (s->gen != el->gen)
+				nobd_br_fdb_forget(el, netns, s);
 		}
 	}
-	rcu_read_unlock();
+}
 
-	return i;
+/* spread a full sweep of BR_HASH_SIZE buckets over nobd_FDB_TO */
+static unsigned long nobd_fdb_tick(unsigned int budget)
+{
+	return max_t(unsigned long, nobd_FDB_TO * budget / BR_HASH_SIZE, 1);
 }
 
 int nobd_br_reg(struct net_bridge *br)
 {
-	struct list_head *p;
 	struct br_element *el = NULL;
+	unsigned int i;
 	int ret = 0;
 
 	pr_info("%s br %s\n", __func__,br->dev->name);
-	del_timer(&nobd_fdb_timer);
-	spin_lock_bh(&nobd_fdb_lock);
-	list_for_each(p, &nobd_br_list) {
-		el = list_entry(p, struct br_element, list);
+	mutex_lock(&nobd_fdb_lock);
+	list_for_each_entry(el, &nobd_br_list, list) {
 		if (el->br == br)
 			goto out;
 	}
-	el = kmalloc(sizeof(struct br_element), GFP_ATOMIC);
+	el = kmalloc(sizeof(struct br_element), GFP_KERNEL);
 	if (!el) {
 		pr_err("insufficient mm for br_element\n");
 		ret = -ENOMEM;
 		goto out;
 	}
 	el->br = br;
+	el->gen = 0;
+	el->cursor = 0;
+	el->snap_id = 0;
+	el->walk_id = 0;
+	el->snap_pos = 0;
+	for (i = 0; i < BR_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&el->shadow[i]);
 	INIT_LIST_HEAD(&el->list);
 	list_add_tail(&el->list, &nobd_br_list);
 out:
-	spin_unlock_bh(&nobd_fdb_lock);
-	if (!list_empty(&nobd_br_list))
-		mod_timer(&nobd_fdb_timer, jiffies + HZ);
+	mutex_unlock(&nobd_fdb_lock);
+	schedule_delayed_work(&nobd_fdb_work, HZ);
 
 	return ret;
 }
 
 int nobd_br_unreg(struct net_bridge *br)
 {
-	struct list_head *p, *tmp;
-	struct br_element *el = NULL;
+	struct br_element *el, *tmp;
 
 	pr_info("%s br %s\n", __func__,br->dev->name);
-	del_timer(&nobd_fdb_timer);
-	spin_lock_bh(&nobd_fdb_lock);
-	list_for_each_safe(p, tmp, &nobd_br_list) {
-		el = list_entry(p, struct br_element, list);
+	mutex_lock(&nobd_fdb_lock);
+	list_for_each_entry_safe(el, tmp, &nobd_br_list, list) {
 		if (el->br == br) {
-			list_del(p);
+			list_del(&el->list);
+			nobd_fdb_shadow_flush(el);
 			el->br = NULL;
 			kfree(el);
 			break;
 		}
 	}
-	spin_unlock_bh(&nobd_fdb_lock);
-	if (!list_empty(&nobd_br_list))
-		mod_timer(&nobd_fdb_timer, jiffies + HZ);
+	mutex_unlock(&nobd_fdb_lock);
 
 	return 0;
 }
 
-static void nobd_fdb_timer_expired(unsigned long unused)
+/*
+ * Snapshot of the shadows, which is what was reported. Each bridge keeps
+ * its own place so those coming and going in between don't shift it, and
+ * entries not scanned yet are reported as new by the scan anyway.
+ */
+int nobd_br_snap(struct nobd_snap_cur *c)
 {
-	struct list_head *p;
-	struct br_element *el = NULL;
+	struct br_element *el;
+	struct nobd_fdb_shadow *s;
+	struct hlist_node *h;
+	struct nobd_ev ev;
+	int netns, rc = 1;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.hdr.type = NOBD_EV_FDB;
+	ev.fdb.op = NOBD_OP_NEW;
+	mutex_lock(&nobd_fdb_lock);
+	list_for_each_entry(el, &nobd_br_list, list) {
+		if (el->snap_id == c->id)
+			continue;
+		/* a walk left by a stopped snapshot starts over */
+		if (el->walk_id != c->id) {
+			el->walk_id = c->id;
+			el->snap_pos = 0;
+		}
+		netns = nobd_net_id(dev_net(el->br->dev));
+		for (; netns >= 0 && el->snap_pos < BR_HASH_SIZE;
+		     el->snap_pos++) {
+			rc = nobd_snap_next(c);
+			if (rc <= 0)
+				goto out;
+			ev.hdr.netns = netns;
+			ev.fdb.br_ifindex = el->br->dev->ifindex;
+			hlist_for_each_entry(s, h, &el->shadow[el->snap_pos],
+					     hnode) {
+				ev.fdb.port_ifindex = s->port;
+				memcpy(ev.fdb.mac, s->mac, sizeof(ev.fdb.mac));
+				ev.fdb.flags = s->flags;
+				nobd_snap_emit(c, &ev);
+			}
+		}
+		el->snap_id = c->id;
+		el->snap_pos = 0;
+	}
+	rc = 1;
+out:
+	mutex_unlock(&nobd_fdb_lock);
+	return rc;
+}
 
-	spin_lock_bh(&nobd_fdb_lock);
-	list_for_each(p, &nobd_br_list) {
-		el = list_entry(p, struct br_element, list);
-		nobd_br_fdb_read(el->br);
+/* diffs fdb_scan_budget buckets of every bridge, resuming at its cursor */
+static void nobd_fdb_work_fn(struct work_struct *work)
+{
+	struct br_element *el;
+	unsigned int budget = clamp_t(unsigned int, fdb_scan_budget, 1,
+				      BR_HASH_SIZE);
+	unsigned int n;
+	int empty, netns;
+	u64 start = nobd_stat_start();
+
+	mutex_lock(&nobd_fdb_lock);
+	list_for_each_entry(el, &nobd_br_list, list) {
+		netns = nobd_net_id(dev_net(el->br->dev));
+		/* being unregistered by nobd_net_disable() */
+		if (netns < 0)
+			continue;
+		for (n = 0; n < budget; n++) {
+			if (!el->cursor)
+				el->gen++;
+			nobd_br_fdb_diff(el, netns, el->cursor);
+			el->cursor = (el->cursor + 1) & (BR_HASH_SIZE - 1);
+			if (!el->cursor)
+				nobd_br_fdb_sweep(el, netns);
+		}
+		cond_resched();
 	}
-	spin_unlock_bh(&nobd_fdb_lock);
+	empty = list_empty(&nobd_br_list);
+	mutex_unlock(&nobd_fdb_lock);
+	nobd_stat_end(NOBD_ST_FDB_SCAN, start);
 
-	mod_timer(&nobd_fdb_timer, jiffies + nobd_FDB_TO);
+	if (!empty)
+		schedule_delayed_work(&nobd_fdb_work, nobd_fdb_tick(budget));
 }
 
 int __init nobd_br_fdb_init(void)
 {
 	pr_info("%s\n", __func__);
 
-	init_timer(&nobd_fdb_timer);
-	nobd_fdb_timer.function = &nobd_fdb_timer_expired;
 	return 0;
 }
 
-void __exit nobd_br_fdb_exit(void)
+void nobd_br_fdb_exit(void)
 {
-	struct list_head *p, *tmp;
-	struct br_element *el = NULL;
+	struct br_element *el, *tmp;
 
 	pr_info("%s\n", __func__);
 
-	del_timer(&nobd_fdb_timer);
-	spin_lock_bh(&nobd_fdb_lock);
-	list_for_each_safe(p, tmp, &nobd_br_list) {
-		el = list_entry(p, struct br_element, list);
-		list_del(p);
+	cancel_delayed_work_sync(&nobd_fdb_work);
+	mutex_lock(&nobd_fdb_lock);
+	list_for_each_entry_safe(el, tmp, &nobd_br_list, list) {
+		list_del(&el->list);
+		nobd_fdb_shadow_flush(el);
 		el->br = NULL;
 		kfree(el);
 	}
-	spin_unlock_bh(&nobd_fdb_lock);
+	mutex_unlock(&nobd_fdb_lock);
 }
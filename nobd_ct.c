@@ -0,0 +1,483 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      Conntrack event coalescing.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/list.h>
+#include <linux/hash.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/rcupdate.h>
+#include <linux/version.h>
+#include <net/netfilter/nf_conntrack_helper.h>
+
+#include "include/nobd_ct.h"
+#include "include/nobd_ring.h"
+#include "include/nobd_proc.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt) "nobd_ct: " fmt
+
+#define NOBD_CT_HBITS	10
+#define NOBD_CT_HELPERS	32
+
+static unsigned int ct_coalesce_ms;
+module_param(ct_coalesce_ms, uint, 0644);
+MODULE_PARM_DESC(ct_coalesce_ms, "conntrack coalescing window in ms, 0 disables");
+
+static unsigned int ct_coalesce_max = 16384;
+module_param(ct_coalesce_max, uint, 0644);
+MODULE_PARM_DESC(ct_coalesce_max, "max flows held in the coalescing window");
+
+static unsigned int ct_track_max = 65536;
+module_param(ct_track_max, uint, 0444);
+MODULE_PARM_DESC(ct_track_max, "conntracks whose start is kept to time them, 0 disables");
+
+/*
+ * A flow waiting for its window to close. The record is built at the first
+ * event, so flushing never touches the conntrack again.
+ */
+struct nobd_ct_flow {
+	struct hlist_node hnode;
+	struct list_head fifo;
+	const void *key;
+	unsigned long first;
+	u64 ts;			/* of the first event, ns */
+	u16 netns;
+	struct nobd_ev_ct rec;
+};
+
+static DEFINE_SPINLOCK(nobd_ct_lock);
+static struct hlist_head nobd_ct_hash[1 << NOBD_CT_HBITS];
+static LIST_HEAD(nobd_ct_fifo);		/* oldest first */
+static unsigned int nobd_ct_count;
+static struct kmem_cache *nobd_ct_cache;
+static struct timer_list nobd_ct_timer;
+
+/*
+ * Start of every conntrack seen created, so its end record can carry the
+ * lifetime. Keyed by the conntrack's address, the conntrack itself is
+ * never written; the entry goes with the destroy event. Buckets are
+ * locked on their own, new and destroy run on every cpu.
+ */
+struct nobd_ct_start {
+	struct hlist_node hnode;
+	const void *key;
+	unsigned long start;
+};
+
+struct nobd_ct_bucket {
+	spinlock_t lock;
+	struct hlist_head head;
+};
+
+static struct nobd_ct_bucket *nobd_ct_track;
+static unsigned int nobd_ct_track_bits;
+static atomic_t nobd_ct_tracked = ATOMIC_INIT(0);
+static struct kmem_cache *nobd_ct_start_cache;
+
+/*
+ * Records carry a helper id instead of its name to leave room for IPv6
+ * tuples. Ids are handed out on first sight and never reused, so the
+ * names can be read without the lock.
+ */
+static DEFINE_SPINLOCK(nobd_ct_helper_lock);
+static char nobd_ct_helpers[NOBD_CT_HELPERS][16];
+static unsigned int nobd_ct_nr_helpers = 1;	/* 0 is no helper */
+
+u8 nobd_ct_helper_id(const char *name)
+{
+	unsigned int i, n = ACCESS_ONCE(nobd_ct_nr_helpers);
+
+	smp_rmb();
+	for (i = 1; i < n; i++) {
+		if (!strncmp(nobd_ct_helpers[i], name, 16))
+			return i;
+	}
+
+	spin_lock_bh(&nobd_ct_helper_lock);
+	for (i = n; i < nobd_ct_nr_helpers; i++) {
+		if (!strncmp(nobd_ct_helpers[i], name, 16))
+			goto out;
+	}
+	if (i == NOBD_CT_HELPERS) {
+		i = 0;
+		goto out;
+	}
+	strlcpy(nobd_ct_helpers[i], name, sizeof(nobd_ct_helpers[i]));
+	smp_wmb();
+	nobd_ct_nr_helpers = i + 1;
+out:
+	spin_unlock_bh(&nobd_ct_helper_lock);
+	return i;
+}
+
+/* conntrack knows of a helper called name */
+static int nobd_ct_helper_known(const char *name)
+{
+	int known;
+
+	rcu_read_lock();
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,37)
+	known = __nf_conntrack_helper_find_byname(name) != NULL;
+#else
+	known = __nf_conntrack_helper_find(name, AF_INET, IPPROTO_TCP) ||
+		__nf_conntrack_helper_find(name, AF_INET, IPPROTO_UDP) ||
+		__nf_conntrack_helper_find(name, AF_INET6, IPPROTO_TCP) ||
+		__nf_conntrack_helper_find(name, AF_INET6, IPPROTO_UDP);
+#endif
+	rcu_read_unlock();
+	return known;
+}
+
+/*
+ * As nobd_ct_helper_id, for names typed by the user: only a helper seen
+ * already or registered with conntrack takes an id, 0 for anything else.
+ */
+u8 nobd_ct_helper_get(const char *name)
+{
+	unsigned int i, n = ACCESS_ONCE(nobd_ct_nr_helpers);
+
+	smp_rmb();
+	for (i = 1; i < n; i++) {
+		if (!strncmp(nobd_ct_helpers[i], name, 16))
+			return i;
+	}
+	return nobd_ct_helper_known(name) ? nobd_ct_helper_id(name) : 0;
+}
+
+const char *nobd_ct_helper_name(u8 id)
+{
+	if (!id || id >= ACCESS_ONCE(nobd_ct_nr_helpers))
+		return NULL;
+	smp_rmb();
+	return nobd_ct_helpers[id];
+}
+
+static int nobd_ct_helpers_show(struct seq_file *m, void *v)
+{
+	unsigned int i, n = ACCESS_ONCE(nobd_ct_nr_helpers);
+
+	smp_rmb();
+	for (i = 1; i < n; i++)
+		seq_printf(m, "%u %.16s\n", i, nobd_ct_helpers[i]);
+	return 0;
+}
+
+static int nobd_ct_helpers_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nobd_ct_helpers_show, NULL);
+}
+
+static const struct file_operations nobd_ct_helpers_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_ct_helpers_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* ts of 0 stamps the record when it is published */
+static void nobd_ct_emit_at(const struct nobd_ev_ct *rec, u16 netns, u64 ts)
+{
+	struct nobd_ev *ev;
+	unsigned long flags;
+
+	ev = nobd_ev_reserve(NOBD_EV_CT, &flags);
+	if (!ev)
+		return;
+	ev->hdr.netns = netns;
+	ev->hdr.ts = ts;
+	memcpy(&ev->ct, rec, sizeof(*rec));
+	nobd_ev_commit(ev, flags);
+}
+
+void nobd_ct_emit(const struct nobd_ev_ct *rec, u16 netns)
+{
+	nobd_ct_emit_at(rec, netns, 0);
+}
+
+static struct nobd_ct_flow *nobd_ct_find(const void *key)
+{
+	struct nobd_ct_flow *fl;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(fl, n, &nobd_ct_hash[hash_ptr(key, NOBD_CT_HBITS)],
+			     hnode) {
+		if (fl->key == key)
+			return fl;
+	}
+	return NULL;
+}
+
+static inline void nobd_ct_merged(struct nobd_ev_ct *rec)
+{
+	if (rec->count != 0xffff)
+		rec->count++;
+}
+
+static void nobd_ct_unlink(struct nobd_ct_flow *fl)
+{
+	hlist_del(&fl->hnode);
+	list_del(&fl->fifo);
+	nobd_ct_count--;
+}
+
+/*
+ * Called for every event of a conntrack with its prebuilt record. Returns
+ * non zero when the event was absorbed by the window, either merged into a
+ * pending flow or folded into a short flow summary.
+ */
+int nobd_ct_coalesce(const void *key, struct nobd_ev_ct *rec, u16 netns)
+{
+	unsigned long window = msecs_to_jiffies(ct_coalesce_ms);
+	struct nobd_ct_flow *fl;
+
+	if (!ct_coalesce_ms)
+		return 0;
+
+	spin_lock_bh(&nobd_ct_lock);
+	fl = nobd_ct_find(key);
+	if (rec->op == NOBD_CT_DESTROY || rec->op == NOBD_CT_TIMEOUT ||
+	    rec->op == NOBD_CT_CLOSED) {
+		if (!fl) {
+			spin_unlock_bh(&nobd_ct_lock);
+			return 0;
+		}
+		nobd_ct_unlink(fl);
+		spin_unlock_bh(&nobd_ct_lock);
+
+		fl->rec.op = NOBD_CT_SHORT;
+		nobd_ct_merged(&fl->rec);
+		fl->rec.duration = jiffies_to_msecs(jiffies - fl->first);
+		nobd_ct_emit_at(&fl->rec, fl->netns, fl->ts);
+		kmem_cache_free(nobd_ct_cache, fl);
+		return 1;
+	}
+
+	if (fl) {
+		nobd_ct_merged(&fl->rec);
+		if (rec->helper)
+			fl->rec.helper = rec->helper;
+		spin_unlock_bh(&nobd_ct_lock);
+		return 1;
+	}
+
+	if (nobd_ct_count >= ct_coalesce_max) {
+		spin_unlock_bh(&nobd_ct_lock);
+		return 0;
+	}
+	fl = kmem_cache_alloc(nobd_ct_cache, GFP_ATOMIC);
+	if (!fl) {
+		spin_unlock_bh(&nobd_ct_lock);
+		return 0;
+	}
+	fl->key = key;
+	fl->first = jiffies;
+	fl->ts = ktime_to_ns(ktime_get_real());
+	fl->netns = netns;
+	memcpy(&fl->rec, rec, sizeof(*rec));
+	fl->rec.count = 1;
+	hlist_add_head(&fl->hnode,
+		       &nobd_ct_hash[hash_ptr(key, NOBD_CT_HBITS)]);
+	list_add_tail(&fl->fifo, &nobd_ct_fifo);
+	if (!nobd_ct_count++)
+		mod_timer(&nobd_ct_timer, jiffies + window + 1);
+	spin_unlock_bh(&nobd_ct_lock);
+
+	return 1;
+}
+
+static struct nobd_ct_bucket *nobd_ct_track_bucket(const void *key)
+{
+	return &nobd_ct_track[hash_ptr(key, nobd_ct_track_bits)];
+}
+
+static struct nobd_ct_start *nobd_ct_track_find(struct nobd_ct_bucket *b,
+						const void *key)
+{
+	struct nobd_ct_start *st;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(st, n, &b->head, hnode) {
+		if (st->key == key)
+			return st;
+	}
+	return NULL;
+}
+
+/* a conntrack was created, a key seen again is a reused address */
+void nobd_ct_track_start(const void *key)
+{
+	struct nobd_ct_bucket *b;
+	struct nobd_ct_start *st;
+
+	if (!nobd_ct_track)
+		return;
+	b = nobd_ct_track_bucket(key);
+	spin_lock_bh(&b->lock);
+	st = nobd_ct_track_find(b, key);
+	if (!st) {
+		if (atomic_read(&nobd_ct_tracked) >= ct_track_max)
+			goto out;
+		st = kmem_cache_alloc(nobd_ct_start_cache, GFP_ATOMIC);
+		if (!st)
+			goto out;
+		st->key = key;
+		hlist_add_head(&st->hnode, &b->head);
+		atomic_inc(&nobd_ct_tracked);
+	}
+	st->start = jiffies;
+out:
+	spin_unlock_bh(&b->lock);
+}
+
+/* ms since the conntrack was created, 0 when that was not seen */
+u32 nobd_ct_track_end(const void *key)
+{
+	struct nobd_ct_bucket *b;
+	struct nobd_ct_start *st;
+	u32 ms;
+
+	if (!nobd_ct_track || !atomic_read(&nobd_ct_tracked))
+		return 0;
+	b = nobd_ct_track_bucket(key);
+	spin_lock_bh(&b->lock);
+	st = nobd_ct_track_find(b, key);
+	if (!st) {
+		spin_unlock_bh(&b->lock);
+		return 0;
+	}
+	hlist_del(&st->hnode);
+	spin_unlock_bh(&b->lock);
+	atomic_dec(&nobd_ct_tracked);
+
+	/* under 1ms still tells it was seen */
+	ms = max(jiffies_to_msecs(jiffies - st->start), 1U);
+	kmem_cache_free(nobd_ct_start_cache, st);
+	return ms;
+}
+
+/* one bucket per 8 conntracks at ct_track_max */
+static int nobd_ct_track_init(void)
+{
+	unsigned int i;
+
+	if (!ct_track_max)
+		return 0;
+	nobd_ct_start_cache = kmem_cache_create("nobd_ct_start",
+						sizeof(struct nobd_ct_start),
+						0, 0, NULL);
+	if (!nobd_ct_start_cache)
+		return -ENOMEM;
+	nobd_ct_track_bits = ilog2(roundup_pow_of_two(max(ct_track_max / 8,
+							  64U)));
+	nobd_ct_track = vmalloc(sizeof(*nobd_ct_track) <<
+				nobd_ct_track_bits);
+	if (!nobd_ct_track) {
+		kmem_cache_destroy(nobd_ct_start_cache);
+		return -ENOMEM;
+	}
+	for (i = 0; i < 1U << nobd_ct_track_bits; i++) {
+		spin_lock_init(&nobd_ct_track[i].lock);
+		INIT_HLIST_HEAD(&nobd_ct_track[i].head);
+	}
+	return 0;
+}
+
+static void nobd_ct_track_exit(void)
+{
+	struct nobd_ct_start *st;
+	struct hlist_node *n, *tmp;
+	unsigned int i;
+
+	if (!nobd_ct_track)
+		return;
+	for (i = 0; i < 1U << nobd_ct_track_bits; i++) {
+		hlist_for_each_entry_safe(st, n, tmp, &nobd_ct_track[i].head,
+					  hnode)
+			kmem_cache_free(nobd_ct_start_cache, st);
+	}
+	vfree(nobd_ct_track);
+	nobd_ct_track = NULL;
+	kmem_cache_destroy(nobd_ct_start_cache);
+}
+
+/* emit every flow whose window closed, all when force is set */
+static void nobd_ct_flush(int force)
+{
+	unsigned long window = msecs_to_jiffies(ct_coalesce_ms);
+	struct nobd_ct_flow *fl, *tmp;
+	LIST_HEAD(done);
+
+	spin_lock_bh(&nobd_ct_lock);
+	list_for_each_entry_safe(fl, tmp, &nobd_ct_fifo, fifo) {
+		if (!force && time_before(jiffies, fl->first + window))
+			break;
+		nobd_ct_unlink(fl);
+		list_add_tail(&fl->fifo, &done);
+	}
+	if (!force && !list_empty(&nobd_ct_fifo)) {
+		fl = list_first_entry(&nobd_ct_fifo, struct nobd_ct_flow, fifo);
+		mod_timer(&nobd_ct_timer, fl->first + window + 1);
+	}
+	spin_unlock_bh(&nobd_ct_lock);
+
+	list_for_each_entry_safe(fl, tmp, &done, fifo) {
+		nobd_ct_emit_at(&fl->rec, fl->netns, fl->ts);
+		kmem_cache_free(nobd_ct_cache, fl);
+	}
+}
+
+static void nobd_ct_timer_expired(unsigned long unused)
+{
+	nobd_ct_flush(0);
+}
+
+int nobd_ct_init(void)
+{
+	int i;
+
+	nobd_ct_cache = kmem_cache_create("nobd_ct_flow",
+					  sizeof(struct nobd_ct_flow), 0, 0,
+					  NULL);
+	if (!nobd_ct_cache)
+		return -ENOMEM;
+	if (nobd_ct_track_init()) {
+		kmem_cache_destroy(nobd_ct_cache);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(nobd_ct_hash); i++)
+		INIT_HLIST_HEAD(&nobd_ct_hash[i]);
+	setup_timer(&nobd_ct_timer, nobd_ct_timer_expired, 0);
+	proc_create("ct_helpers", 0444, nobd_proc_dir, &nobd_ct_helpers_fops);
+
+	return 0;
+}
+
+/* must be called after the conntrack notifier is gone */
+void nobd_ct_exit(void)
+{
+	remove_proc_entry("ct_helpers", nobd_proc_dir);
+	del_timer_sync(&nobd_ct_timer);
+	nobd_ct_flush(1);
+	kmem_cache_destroy(nobd_ct_cache);
+	nobd_ct_track_exit();
+}
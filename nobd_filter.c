@@ -0,0 +1,730 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      Event filter expressions, compiled once and run before recording.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/ctype.h>
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu.h>
+#include <linux/nsproxy.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/inet.h>
+#include <linux/uaccess.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <net/net_namespace.h>
+#include <asm/local.h>
+
+#include "include/nobd_filter.h"
+#include "include/nobd_ct.h"
+#include "include/nobd_proc.h"
+#include "include/nobd_net.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt) "nobd_filter: " fmt
+
+#define NOBD_FLT_MAX_INSN	64
+#define NOBD_FLT_MAX_DEPTH	8	/* nested parentheses */
+#define NOBD_FLT_MAX_TEXT	1024
+#define NOBD_FLT_TOKLEN		64
+
+/*
+ * Expressions are compiled to postfix and run on a stack of booleans.
+ * Primitives push whether the record matches them, the rest combine the
+ * top of the stack. A primitive that makes no sense for a record type,
+ * like a port on a link record, does not match it.
+ */
+enum nobd_flt_op {
+	NOBD_FLT_AND,
+	NOBD_FLT_OR,
+	NOBD_FLT_NOT,
+	NOBD_FLT_TYPE,		/* val: enum nobd_ev_type */
+	NOBD_FLT_FAMILY,	/* family */
+	NOBD_FLT_NET,		/* any address of the record in family/plen/w */
+	NOBD_FLT_SRC,
+	NOBD_FLT_DST,
+	NOBD_FLT_PORT,		/* val: either port, network order */
+	NOBD_FLT_SPORT,
+	NOBD_FLT_DPORT,
+	NOBD_FLT_PROTO,
+	NOBD_FLT_IF,		/* val: any ifindex of the record, in ns */
+	NOBD_FLT_MAC,
+	NOBD_FLT_HELPER,	/* val: ct helper id */
+};
+
+struct nobd_flt_insn {
+	u8 op;
+	u8 family;
+	u8 plen;
+	u8 pad;
+	u32 val;
+	int ns;			/* NOBD_FLT_IF: namespace id, -1 for any */
+	union {
+		u32 w[4];	/* prefix in host order, masked to plen */
+		u8 mac[ETH_ALEN];
+	};
+};
+
+struct nobd_flt_prog {
+	char *text;
+	unsigned int len;
+	struct nobd_flt_insn insn[0];
+};
+
+struct nobd_flt_parse {
+	char *p;
+	char tok[NOBD_FLT_TOKLEN];
+	int have;		/* tok is peeked but not consumed */
+	int depth;
+	struct nobd_flt_prog *prog;
+};
+
+static struct nobd_flt_prog *nobd_flt;
+static DEFINE_MUTEX(nobd_flt_lock);
+static DEFINE_PER_CPU(local_t, nobd_flt_dropped[NOBD_EV_MAX]);
+
+static const char *nobd_flt_types[NOBD_EV_MAX] = {
+	[NOBD_EV_CT]	= "ct",
+	[NOBD_EV_ROUTE]	= "route",
+	[NOBD_EV_NEIGH]	= "neigh",
+	[NOBD_EV_LINK]	= "link",
+	[NOBD_EV_FDB]	= "fdb",
+	[NOBD_EV_VLAN]	= "vlan",
+	[NOBD_EV_PPPOE]	= "pppoe",
+	[NOBD_EV_DROPS]	= "drops",
+};
+
+static int nobd_flt_prefix(const struct nobd_flt_insn *in, u8 family,
+			   const union nobd_addr *a)
+{
+	unsigned int i, bits = in->plen;
+	u32 mask;
+
+	if (family != in->family)
+		return 0;
+	for (i = 0; bits; i++) {
+		mask = bits >= 32 ? ~0U : ~0U << (32 - bits);
+		if ((ntohl(a->ip6[i]) & mask) != in->w[i])
+			return 0;
+		bits -= min(bits, 32U);
+	}
+	return 1;
+}
+
+static int nobd_flt_addr(const struct nobd_flt_insn *in, u8 type,
+			 const void *body)
+{
+	const struct nobd_ev_ct *ct = body;
+	const struct nobd_ev_route *rt = body;
+	const struct nobd_ev_neigh *ne = body;
+
+	switch (type) {
+	case NOBD_EV_CT:
+		if (in->op != NOBD_FLT_DST &&
+		    nobd_flt_prefix(in, ct->family, &ct->src))
+			return 1;
+		return in->op != NOBD_FLT_SRC &&
+			nobd_flt_prefix(in, ct->family, &ct->dst);
+	case NOBD_EV_ROUTE:
+		/* the route prefix must lie within the filter's */
+		return in->op != NOBD_FLT_SRC && rt->dst_len >= in->plen &&
+			nobd_flt_prefix(in, rt->family, &rt->dst);
+	case NOBD_EV_NEIGH:
+		return in->op != NOBD_FLT_SRC &&
+			nobd_flt_prefix(in, ne->family, &ne->ip);
+	}
+	return 0;
+}
+
+static int nobd_flt_if(u32 ifindex, u8 type, const void *body)
+{
+	const struct nobd_ev_route *rt = body;
+	const struct nobd_ev_neigh *ne = body;
+	const struct nobd_ev_link *ln = body;
+	const struct nobd_ev_fdb *fdb = body;
+	const struct nobd_ev_vlan *vl = body;
+	const struct nobd_ev_pppoe *pp = body;
+
+	switch (type) {
+	case NOBD_EV_ROUTE:
+		return rt->oif == ifindex;
+	case NOBD_EV_NEIGH:
+		return ne->ifindex == ifindex;
+	case NOBD_EV_LINK:
+		return ln->ifindex == ifindex || ln->master == ifindex;
+	case NOBD_EV_FDB:
+		return fdb->br_ifindex == ifindex ||
+			fdb->port_ifindex == ifindex ||
+			fdb->old_port_ifindex == ifindex;
+	case NOBD_EV_VLAN:
+		return vl->ifindex == ifindex || vl->real_ifindex == ifindex;
+	case NOBD_EV_PPPOE:
+		return pp->ifindex == ifindex || pp->pppoe_ifindex == ifindex;
+	}
+	return 0;
+}
+
+static const u8 *nobd_flt_mac(u8 type, const void *body)
+{
+	switch (type) {
+	case NOBD_EV_NEIGH:
+		return ((const struct nobd_ev_neigh *)body)->lladdr;
+	case NOBD_EV_FDB:
+		return ((const struct nobd_ev_fdb *)body)->mac;
+	case NOBD_EV_PPPOE:
+		return ((const struct nobd_ev_pppoe *)body)->remote;
+	}
+	return NULL;
+}
+
+static int nobd_flt_family(u8 type, const void *body)
+{
+	switch (type) {
+	case NOBD_EV_CT:
+		return ((const struct nobd_ev_ct *)body)->family;
+	case NOBD_EV_ROUTE:
+		return ((const struct nobd_ev_route *)body)->family;
+	case NOBD_EV_NEIGH:
+		return ((const struct nobd_ev_neigh *)body)->family;
+	}
+	return AF_UNSPEC;
+}
+
+static int nobd_flt_run(const struct nobd_flt_prog *prog, u8 type, u16 netns,
+			const void *body)
+{
+	const struct nobd_ev_ct *ct = body;
+	u8 st[NOBD_FLT_MAX_INSN];
+	const struct nobd_flt_insn *in;
+	const u8 *mac;
+	unsigned int i, sp = 0;
+	int r;
+
+	for (i = 0; i < prog->len; i++) {
+		in = &prog->insn[i];
+		switch (in->op) {
+		case NOBD_FLT_AND:
+			sp--;
+			st[sp - 1] &= st[sp];
+			continue;
+		case NOBD_FLT_OR:
+			sp--;
+			st[sp - 1] |= st[sp];
+			continue;
+		case NOBD_FLT_NOT:
+			st[sp - 1] = !st[sp - 1];
+			continue;
+		case NOBD_FLT_TYPE:
+			r = type == in->val;
+			break;
+		case NOBD_FLT_FAMILY:
+			r = nobd_flt_family(type, body) == in->family;
+			break;
+		case NOBD_FLT_NET:
+		case NOBD_FLT_SRC:
+		case NOBD_FLT_DST:
+			r = nobd_flt_addr(in, type, body);
+			break;
+		case NOBD_FLT_PORT:
+			r = type == NOBD_EV_CT &&
+				(ct->sport == in->val || ct->dport == in->val);
+			break;
+		case NOBD_FLT_SPORT:
+			r = type == NOBD_EV_CT && ct->sport == in->val;
+			break;
+		case NOBD_FLT_DPORT:
+			r = type == NOBD_EV_CT && ct->dport == in->val;
+			break;
+		case NOBD_FLT_PROTO:
+			r = type == NOBD_EV_CT && ct->proto == in->val;
+			break;
+		case NOBD_FLT_HELPER:
+			r = type == NOBD_EV_CT && ct->helper == in->val;
+			break;
+		case NOBD_FLT_IF:
+			r = (in->ns < 0 || in->ns == netns) &&
+				nobd_flt_if(in->val, type, body);
+			break;
+		case NOBD_FLT_MAC:
+			mac = nobd_flt_mac(type, body);
+			r = mac && !memcmp(mac, in->mac, ETH_ALEN);
+			break;
+		default:
+			r = 0;
+			break;
+		}
+		st[sp++] = r;
+	}
+	return st[0];
+}
+
+/*
+ * Returns non zero if a record of type from namespace netns whose payload
+ * is body should be recorded. Callable from any context.
+ */
+int nobd_flt_pass(u8 type, u16 netns, const void *body)
+{
+	const struct nobd_flt_prog *prog;
+	int pass = 1;
+
+	rcu_read_lock();
+	prog = rcu_dereference(nobd_flt);
+	if (prog)
+		pass = nobd_flt_run(prog, type, netns, body);
+	rcu_read_unlock();
+	if (!pass && type < NOBD_EV_MAX) {
+		local_inc(&get_cpu_var(nobd_flt_dropped)[type]);
+		put_cpu_var(nobd_flt_dropped);
+	}
+
+	return pass;
+}
+
+static int nobd_flt_parse_type(struct nobd_flt_insn *in, const char *arg)
+{
+	int i;
+
+	for (i = 0; i < NOBD_EV_MAX; i++) {
+		if (nobd_flt_types[i] && !strcmp(arg, nobd_flt_types[i])) {
+			in->val = i;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+/* address[/len], the family follows from the address */
+static int nobd_flt_parse_net(struct nobd_flt_insn *in, const char *arg)
+{
+	char buf[INET6_ADDRSTRLEN + 4];
+	union nobd_addr a;
+	unsigned long plen;
+	unsigned int i, bits, maxlen;
+	const char *end;
+	char *slash;
+
+	strlcpy(buf, arg, sizeof(buf));
+	slash = strchr(buf, '/');
+	if (slash)
+		*slash++ = '\0';
+	memset(&a, 0, sizeof(a));
+	if (strchr(buf, ':')) {
+		if (!in6_pton(buf, -1, a.b, '\0', &end))
+			return -EINVAL;
+		in->family = AF_INET6;
+		maxlen = 128;
+	} else {
+		if (!in4_pton(buf, -1, a.b, '\0', &end))
+			return -EINVAL;
+		in->family = AF_INET;
+		maxlen = 32;
+	}
+	plen = maxlen;
+	if (slash && (strict_strtoul(slash, 10, &plen) || plen > maxlen))
+		return -EINVAL;
+	in->plen = plen;
+
+	for (i = 0, bits = plen; bits; i++) {
+		in->w[i] = ntohl(a.ip6[i]);
+		if (bits < 32)
+			in->w[i] &= ~0U << (32 - bits);
+		bits -= min(bits, 32U);
+	}
+	return 0;
+}
+
+static int nobd_flt_parse_port(struct nobd_flt_insn *in, const char *arg)
+{
+	unsigned long port;
+
+	if (strict_strtoul(arg, 10, &port) || port > 65535)
+		return -EINVAL;
+	in->val = htons(port);
+	return 0;
+}
+
+static int nobd_flt_parse_proto(struct nobd_flt_insn *in, const char *arg)
+{
+	static const struct {
+		const char *name;
+		u8 proto;
+	} protos[] = {
+		{ "icmp",	IPPROTO_ICMP },
+		{ "tcp",	IPPROTO_TCP },
+		{ "udp",	IPPROTO_UDP },
+		{ "gre",	IPPROTO_GRE },
+		{ "esp",	IPPROTO_ESP },
+		{ "icmpv6",	IPPROTO_ICMPV6 },
+		{ "sctp",	IPPROTO_SCTP },
+	};
+	unsigned long proto;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(protos); i++) {
+		if (!strcmp(arg, protos[i].name)) {
+			in->val = protos[i].proto;
+			return 0;
+		}
+	}
+	if (strict_strtoul(arg, 10, &proto) || proto > 255)
+		return -EINVAL;
+	in->val = proto;
+	return 0;
+}
+
+/*
+ * An ifindex, matched in every namespace, or a name resolved now in the
+ * namespace of the writer, which must be monitored, and only matched
+ * there. A device renamed later won't match.
+ */
+static int nobd_flt_parse_if(struct nobd_flt_insn *in, const char *arg)
+{
+	struct net *net = current->nsproxy->net_ns;
+	struct net_device *dev;
+	unsigned long ifindex;
+
+	in->ns = -1;
+	if (!strict_strtoul(arg, 10, &ifindex)) {
+		if (!ifindex)
+			return -EINVAL;
+		in->val = ifindex;
+		return 0;
+	}
+	in->ns = nobd_net_id(net);
+	if (in->ns < 0)
+		return -EINVAL;
+	dev = dev_get_by_name(net, arg);
+	if (!dev)
+		return -ENODEV;
+	in->val = dev->ifindex;
+	dev_put(dev);
+	return 0;
+}
+
+static int nobd_flt_parse_mac(struct nobd_flt_insn *in, const char *arg)
+{
+	unsigned int m[ETH_ALEN];
+	char c;
+	int i;
+
+	if (sscanf(arg, "%x:%x:%x:%x:%x:%x%c", &m[0], &m[1], &m[2], &m[3],
+		   &m[4], &m[5], &c) != ETH_ALEN)
+		return -EINVAL;
+	for (i = 0; i < ETH_ALEN; i++) {
+		if (m[i] > 0xff)
+			return -EINVAL;
+		in->mac[i] = m[i];
+	}
+	return 0;
+}
+
+/* a helper seen already or registered with conntrack, typos take no id */
+static int nobd_flt_parse_helper(struct nobd_flt_insn *in, const char *arg)
+{
+	in->val = nobd_ct_helper_get(arg);
+	return in->val ? 0 : -ENOENT;
+}
+
+static const struct {
+	const char *name;
+	u8 op;
+	int (*parse)(struct nobd_flt_insn *in, const char *arg);
+} nobd_flt_prims[] = {
+	{ "type",	NOBD_FLT_TYPE,		nobd_flt_parse_type },
+	{ "net",	NOBD_FLT_NET,		nobd_flt_parse_net },
+	{ "src",	NOBD_FLT_SRC,		nobd_flt_parse_net },
+	{ "dst",	NOBD_FLT_DST,		nobd_flt_parse_net },
+	{ "port",	NOBD_FLT_PORT,		nobd_flt_parse_port },
+	{ "sport",	NOBD_FLT_SPORT,		nobd_flt_parse_port },
+	{ "dport",	NOBD_FLT_DPORT,		nobd_flt_parse_port },
+	{ "proto",	NOBD_FLT_PROTO,		nobd_flt_parse_proto },
+	{ "if",		NOBD_FLT_IF,		nobd_flt_parse_if },
+	{ "mac",	NOBD_FLT_MAC,		nobd_flt_parse_mac },
+	{ "helper",	NOBD_FLT_HELPER,	nobd_flt_parse_helper },
+};
+
+/* the next token without consuming it, "" at the end of the text */
+static const char *nobd_flt_peek(struct nobd_flt_parse *ps)
+{
+	char *p = ps->p;
+	unsigned int n = 0;
+
+	if (ps->have)
+		return ps->tok;
+	while (isspace(*p))
+		p++;
+	if (*p == '(' || *p == ')') {
+		ps->tok[n++] = *p++;
+	} else {
+		while (*p && !isspace(*p) && *p != '(' && *p != ')') {
+			if (n == NOBD_FLT_TOKLEN - 1)
+				break;
+			ps->tok[n++] = *p++;
+		}
+	}
+	ps->tok[n] = '\0';
+	ps->p = p;
+	ps->have = 1;
+	return ps->tok;
+}
+
+static void nobd_flt_take(struct nobd_flt_parse *ps)
+{
+	ps->have = 0;
+}
+
+static int nobd_flt_is(struct nobd_flt_parse *ps, const char *a, const char *b)
+{
+	const char *t = nobd_flt_peek(ps);
+
+	return !strcmp(t, a) || !strcmp(t, b);
+}
+
+static struct nobd_flt_insn *nobd_flt_emit(struct nobd_flt_parse *ps, u8 op)
+{
+	struct nobd_flt_insn *in;
+
+	if (ps->prog->len == NOBD_FLT_MAX_INSN)
+		return NULL;
+	in = &ps->prog->insn[ps->prog->len++];
+	memset(in, 0, sizeof(*in));
+	in->op = op;
+	return in;
+}
+
+static int nobd_flt_expr(struct nobd_flt_parse *ps);
+
+static int nobd_flt_prim(struct nobd_flt_parse *ps)
+{
+	struct nobd_flt_insn *in;
+	const char *arg;
+	int i, err;
+
+	if (nobd_flt_is(ps, "ip", "ip6")) {
+		in = nobd_flt_emit(ps, NOBD_FLT_FAMILY);
+		if (!in)
+			return -E2BIG;
+		in->family = ps->tok[2] ? AF_INET6 : AF_INET;
+		nobd_flt_take(ps);
+		return 0;
+	}
+	for (i = 0; i < ARRAY_SIZE(nobd_flt_prims); i++) {
+		if (!strcmp(ps->tok, nobd_flt_prims[i].name))
+			break;
+	}
+	if (i == ARRAY_SIZE(nobd_flt_prims))
+		return -EINVAL;
+	nobd_flt_take(ps);
+
+	arg = nobd_flt_peek(ps);
+	if (!*arg || *arg == '(' || *arg == ')')
+		return -EINVAL;
+	in = nobd_flt_emit(ps, nobd_flt_prims[i].op);
+	if (!in)
+		return -E2BIG;
+	err = nobd_flt_prims[i].parse(in, arg);
+	nobd_flt_take(ps);
+	return err;
+}
+
+static int nobd_flt_factor(struct nobd_flt_parse *ps)
+{
+	int err;
+
+	if (nobd_flt_is(ps, "not", "!")) {
+		nobd_flt_take(ps);
+		err = nobd_flt_factor(ps);
+		if (!err && !nobd_flt_emit(ps, NOBD_FLT_NOT))
+			err = -E2BIG;
+		return err;
+	}
+	if (!strcmp(ps->tok, "(")) {
+		nobd_flt_take(ps);
+		if (++ps->depth > NOBD_FLT_MAX_DEPTH)
+			return -EINVAL;
+		err = nobd_flt_expr(ps);
+		ps->depth--;
+		if (err)
+			return err;
+		if (strcmp(nobd_flt_peek(ps), ")"))
+			return -EINVAL;
+		nobd_flt_take(ps);
+		return 0;
+	}
+	return nobd_flt_prim(ps);
+}
+
+static int nobd_flt_term(struct nobd_flt_parse *ps)
+{
+	int err;
+
+	err = nobd_flt_factor(ps);
+	while (!err && nobd_flt_is(ps, "and", "&&")) {
+		nobd_flt_take(ps);
+		err = nobd_flt_factor(ps);
+		if (!err && !nobd_flt_emit(ps, NOBD_FLT_AND))
+			err = -E2BIG;
+	}
+	return err;
+}
+
+static int nobd_flt_expr(struct nobd_flt_parse *ps)
+{
+	int err;
+
+	err = nobd_flt_term(ps);
+	while (!err && nobd_flt_is(ps, "or", "||")) {
+		nobd_flt_take(ps);
+		err = nobd_flt_term(ps);
+		if (!err && !nobd_flt_emit(ps, NOBD_FLT_OR))
+			err = -E2BIG;
+	}
+	return err;
+}
+
+static struct nobd_flt_prog *nobd_flt_compile(char *text, int *err)
+{
+	struct nobd_flt_parse ps;
+
+	memset(&ps, 0, sizeof(ps));
+	ps.p = text;
+	ps.prog = kzalloc(sizeof(*ps.prog) +
+			  NOBD_FLT_MAX_INSN * sizeof(struct nobd_flt_insn),
+			  GFP_KERNEL);
+	if (!ps.prog) {
+		*err = -ENOMEM;
+		return NULL;
+	}
+	*err = nobd_flt_expr(&ps);
+	if (!*err && *nobd_flt_peek(&ps))
+		*err = -EINVAL;
+	if (*err) {
+		pr_info("bad filter near \"%s\"\n", ps.tok);
+		kfree(ps.prog);
+		return NULL;
+	}
+	ps.prog->text = text;
+	return ps.prog;
+}
+
+static void nobd_flt_swap(struct nobd_flt_prog *prog)
+{
+	struct nobd_flt_prog *old;
+
+	mutex_lock(&nobd_flt_lock);
+	old = nobd_flt;
+	rcu_assign_pointer(nobd_flt, prog);
+	mutex_unlock(&nobd_flt_lock);
+
+	if (old) {
+		synchronize_rcu();
+		kfree(old->text);
+		kfree(old);
+	}
+}
+
+/* the whole write is one expression, an empty one removes the filter */
+static ssize_t nobd_flt_write(struct file *file, const char __user *ubuf,
+			      size_t count, loff_t *ppos)
+{
+	struct nobd_flt_prog *prog = NULL;
+	char *text, *p;
+	int err;
+
+	if (count >= NOBD_FLT_MAX_TEXT)
+		return -E2BIG;
+	text = kmalloc(count + 1, GFP_KERNEL);
+	if (!text)
+		return -ENOMEM;
+	if (copy_from_user(text, ubuf, count)) {
+		kfree(text);
+		return -EFAULT;
+	}
+	text[count] = '\0';
+	for (p = text; *p; p++) {
+		if (isspace(*p))
+			*p = ' ';
+	}
+	p = strstrip(text);
+
+	if (*p) {
+		memmove(text, p, strlen(p) + 1);
+		prog = nobd_flt_compile(text, &err);
+		if (!prog) {
+			kfree(text);
+			return err;
+		}
+	} else {
+		kfree(text);
+	}
+	nobd_flt_swap(prog);
+
+	return count;
+}
+
+static int nobd_flt_show(struct seq_file *m, void *v)
+{
+	unsigned long dropped;
+	int i, cpu;
+
+	mutex_lock(&nobd_flt_lock);
+	seq_printf(m, "%s\n", nobd_flt ? nobd_flt->text : "none");
+	if (nobd_flt)
+		seq_printf(m, "# insns %u\n", nobd_flt->len);
+	mutex_unlock(&nobd_flt_lock);
+	for (i = 0; i < NOBD_EV_MAX; i++) {
+		if (!nobd_flt_types[i])
+			continue;
+		dropped = 0;
+		for_each_possible_cpu(cpu)
+			dropped += local_read(&per_cpu(nobd_flt_dropped,
+						       cpu)[i]);
+		seq_printf(m, "# %-6s dropped %lu\n", nobd_flt_types[i],
+			   dropped);
+	}
+	return 0;
+}
+
+static int nobd_flt_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nobd_flt_show, NULL);
+}
+
+static const struct file_operations nobd_flt_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_flt_open,
+	.read		= seq_read,
+	.write		= nobd_flt_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int nobd_flt_init(void)
+{
+	if (!proc_create("filter", 0600, nobd_proc_dir, &nobd_flt_fops))
+		return -ENOMEM;
+	return 0;
+}
+
+/* must be called once nothing records any more */
+void nobd_flt_exit(void)
+{
+	remove_proc_entry("filter", nobd_proc_dir);
+	nobd_flt_swap(NULL);
+}
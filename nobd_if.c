@@ -0,0 +1,264 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      Per interface state cache, classifies netdev events and drops repeats.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/hash.h>
+#include <linux/netdevice.h>
+#include <linux/if_arp.h>
+#include <linux/rtnetlink.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <net/net_namespace.h>
+#include <vlan.h>
+#include <br_private.h>
+
+#include "include/nobd_if.h"
+#include "include/nobd_net.h"
+#include "include/nobd_proc.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt) "nobd_if: " fmt
+
+#define NOBD_IF_HBITS	8
+
+static struct hlist_head nobd_if_hash[1 << NOBD_IF_HBITS];
+static unsigned int nobd_if_count;
+static unsigned long nobd_if_repeats;	/* events that changed nothing */
+
+static struct hlist_head *nobd_if_bucket(struct net *net, int ifindex)
+{
+	return &nobd_if_hash[hash_32(ifindex ^ (unsigned long)net,
+				     NOBD_IF_HBITS)];
+}
+
+static struct nobd_if *nobd_if_find(struct net_device *dev)
+{
+	struct net *net = dev_net(dev);
+	struct nobd_if *ifc;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(ifc, n, nobd_if_bucket(net, dev->ifindex),
+			     hnode) {
+		if (ifc->ifindex == dev->ifindex && ifc->net == net)
+			return ifc;
+	}
+	return NULL;
+}
+
+static u8 nobd_if_base(struct net_device *dev)
+{
+	if (dev->priv_flags & IFF_802_1Q_VLAN)
+		return NOBD_CLASS_VLAN;
+	if (dev->priv_flags & IFF_EBRIDGE)
+		return NOBD_CLASS_BRIDGE;
+	if (dev->type == ARPHRD_ETHER)
+		return NOBD_CLASS_ETH;
+	if (dev->type == ARPHRD_PPP)
+		return NOBD_CLASS_PPP;
+	return NOBD_IF_NONE;
+}
+
+/* any device but vlans and bridges is a port while enslaved */
+static u8 nobd_if_port(u8 base, struct net_device *dev)
+{
+	if (base == NOBD_CLASS_VLAN || base == NOBD_CLASS_BRIDGE ||
+	    !dev->br_port)
+		return base;
+	return NOBD_CLASS_BRPORT;
+}
+
+/* the class worked out from scratch, for devices not cached */
+u8 nobd_if_class(struct net_device *dev)
+{
+	return nobd_if_port(nobd_if_base(dev), dev);
+}
+
+/*
+ * The entry of dev, made on first sight so devices that predate the
+ * module or the monitoring of their namespace are picked up as they go.
+ * Only port membership can change under a device, it is refreshed here.
+ */
+struct nobd_if *nobd_if_get(struct net_device *dev)
+{
+	struct nobd_if *ifc;
+	struct vlan_dev_info *vlan;
+
+	ASSERT_RTNL();
+	ifc = nobd_if_find(dev);
+	if (!ifc) {
+		ifc = kzalloc(sizeof(*ifc), GFP_KERNEL);
+		if (!ifc)
+			return NULL;
+		ifc->net = dev_net(dev);
+		ifc->ifindex = dev->ifindex;
+		ifc->base = nobd_if_base(dev);
+		ifc->up = NOBD_IF_UNKNOWN;
+		ifc->carrier = NOBD_IF_UNKNOWN;
+		if (ifc->base == NOBD_CLASS_VLAN) {
+			vlan = netdev_priv(dev);
+			ifc->lower = vlan->real_dev->ifindex;
+			ifc->vid = vlan->vlan_id;
+		}
+		hlist_add_head(&ifc->hnode,
+			       nobd_if_bucket(ifc->net, ifc->ifindex));
+		nobd_if_count++;
+	}
+	ifc->class = nobd_if_port(ifc->base, dev);
+	ifc->master = ifc->class == NOBD_CLASS_BRPORT ?
+		dev->br_port->br->dev->ifindex : 0;
+	return ifc;
+}
+
+/*
+ * Whether event moves the device to a state not reported yet, and takes
+ * it if so. Up and down follow IFF_UP, NETDEV_CHANGE only counts when
+ * the carrier flipped; the rest always go through.
+ */
+int nobd_if_transition(struct nobd_if *ifc, struct net_device *dev,
+		       unsigned long event)
+{
+	u8 state;
+
+	switch (event) {
+	case NETDEV_UP:
+	case NETDEV_DOWN:
+		state = event == NETDEV_UP;
+		if (ifc->up == state)
+			break;
+		ifc->up = state;
+		/* the carrier of a device going down is of no interest */
+		ifc->carrier = state ? netif_carrier_ok(dev) : NOBD_IF_UNKNOWN;
+		return 1;
+	case NETDEV_CHANGE:
+		state = netif_carrier_ok(dev);
+		if (ifc->carrier == state)
+			break;
+		ifc->carrier = state;
+		return 1;
+	default:
+		return 1;
+	}
+	nobd_if_repeats++;
+	return 0;
+}
+
+void nobd_if_del(struct net_device *dev)
+{
+	struct nobd_if *ifc;
+
+	ASSERT_RTNL();
+	ifc = nobd_if_find(dev);
+	if (!ifc)
+		return;
+	hlist_del(&ifc->hnode);
+	nobd_if_count--;
+	kfree(ifc);
+}
+
+/*
+ * Drops what is known of a namespace whose monitoring stops, or NULL for
+ * all of them. Whatever happens meanwhile would otherwise look like a
+ * repeat once it is monitored again.
+ */
+void nobd_if_purge(struct net *net)
+{
+	struct nobd_if *ifc;
+	struct hlist_node *n, *tmp;
+	int i;
+
+	rtnl_lock();
+	for (i = 0; i < ARRAY_SIZE(nobd_if_hash); i++) {
+		hlist_for_each_entry_safe(ifc, n, tmp, &nobd_if_hash[i],
+					  hnode) {
+			if (net && ifc->net != net)
+				continue;
+			hlist_del(&ifc->hnode);
+			nobd_if_count--;
+			kfree(ifc);
+		}
+	}
+	rtnl_unlock();
+}
+
+static const char *nobd_if_names[] = {
+	[NOBD_CLASS_ETH]	= "eth",
+	[NOBD_CLASS_BRIDGE]	= "bridge",
+	[NOBD_CLASS_BRPORT]	= "brport",
+	[NOBD_CLASS_VLAN]	= "vlan",
+	[NOBD_CLASS_PPP]	= "ppp",
+};
+
+static int nobd_if_show(struct seq_file *m, void *v)
+{
+	struct nobd_if *ifc;
+	struct hlist_node *n;
+	int i;
+
+	rtnl_lock();
+	seq_printf(m, "# entries %u repeats %lu\n", nobd_if_count,
+		   nobd_if_repeats);
+	for (i = 0; i < ARRAY_SIZE(nobd_if_hash); i++) {
+		hlist_for_each_entry(ifc, n, &nobd_if_hash[i], hnode) {
+			seq_printf(m, "ns %d if %d %s",
+				   nobd_net_id(ifc->net), ifc->ifindex,
+				   ifc->class < ARRAY_SIZE(nobd_if_names) ?
+				   nobd_if_names[ifc->class] : "-");
+			if (ifc->master)
+				seq_printf(m, " master %d", ifc->master);
+			if (ifc->base == NOBD_CLASS_VLAN)
+				seq_printf(m, " vid %u lower %d", ifc->vid,
+					   ifc->lower);
+			if (ifc->up != NOBD_IF_UNKNOWN)
+				seq_printf(m, " %s", ifc->up ? "up" : "down");
+			if (ifc->carrier != NOBD_IF_UNKNOWN)
+				seq_printf(m, " carrier %u", ifc->carrier);
+			seq_putc(m, '\n');
+		}
+	}
+	rtnl_unlock();
+	return 0;
+}
+
+static int nobd_if_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nobd_if_show, NULL);
+}
+
+static const struct file_operations nobd_if_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_if_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int nobd_if_init(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(nobd_if_hash); i++)
+		INIT_HLIST_HEAD(&nobd_if_hash[i]);
+	proc_create("links", 0444, nobd_proc_dir, &nobd_if_fops);
+
+	return 0;
+}
+
+/* once the netdevice notifier is gone */
+void nobd_if_exit(void)
+{
+	remove_proc_entry("links", nobd_proc_dir);
+	nobd_if_purge(NULL);
+}
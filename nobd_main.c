@@ -15,6 +15,14 @@
 #include <linux/kernel.h>
 #include "include/nobd_nl.h"
 #include "include/nobd_nc.h"
+#include "include/nobd_ring.h"
+#include "include/nobd_proc.h"
+#include "include/nobd_rt.h"
+#include "include/nobd_rl.h"
+#include "include/nobd_stat.h"
+#include "include/nobd_filter.h"
+#include "include/nobd_net.h"
+#include "include/nobd_snap.h"
 
 #undef pr_fmt
 #define pr_fmt(fmt) "nobd: " fmt
@@ -24,26 +32,88 @@ static int __init nobd_init(void)
 	int err = 0;
 
 	pr_info("init\n");
+	err = nobd_ring_init();
+	if (err) {
+		printk(KERN_ERR "ring failed\n");
+		return err;
+	}
+	err = nobd_proc_init();
+	if (err) {
+		printk(KERN_ERR "proc failed\n");
+		goto err_ring;
+	}
+	nobd_stat_init();
+	err = nobd_flt_init();
+	if (err) {
+		printk(KERN_ERR "filter failed\n");
+		goto err_proc;
+	}
+	err = nobd_rl_init();
+	if (err) {
+		printk(KERN_ERR "rl failed\n");
+		goto err_flt;
+	}
+	err = nobd_rt_init();
+	if (err) {
+		printk(KERN_ERR "rt failed\n");
+		goto err_rl;
+	}
 	err = nobd_nl_open();
 	if (err) {
 		printk(KERN_ERR "nl failed\n");
-		return err;
+		goto err_rt;
+	}
+	err = nobd_net_init();
+	if (err) {
+		printk(KERN_ERR "net failed\n");
+		goto err_nl;
 	}
 	err = nobd_nc_init();
 	if (err) {
 		printk(KERN_ERR "nc failed\n");
-		nobd_nl_close();
-		return err;
+		goto err_net;
+	}
+	err = nobd_snap_init();
+	if (err) {
+		printk(KERN_ERR "snap failed\n");
+		goto err_nc;
 	}
 
 	return err;
+
+err_nc:
+	nobd_nc_exit();
+err_net:
+	nobd_net_exit();
+err_nl:
+	nobd_nl_close();
+err_rt:
+	nobd_rt_exit();
+err_rl:
+	nobd_rl_exit();
+err_flt:
+	nobd_flt_exit();
+err_proc:
+	nobd_stat_exit();
+	nobd_proc_exit();
+err_ring:
+	nobd_ring_exit();
+	return err;
 }
 
 static void __exit nobd_exit(void)
 {
 	pr_info("exit\n");
-	nobd_nl_close();
+	nobd_snap_exit();
 	nobd_nc_exit();
+	nobd_net_exit();
+	nobd_nl_close();
+	nobd_rt_exit();
+	nobd_rl_exit();
+	nobd_flt_exit();
+	nobd_stat_exit();
+	nobd_proc_exit();
+	nobd_ring_exit();
 }
 
 module_init(nobd_init)
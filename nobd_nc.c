@@ -21,16 +21,29 @@
 #include <vlan.h>
 #include <br_private.h>
 #include <linux/if_arp.h>
+#include <linux/rtnetlink.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
 #include <net/netfilter/nf_conntrack.h>
 #include <net/netfilter/nf_conntrack_core.h>
 #include <net/netfilter/nf_conntrack_helper.h>
 #include <net/netfilter/nf_conntrack_ecache.h>
 #include <net/netfilter/nf_conntrack_l3proto.h>
 #include <net/netfilter/nf_conntrack_l4proto.h>
+#include <linux/netfilter/nf_conntrack_tcp.h>
 #include <linux/version.h>
 
 #include "include/nobd_pppoe_sock.h"
 #include "include/nobd_br.h"
+#include "include/nobd_ring.h"
+#include "include/nobd_ct.h"
+#include "include/nobd_filter.h"
+#include "include/nobd_net.h"
+#include "include/nobd_stat.h"
+#include "include/nobd_snap.h"
+#include "include/nobd_nc.h"
+#include "include/nobd_if.h"
+#include "include/nobd_top.h"
 
 #undef pr_fmt
 #define pr_fmt(fmt) "nobd_nc: " fmt
@@ -42,8 +55,11 @@ MODULE_PARM_DESC(no_ct, "avoid reporting conntrack events");
 DEFINE_SPINLOCK(nobd_lock);
 #ifdef CONFIG_NF_CONNTRACK_EVENTS
 
-static void (*death_by_timeout_org)(unsigned long);
-static atomic_t en_reg_timeout_death = ATOMIC_INIT(1);
+static unsigned int ct_sample_n = 1;
+module_param(ct_sample_n, uint, 0644);
+MODULE_PARM_DESC(ct_sample_n, "report 1 in N conntrack flows, picked by tuple hash");
+
+static u32 nobd_ct_sample_seed;
 
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,26)
 static inline u_int16_t nf_ct_l3num(const struct nf_conn *ct)
@@ -56,81 +72,142 @@ static inline u_int8_t nf_ct_protonum(const struct nf_conn *ct)
 }
 #endif /* KERNEL_VERSION 2.6.26 */
 
-#ifndef NIPQUAD
-	#define NIPQUAD(addr) \
-	((unsigned char *)&addr)[0], \
-	((unsigned char *)&addr)[1], \
-	((unsigned char *)&addr)[2], \
-	((unsigned char *)&addr)[3]
-	#define NIPQUAD_FMT "%u.%u.%u.%u"
-#endif
-
-static void nobd_print_conntrack_tuple(struct nf_conn *ct)
+/*
+ * Flows are sampled on a hash of their original tuple, so NEW, DESTROY
+ * and a snapshot all agree on a flow. Returns the N it was kept at, 0
+ * when it is left out. A record stands for sample_n flows.
+ */
+static u16 nobd_ct_sample(struct nf_conn *ct)
 {
-	const struct nf_conntrack_l3proto *l3proto;
-	const struct nf_conntrack_l4proto *l4proto;
+	struct nf_conntrack_tuple *t = &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple;
+	unsigned int n = min(ACCESS_ONCE(ct_sample_n), 0xffffU);
+	u32 h;
+
+	if (n <= 1)
+		return 1;
+	h = jhash2(t->src.u3.all, ARRAY_SIZE(t->src.u3.all),
+		   nobd_ct_sample_seed);
+	h = jhash2(t->dst.u3.all, ARRAY_SIZE(t->dst.u3.all), h);
+	h = jhash_3words((__force u32)t->src.u.all,
+			 (__force u32)t->dst.u.all, t->dst.protonum, h);
+	return ((u64)h * n) >> 32 ? 0 : n;
+}
 
-	struct nf_conntrack_tuple *tuple = 
+static void nobd_ct_fill(struct nf_conn *ct, u8 op, u16 sample_n,
+			 struct nobd_ev_ct *rec)
+{
+	struct nf_conntrack_tuple *tuple =
 		&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple;
+	struct nf_conn_help *help = nfct_help(ct);
 
-	l3proto = __nf_ct_l3proto_find(nf_ct_l3num(ct));
-	NF_CT_ASSERT(l3proto);
-	l4proto = __nf_ct_l4proto_find(nf_ct_l3num(ct), nf_ct_protonum(ct));
-	NF_CT_ASSERT(l4proto);
-
-	pr_info("[%s]" NIPQUAD_FMT ":%u -> " NIPQUAD_FMT ":%u\n",
-		l4proto->name,
-		NIPQUAD(tuple->src.u3.ip), ntohs(tuple->src.u.all),
-		NIPQUAD(tuple->dst.u3.ip), ntohs(tuple->dst.u.all));
+	memset(rec, 0, sizeof(*rec));
+	rec->family = nf_ct_l3num(ct);
+	if (rec->family == AF_INET6) {
+		memcpy(rec->src.ip6, tuple->src.u3.ip6, sizeof(rec->src.ip6));
+		memcpy(rec->dst.ip6, tuple->dst.u3.ip6, sizeof(rec->dst.ip6));
+	} else {
+		rec->src.ip = tuple->src.u3.ip;
+		rec->dst.ip = tuple->dst.u3.ip;
+	}
+	rec->sport = tuple->src.u.all;
+	rec->dport = tuple->dst.u.all;
+	rec->proto = tuple->dst.protonum;
+	rec->op = op;
+	rec->count = 1;
+	rec->sample_n = sample_n;
+	if (help && help->helper)
+		rec->helper = nobd_ct_helper_id(help->helper->name);
 }
 
-/* overrides ct->timeout->function() */
-void nobd_death_by_timeout(unsigned long ul_conntrack)
+static void nobd_ct_record(struct nf_conn *ct, u8 op, u16 netns,
+			   u16 sample_n, u32 duration)
 {
-	struct nf_conn *ct = (void *)ul_conntrack;
+	struct nobd_ev_ct rec;
+
+	nobd_ct_fill(ct, op, sample_n, &rec);
+	rec.duration = duration;
+	/* heavy hitters count every new flow, whatever the filter keeps */
+	if (op == NOBD_CT_NEW)
+		nobd_top_add(&rec, netns);
+	if (!nobd_flt_pass(NOBD_EV_CT, netns, &rec))
+		return;
+	if (nobd_ct_coalesce(ct, &rec, netns))
+		return;
+	nobd_ct_emit(&rec, netns);
+}
 
-	pr_info("nobd_death_by_timeout:\n");
-	nobd_print_conntrack_tuple(ct);
-//	mod_timer(&ct->timeout, jiffies + 400 * HZ);
-	death_by_timeout_org(ul_conntrack); /* hook the original timeout */
+/*
+ * Why a conntrack went, read off it on destroy. Its timer is only deleted
+ * early when something took the entry out, an expired one ran it out.
+ */
+static u8 nobd_ct_end_op(struct nf_conn *ct)
+{
+	if (time_before(jiffies, ct->timeout.expires))
+		return NOBD_CT_DESTROY;
+	if (nf_ct_protonum(ct) == IPPROTO_TCP &&
+	    ct->proto.tcp.state >= TCP_CONNTRACK_FIN_WAIT &&
+	    ct->proto.tcp.state <= TCP_CONNTRACK_CLOSE)
+		return NOBD_CT_CLOSED;
+	return NOBD_CT_TIMEOUT;
 }
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,24)
-static void unregister_death_by_timeout(void)
+/*
+ * Snapshot of the conntracks of every monitored namespace, straight from
+ * the table, ring room checked before each bucket. A run holds the lock
+ * for its snap_chunk buckets at most. A resize restarts the namespace,
+ * the consumer sees some twice.
+ */
+int nobd_ct_snap(struct nobd_snap_cur *c)
 {
 	struct nf_conntrack_tuple_hash *h;
-	struct nf_conn *ct;
 	struct hlist_nulls_node *n;
-	unsigned int bucket = 0;
-	struct net *net = &init_net;
-
-	spin_lock_bh(&nf_conntrack_lock);
-	/* Go over all tuples in the Linux database */
-	for (; bucket < net->ct.htable_size; bucket++) {
-		hlist_nulls_for_each_entry(h, n, &net->ct.hash[bucket], hnnode) {
-			ct = nf_ct_tuplehash_to_ctrack(h);
-			if (death_by_timeout_org)
-				ct->timeout.function = death_by_timeout_org;
+	struct nf_conn *ct;
+	struct net *net;
+	struct nobd_ev ev;
+	u16 sample_n;
+	int rc = 1;
+
+	if (no_ct)
+		return 1;
+	memset(&ev, 0, sizeof(ev));
+	ev.hdr.type = NOBD_EV_CT;
+	for (; (net = nobd_net_next(&c->netns)) != NULL; c->netns++) {
+		spin_lock_bh(&nf_conntrack_lock);
+		if (c->table != (unsigned long)net->ct.hash) {
+			c->table = (unsigned long)net->ct.hash;
+			c->pos = 0;
+		}
+		for (; c->pos < net->ct.htable_size; c->pos++) {
+			rc = nobd_snap_next(c);
+			if (rc <= 0)
+				break;
+			hlist_nulls_for_each_entry(h, n, &net->ct.hash[c->pos],
+						   hnnode) {
+				if (NF_CT_DIRECTION(h) != IP_CT_DIR_ORIGINAL)
+					continue;
+				ct = nf_ct_tuplehash_to_ctrack(h);
+				sample_n = nobd_ct_sample(ct);
+				if (!sample_n)
+					continue;
+				ev.hdr.netns = c->netns;
+				nobd_ct_fill(ct, NOBD_CT_NEW, sample_n, &ev.ct);
+				nobd_snap_emit(c, &ev);
+			}
 		}
+		spin_unlock_bh(&nf_conntrack_lock);
+		put_net(net);
+		if (rc <= 0)
+			return rc;
+		c->table = 0;
+		c->pos = 0;
 	}
-	spin_unlock_bh(&nf_conntrack_lock);
+	return 1;
 }
 #else /* LINUX_VERSION_CODE < KERNEL_VERSION(2,6,24) */
-static void unregister_death_by_timeout(void)
+int nobd_ct_snap(struct nobd_snap_cur *c)
 {
-	struct nf_conntrack_tuple_hash *h;
-	struct nf_conn *ct;
-	unsigned int bucket = 0;
-
-	spin_lock_bh(&nf_conntrack_lock);
-	/* Go over all tuples in the Linux database */
-	for (; bucket < nf_conntrack_htable_size; bucket++) {
-		list_for_each_entry(h, &nf_conntrack_hash[bucket], list) {
-			ct = nf_ct_tuplehash_to_ctrack(h);
-			ct->timeout.function = death_by_timeout_org;
-		}
-	}
-	spin_unlock_bh(&nf_conntrack_lock);
+	return 1;
 }
 #endif
 
@@ -144,52 +221,41 @@ static int nobd_nc_ct_event(unsigned int events, struct nf_ct_event *item)
 {
 	struct nf_conn *ct = item->ct;
 #endif /* LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,31) */
+	u64 start = nobd_stat_start();
+	u32 duration;
+	u16 sample_n;
+	int netns;
 
-	struct nf_conn_help *help = nfct_help(ct);
 	/* ignore fake conntrack entry */
 	if (ct == &nf_conntrack_untracked)
-		return 0;
-
-	if (!death_by_timeout_org)
-		death_by_timeout_org = ct->timeout.function;
-
-	if (atomic_read(&en_reg_timeout_death))
-		ct->timeout.function = &nobd_death_by_timeout;
-
+		goto out;
+	netns = nobd_net_id(nf_ct_net(ct));
 	if (events & IPCT_DESTROY) {
-		pr_info("destroyed ct\n");
-	} else  if (events & IPCT_NEW) {
-		pr_info("new ct\n");
-		if (help && help->helper) {
-			struct nf_conntrack_helper *hlp = help->helper;
-			struct nf_conntrack_tuple *tup =
-				&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple;
-
-			pr_info("new helper ct\n");
-			pr_info("(%s:%d): helper name: %s, proto %u, "
-				"port %u\n", __func__, __LINE__,
-			       hlp->name, tup->dst.protonum, 
-				ntohs(tup->dst.u.all));
-		}
-	} else if (events & IPCT_RELATED) {
-		pr_info("related ct\n");
-	} else if (events & IPCT_HELPER) {
-		if (help && help->helper) {
-			struct nf_conntrack_helper *hlp = help->helper;
-			struct nf_conntrack_tuple *tup =
-				&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple;
-
-			pr_info("new helper ct\n");
-			pr_info("(%s:%d): helper name: %s, proto %u, dst_port %u\n", __func__, __LINE__,
-			       hlp->name, tup->dst.protonum, ntohs(tup->dst.u.all));
-		} else {
-			pr_debug("new ct\n");
-		}
-
-	} else 
-		return 0;
-
-	nobd_print_conntrack_tuple(ct);
+		/* dropped even when its namespace stopped being monitored */
+		duration = nobd_ct_track_end(ct);
+		if (netns < 0)
+			goto out;
+		sample_n = nobd_ct_sample(ct);
+		if (sample_n)
+			nobd_ct_record(ct, nobd_ct_end_op(ct), netns, sample_n,
+				       duration);
+		goto out;
+	}
+	if (netns < 0)
+		goto out;
+	sample_n = nobd_ct_sample(ct);
+	if (!sample_n)
+		goto out;
+
+	if (events & IPCT_NEW) {
+		nobd_ct_track_start(ct);
+		nobd_ct_record(ct, NOBD_CT_NEW, netns, sample_n, 0);
+	} else if (events & IPCT_RELATED)
+		nobd_ct_record(ct, NOBD_CT_RELATED, netns, sample_n, 0);
+	else if (events & IPCT_HELPER)
+		nobd_ct_record(ct, NOBD_CT_HELPER, netns, sample_n, 0);
+out:
+	nobd_stat_end(NOBD_ST_CT_EVENT, start);
 	return 0;
 }
 
@@ -203,44 +269,109 @@ static struct nf_ct_event_notifier nobd_ct_notifier = {
 };
 #endif /* LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,31) */
 
+#else
+int nobd_ct_snap(struct nobd_snap_cur *c)
+{
+	return 1;
+}
 #endif /* CONFIG_NF_CONNTRACK_EVENTS */
 
-static int nobd_nc_br_if_event(struct notifier_block *unused, unsigned long event, 
-			      void *ptr)
+/* maps NETDEV_* to the record op, -1 for events we don't report */
+static int nobd_link_op(unsigned long event)
+{
+	switch (event) {
+	case NETDEV_REGISTER:
+		return NOBD_LINK_REGISTER;
+	case NETDEV_UNREGISTER:
+		return NOBD_LINK_UNREGISTER;
+	case NETDEV_UP:
+		return NOBD_LINK_UP;
+	case NETDEV_DOWN:
+		return NOBD_LINK_DOWN;
+	case NETDEV_GOING_DOWN:
+		return NOBD_LINK_GOING_DOWN;
+	case NETDEV_CHANGE:
+		return NOBD_LINK_CHANGE;
+	}
+	return -1;
+}
+
+static void nobd_link_fill(struct nobd_ev *ev, struct net_device *dev,
+			   int op, u8 class, struct net_device *master)
+{
+	ev->link.ifindex = dev->ifindex;
+	ev->link.master = master ? master->ifindex : 0;
+	ev->link.op = op;
+	ev->link.class = class;
+	memcpy(ev->link.name, dev->name, sizeof(ev->link.name));
+}
+
+static void nobd_link_record(struct net_device *dev, int op, u8 class,
+			     struct net_device *master)
+{
+	struct nobd_ev *ev;
+	unsigned long flags;
+	int netns = nobd_net_id(dev_net(dev));
+
+	if (netns < 0)
+		return;
+	ev = nobd_ev_reserve(NOBD_EV_LINK, &flags);
+	if (!ev)
+		return;
+	ev->hdr.netns = netns;
+	nobd_link_fill(ev, dev, op, class, master);
+	nobd_ev_commit(ev, flags);
+}
+
+static void nobd_vlan_fill(struct nobd_ev *ev, struct net_device *dev,
+			   int op)
+{
+	struct vlan_dev_info *dev_info = (struct vlan_dev_info *)netdev_priv(dev);
+
+	ev->vlan.ifindex = dev->ifindex;
+	ev->vlan.real_ifindex = dev_info->real_dev->ifindex;
+	ev->vlan.vid = dev_info->vlan_id;
+	ev->vlan.op = op;
+	memcpy(ev->vlan.name, dev->name, sizeof(ev->vlan.name));
+}
+
+/*
+ * The class handlers get report clear for events that change nothing
+ * nobd_if.c knows of, a repeated up or a carrier that did not flip.
+ */
+static int nobd_nc_br_if_event(struct net_device *dev, unsigned long event,
+			       int report)
 {
-	struct net_device *dev = ptr;
 	struct net_bridge *br = dev->br_port->br;
 
 	switch (event) {
-
 	case NETDEV_REGISTER:
-		pr_info("if %s up at br [%s]\n", dev->name, br->dev->name);
-		break;
-
 	case NETDEV_UNREGISTER:
-		pr_info("if %s down at br [%s]\n", dev->name, br->dev->name);
+		nobd_link_record(dev, nobd_link_op(event), NOBD_CLASS_BRPORT,
+				 br->dev);
 		break;
 	}
 	return NOTIFY_DONE;
 }
 
-static int nobd_nc_br_dev_event(struct notifier_block *unused, unsigned long event, 
-			      void *ptr)
+static int nobd_nc_br_dev_event(struct net_device *dev, unsigned long event,
+				int report)
 {
-	struct net_device *dev = ptr;
 	struct net_bridge *br = netdev_priv(dev);
 	int ret = NOTIFY_DONE;
 
 	switch (event) {
 
 	case NETDEV_REGISTER:
-		pr_info("br up [%s]\n", dev->name);
+		nobd_link_record(dev, NOBD_LINK_REGISTER, NOBD_CLASS_BRIDGE,
+				 NULL);
 		if (nobd_br_reg(br))
 			ret = NOTIFY_BAD;
 		break;
 
 	case NETDEV_UNREGISTER:
-		pr_info("br unreg [%s]\n", dev->name);
+		nobd_link_record(dev, NOBD_LINK_UNREGISTER, NOBD_CLASS_BRIDGE,
+				 NULL);
 		nobd_br_unreg(br);
 		break;
 	}
@@ -248,116 +379,173 @@ static int nobd_nc_br_dev_event(struct notifier_block *unused, unsigned long eve
 	return ret;
 }
 
-static int 
-nobd_nc_eth_dev_event(struct notifier_block *unused, unsigned long event,
-			     void *ptr)
+static int nobd_nc_eth_dev_event(struct net_device *dev, unsigned long event,
+				 int report)
 {
-	struct net_device *dev = ptr;
-
-	pr_info("(%s:%d) eth dev %s event %lu\n", __func__, __LINE__,
-	       dev->name, event);
-	switch (event) {
-	case NETDEV_REGISTER:
-		pr_info("eth dev register %s\n", dev->name);
-		break;
-	case NETDEV_UNREGISTER:
-		pr_info("eth dev unregister %s\n", dev->name);
-		break;
-	case NETDEV_UP:
-		pr_info("eth dev %s up\n", dev->name);
-	case NETDEV_DOWN:
-		pr_info("eth dev %s down\n", dev->name);
-	case NETDEV_CHANGE:
-		pr_info("eth dev %s change\n", dev->name);
+	int op = nobd_link_op(event);
 
-	}
+	if (report && op >= 0 && event != NETDEV_GOING_DOWN)
+		nobd_link_record(dev, op, NOBD_CLASS_ETH, NULL);
 
 	return NOTIFY_DONE;
 }
 
-static int 
-nobd_nc_pppox_dev_event(struct notifier_block *unused, unsigned long event,
-			     void *ptr)
+static int nobd_nc_pppox_dev_event(struct net_device *dev,
+				   unsigned long event, int report)
 {
-	struct net_device *dev = ptr;
-
-	pr_info("(%s:%d) pppox dev %s event %lu\n", __func__, __LINE__,
-	       dev->name, event);
+	int op = nobd_link_op(event);
 
 	switch (event) {
 	case NETDEV_REGISTER:
-		pr_info("dev register %s\n", dev->name);
+		nobd_link_record(dev, op, NOBD_CLASS_PPP, NULL);
 		break;
 	case NETDEV_UNREGISTER:
-		pr_info("dev unregister %s\n", dev->name);
+		nobd_link_record(dev, op, NOBD_CLASS_PPP, NULL);
+		nobd_pppoe_dev_gone(dev);
 		break;
 	case NETDEV_UP:
-		pr_info("dev %s up\n", dev->name);
-		find_dev_pppoe_socks(dev);
-		break;
 	case NETDEV_DOWN:
-		pr_info("dev %s down\n", dev->name);
-		find_dev_pppoe_socks(dev);
-		break;
 	case NETDEV_GOING_DOWN:
-		pr_info("dev %s going down\n", dev->name);
-		find_dev_pppoe_socks(dev);
+		if (report)
+			nobd_link_record(dev, op, NOBD_CLASS_PPP, NULL);
+		find_dev_pppoe_socks(dev, op);
 		break;
 	}
 
 	return NOTIFY_DONE;
 }
 
-static int 
-nobd_nc_vlan_dev_event(struct notifier_block *unused, unsigned long event,
-			     void *ptr)
+static int nobd_nc_vlan_dev_event(struct net_device *dev,
+				  unsigned long event, int report)
 {
-	struct net_device *dev = ptr;
-	struct vlan_dev_info *dev_info = (struct vlan_dev_info *)netdev_priv(dev);
+	struct nobd_ev *ev;
+	unsigned long flags;
+	int netns = nobd_net_id(dev_net(dev));
 
 	switch (event) {
 	case NETDEV_REGISTER:
-		pr_info("vlan register %s vid %u\n", dev->name, dev_info->vlan_id);
-		break;
 	case NETDEV_UNREGISTER:
-		pr_info("vlan unreg %s vid %u\n", dev->name, dev_info->vlan_id);
-		break;
 	case NETDEV_UP:
-		pr_info("vlan %s up vid %u\n", dev->name, dev_info->vlan_id);
-		break;
 	case NETDEV_DOWN:
-		pr_info("vlan %s down vid %u\n", dev->name, dev_info->vlan_id);
+		if (netns < 0 || !report)
+			break;
+		ev = nobd_ev_reserve(NOBD_EV_VLAN, &flags);
+		if (!ev)
+			break;
+		ev->hdr.netns = netns;
+		nobd_vlan_fill(ev, dev, nobd_link_op(event));
+		nobd_ev_commit(ev, flags);
 		break;
 	}
 
 	return NOTIFY_DONE;
 }
 
-/* main dispatcher for netdev events */
+static const struct {
+	int (*fn)(struct net_device *dev, unsigned long event, int report);
+	int id;
+} nobd_nc_classes[] = {
+	[NOBD_CLASS_ETH]	= { nobd_nc_eth_dev_event, NOBD_ST_NETDEV_ETH },
+	[NOBD_CLASS_BRIDGE]	= { nobd_nc_br_dev_event, NOBD_ST_NETDEV_BR_DEV },
+	[NOBD_CLASS_BRPORT]	= { nobd_nc_br_if_event, NOBD_ST_NETDEV_BR_IF },
+	[NOBD_CLASS_VLAN]	= { nobd_nc_vlan_dev_event, NOBD_ST_NETDEV_VLAN },
+	[NOBD_CLASS_PPP]	= { nobd_nc_pppox_dev_event, NOBD_ST_NETDEV_PPPOX },
+};
+
+/*
+ * main dispatcher for netdev events, the class comes from the nobd_if.c
+ * cache and each class is timed on its own
+ */
 static int nobd_nc_netdev_event(struct notifier_block *unused, unsigned long event,
 			   void *ptr)
 {
 	struct net_device *dev = ptr;
-	
-//      pr_debug("dpa_netdev_dev %s event %lu, dev_type: %#x, flags #%x\n",dev->name, event,
-//      	dev->type, dev->priv_flags);
-
-	if (dev->priv_flags & IFF_802_1Q_VLAN) {
-		return nobd_nc_vlan_dev_event(unused, event, ptr);
+	struct nobd_if *ifc;
+	int ret = NOTIFY_DONE, report = 1;
+	u64 start = nobd_stat_start(), sub;
+	u8 class;
+
+	if (nobd_net_id(dev_net(dev)) < 0)
+		goto out;	/* namespace not monitored */
+
+	ifc = nobd_if_get(dev);
+	if (ifc) {
+		class = ifc->class;
+		report = nobd_if_transition(ifc, dev, event);
+	} else {
+		class = nobd_if_class(dev);
 	}
-	if (dev->priv_flags & IFF_EBRIDGE) {
-		return nobd_nc_br_dev_event(unused, event, ptr);
-	} else if (dev->br_port) {
-		return nobd_nc_br_if_event(unused, event, ptr);
-	}
-	if (dev->type == ARPHRD_ETHER) {
-		return nobd_nc_eth_dev_event(unused, event, ptr);
+
+	if (class < ARRAY_SIZE(nobd_nc_classes)) {
+		sub = nobd_stat_start();
+		ret = nobd_nc_classes[class].fn(dev, event, report);
+		nobd_stat_end(nobd_nc_classes[class].id, sub);
 	}
-	if (dev->type == ARPHRD_PPP) {
-		return nobd_nc_pppox_dev_event(unused, event, ptr);
+out:
+	/* even unmonitored, the ifindex may come back as another device */
+	if (event == NETDEV_UNREGISTER)
+		nobd_if_del(dev);
+	nobd_stat_end(NOBD_ST_NETDEV_EVENT, start);
+
+	return ret;
+}
+
+/* a registered device as the notifiers would have reported it, then up */
+static void nobd_link_snap(struct nobd_snap_cur *c, struct net_device *dev)
+{
+	struct nobd_ev ev;
+	u8 class = nobd_if_class(dev);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.hdr.type = NOBD_EV_LINK;
+	ev.hdr.netns = c->netns;
+	if (class == NOBD_IF_NONE)
+		return;
+	if (class == NOBD_CLASS_VLAN) {
+		ev.hdr.type = NOBD_EV_VLAN;
+		nobd_vlan_fill(&ev, dev, NOBD_LINK_REGISTER);
+	} else {
+		nobd_link_fill(&ev, dev, NOBD_LINK_REGISTER, class,
+			       class == NOBD_CLASS_BRPORT ?
+			       dev->br_port->br->dev : NULL);
 	}
+	nobd_snap_emit(c, &ev);
+
+	if (!(dev->flags & IFF_UP))
+		return;
+	if (ev.hdr.type == NOBD_EV_VLAN)
+		ev.vlan.op = NOBD_LINK_UP;
+	else
+		ev.link.op = NOBD_LINK_UP;
+	nobd_snap_emit(c, &ev);
+}
 
-	return NOTIFY_DONE;
+/* snapshot of the devices of every monitored namespace, by index bucket */
+int nobd_nc_snap_links(struct nobd_snap_cur *c)
+{
+	struct net_device *dev;
+	struct hlist_node *n;
+	struct net *net;
+	int rc = 1;
+
+	for (; (net = nobd_net_next(&c->netns)) != NULL; c->netns++) {
+		rtnl_lock();
+		for (; c->pos < NETDEV_HASHENTRIES; c->pos++) {
+			rc = nobd_snap_next(c);
+			if (rc <= 0)
+				break;
+			hlist_for_each_entry(dev, n,
+					     &net->dev_index_head[c->pos],
+					     index_hlist)
+				nobd_link_snap(c, dev);
+		}
+		rtnl_unlock();
+		put_net(net);
+		if (rc <= 0)
+			return rc;
+		c->pos = 0;
+	}
+	return 1;
 }
 
 static struct notifier_block nobd_netdev_notifier __read_mostly = {
@@ -373,21 +561,53 @@ int nobd_nc_init(void)
 	if (err)
 		goto exit;
 
+	err = nobd_ct_init();
+	if (err)
+		goto err_ct;
+
+	err = nobd_top_init();
+	if (err)
+		goto err_top;
+
+	err = nobd_pppoe_init();
+	if (err)
+		goto err_pppoe;
+
+	err = nobd_if_init();
+	if (err)
+		goto err_if;
+
 	err = register_netdevice_notifier(&nobd_netdev_notifier);
-	if (err) {
-		unregister_netdevice_notifier(&nobd_netdev_notifier);
-	}
+	if (err)
+		goto err_netdev;
 #ifdef CONFIG_NF_CONNTRACK_EVENTS
 	if (!no_ct) {
 		pr_info("reg nf_conntrack\n");
+		get_random_bytes(&nobd_ct_sample_seed,
+				 sizeof(nobd_ct_sample_seed));
 		err = nf_conntrack_register_notifier(&nobd_ct_notifier);
-		if (err) {
-			nf_conntrack_unregister_notifier(&nobd_ct_notifier);
-		}
+		if (err)
+			goto err_conntrack;
 	}
 #else
 	#warning "CONFIG_NF_CONNTRACK_EVENTS undefined!"
 #endif
+	return 0;
+
+#ifdef CONFIG_NF_CONNTRACK_EVENTS
+err_conntrack:
+	unregister_netdevice_notifier(&nobd_netdev_notifier);
+#endif
+err_netdev:
+	nobd_if_exit();
+err_if:
+	nobd_pppoe_exit();
+err_pppoe:
+	nobd_top_exit();
+err_top:
+	nobd_ct_exit();
+err_ct:
+	nobd_br_fdb_exit();
 exit :
 	return err;
 }
@@ -399,10 +619,14 @@ void nobd_nc_exit(void)
 #ifdef CONFIG_NF_CONNTRACK_EVENTS
 	if (!no_ct) {
 		pr_info("unreg nf_ct\n");
-		atomic_set(&en_reg_timeout_death, 0);
 		nf_conntrack_unregister_notifier(&nobd_ct_notifier);
-		unregister_death_by_timeout();
+		/* an event may still be in our notifier on another cpu */
+		synchronize_rcu();
 	}
 #endif
+	nobd_if_exit();
+	nobd_pppoe_exit();
+	nobd_top_exit();
+	nobd_ct_exit();
 	nobd_br_fdb_exit();
 }
@@ -0,0 +1,413 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      Neighbour shadow table, reports reachability and lladdr changes only.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/jhash.h>
+#include <linux/jiffies.h>
+#include <linux/workqueue.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <net/neighbour.h>
+
+#include "include/nobd_neigh.h"
+#include "include/nobd_ring.h"
+#include "include/nobd_proc.h"
+#include "include/nobd_snap.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt) "nobd_neigh: " fmt
+
+#define NOBD_NEIGH_HBITS	10
+
+static unsigned int neigh_flap_ms;
+module_param(neigh_flap_ms, uint, 0644);
+MODULE_PARM_DESC(neigh_flap_ms, "hold down neighbour changes this close to the last report, 0 disables");
+
+/*
+ * An entry is valid while its NUD state is in NUD_VALID. Moves between
+ * REACHABLE, STALE, DELAY and PROBE keep it valid and are not reported,
+ * only becoming valid, becoming invalid and a new lladdr are. The current
+ * state is what the kernel last told us, rep_* is what we last reported.
+ */
+struct nobd_neigh {
+	struct hlist_node hnode;
+	struct list_head pending;	/* held down, see nobd_neigh_settle() */
+	union nobd_addr ip;
+	u32 ifindex;
+	u16 netns;
+	u8 family;
+	u8 valid;
+	u8 rep_valid;
+	u16 nud;
+	u16 flaps;
+	u32 gen;			/* resync generation last seen in */
+	unsigned long reported;
+	u8 mac[ETH_ALEN];
+	u8 rep_mac[ETH_ALEN];
+};
+
+static DEFINE_SPINLOCK(nobd_neigh_lock);
+static struct hlist_head nobd_neigh_hash[1 << NOBD_NEIGH_HBITS];
+static LIST_HEAD(nobd_neigh_pending);
+static struct kmem_cache *nobd_neigh_cache;
+static unsigned int nobd_neigh_count;
+static unsigned long nobd_neigh_damped;
+
+static void nobd_neigh_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(nobd_neigh_work, nobd_neigh_work_fn);
+static unsigned long nobd_neigh_due;	/* of the work, while pending */
+
+static struct hlist_head *nobd_neigh_bucket(const union nobd_addr *ip,
+					    u32 ifindex, u16 netns, u8 family)
+{
+	return &nobd_neigh_hash[jhash2(ip->ip6, 4, ifindex ^ netns << 8 ^
+				       family << 24) &
+				((1 << NOBD_NEIGH_HBITS) - 1)];
+}
+
+static struct nobd_neigh *nobd_neigh_find(const struct nobd_ev_neigh *rec,
+					  u16 netns)
+{
+	struct nobd_neigh *e;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(e, n, nobd_neigh_bucket(&rec->ip, rec->ifindex,
+						      netns, rec->family),
+			     hnode) {
+		if (!memcmp(&e->ip, &rec->ip, sizeof(e->ip)) &&
+		    e->ifindex == rec->ifindex && e->netns == netns &&
+		    e->family == rec->family)
+			return e;
+	}
+	return NULL;
+}
+
+static void nobd_neigh_emit(struct nobd_neigh *e, u8 op)
+{
+	struct nobd_ev *ev;
+	unsigned long flags;
+
+	ev = nobd_ev_reserve(NOBD_EV_NEIGH, &flags);
+	if (ev) {
+		ev->hdr.netns = e->netns;
+		ev->neigh.ip = e->ip;
+		ev->neigh.ifindex = e->ifindex;
+		memcpy(ev->neigh.lladdr, e->valid ? e->mac : e->rep_mac,
+		       ETH_ALEN);
+		ev->neigh.op = op;
+		ev->neigh.family = e->family;
+		ev->neigh.state = e->nud;
+		ev->neigh.flaps = e->flaps;
+		nobd_ev_commit(ev, flags);
+	}
+
+	e->rep_valid = e->valid;
+	memcpy(e->rep_mac, e->mac, ETH_ALEN);
+	e->reported = jiffies;
+	e->flaps = 0;
+}
+
+/*
+ * Has the work run at when, or earlier if it already is due sooner. A
+ * pending work is moved up, it would not be by a second schedule. Called
+ * with nobd_neigh_lock held, which the work takes before looking.
+ */
+static void nobd_neigh_schedule(unsigned long when)
+{
+	if (delayed_work_pending(&nobd_neigh_work)) {
+		if (!time_before(when, nobd_neigh_due))
+			return;
+		cancel_delayed_work(&nobd_neigh_work);
+	}
+	nobd_neigh_due = when;
+	schedule_delayed_work(&nobd_neigh_work,
+			      time_after(when, jiffies) ? when - jiffies : 0);
+}
+
+/*
+ * Brings the reported state in line with the current one. A change within
+ * neigh_flap_ms of the last record is held down on the pending list and
+ * reported by the work once the interval is over, if it still stands.
+ * Returns non zero if the entry was freed.
+ */
+static int nobd_neigh_settle(struct nobd_neigh *e, int report)
+{
+	unsigned long window = msecs_to_jiffies(neigh_flap_ms);
+	u8 op;
+
+	if (e->valid == e->rep_valid &&
+	    (!e->valid || !memcmp(e->mac, e->rep_mac, ETH_ALEN)))
+		goto settled;
+
+	if (!report) {
+		e->rep_valid = e->valid;
+		memcpy(e->rep_mac, e->mac, ETH_ALEN);
+		goto settled;
+	}
+
+	if (window && time_before(jiffies, e->reported + window)) {
+		e->flaps++;
+		nobd_neigh_damped++;
+		if (list_empty(&e->pending)) {
+			list_add_tail(&e->pending, &nobd_neigh_pending);
+			nobd_neigh_schedule(e->reported + window);
+		}
+		return 0;
+	}
+
+	if (!e->rep_valid)
+		op = NOBD_OP_NEW;
+	else if (!e->valid)
+		op = NOBD_OP_DEL;
+	else
+		op = NOBD_OP_CHANGE;
+	nobd_neigh_emit(e, op);
+
+settled:
+	list_del_init(&e->pending);
+	if (e->valid)
+		return 0;
+	hlist_del(&e->hnode);
+	kmem_cache_free(nobd_neigh_cache, e);
+	nobd_neigh_count--;
+	return 1;
+}
+
+/* reports the held down entries whose interval is over */
+static void nobd_neigh_work_fn(struct work_struct *work)
+{
+	unsigned long window = msecs_to_jiffies(neigh_flap_ms);
+	unsigned long next = 0;
+	struct nobd_neigh *e, *tmp;
+	int again = 0;
+
+	spin_lock_bh(&nobd_neigh_lock);
+	list_for_each_entry_safe(e, tmp, &nobd_neigh_pending, pending) {
+		if (time_before(jiffies, e->reported + window)) {
+			if (!again || time_before(e->reported + window, next))
+				next = e->reported + window;
+			again = 1;
+			continue;
+		}
+		list_del_init(&e->pending);
+		nobd_neigh_settle(e, 1);
+	}
+	if (again)
+		nobd_neigh_schedule(next);
+	spin_unlock_bh(&nobd_neigh_lock);
+}
+
+/*
+ * Called for every neighbour message, live or from a resync dump, with
+ * report cleared while the table is being seeded. Returns non zero if the
+ * entry changed in a way worth a record.
+ */
+int nobd_neigh_update(const struct nobd_ev_neigh *rec, u16 netns, u32 gen,
+		      int report)
+{
+	int valid = rec->op != NOBD_OP_DEL && (rec->state & NUD_VALID);
+	struct nobd_neigh *e;
+	int changed;
+
+	spin_lock_bh(&nobd_neigh_lock);
+	e = nobd_neigh_find(rec, netns);
+	if (!e) {
+		if (!valid) {
+			spin_unlock_bh(&nobd_neigh_lock);
+			return 0;
+		}
+		e = kmem_cache_zalloc(nobd_neigh_cache, GFP_ATOMIC);
+		if (!e) {
+			spin_unlock_bh(&nobd_neigh_lock);
+			return 0;
+		}
+		e->ip = rec->ip;
+		e->ifindex = rec->ifindex;
+		e->netns = netns;
+		e->family = rec->family;
+		e->reported = jiffies - msecs_to_jiffies(neigh_flap_ms) - 1;
+		INIT_LIST_HEAD(&e->pending);
+		hlist_add_head(&e->hnode, nobd_neigh_bucket(&e->ip, e->ifindex,
+							    netns, e->family));
+		nobd_neigh_count++;
+	}
+
+	changed = e->valid != valid ||
+		(valid && memcmp(e->mac, rec->lladdr, ETH_ALEN));
+	e->gen = gen;
+	e->nud = rec->state;
+	e->valid = valid;
+	if (valid)
+		memcpy(e->mac, rec->lladdr, ETH_ALEN);
+	nobd_neigh_settle(e, report);
+	spin_unlock_bh(&nobd_neigh_lock);
+
+	return changed;
+}
+
+/* a resync dump of netns is over, entries it did not return are gone */
+unsigned int nobd_neigh_sweep(u16 netns, u32 gen)
+{
+	struct nobd_neigh *e;
+	struct hlist_node *n, *tmp;
+	unsigned int i, swept = 0;
+
+	spin_lock_bh(&nobd_neigh_lock);
+	for (i = 0; i < ARRAY_SIZE(nobd_neigh_hash); i++) {
+		hlist_for_each_entry_safe(e, n, tmp, &nobd_neigh_hash[i],
+					  hnode) {
+			if (e->netns != netns || e->gen == gen)
+				continue;
+			e->valid = 0;
+			nobd_neigh_settle(e, 1);
+			swept++;
+		}
+	}
+	spin_unlock_bh(&nobd_neigh_lock);
+
+	return swept;
+}
+
+/* netns is no longer monitored, its entries go without a record */
+void nobd_neigh_purge(u16 netns)
+{
+	struct nobd_neigh *e;
+	struct hlist_node *n, *tmp;
+	unsigned int i;
+
+	spin_lock_bh(&nobd_neigh_lock);
+	for (i = 0; i < ARRAY_SIZE(nobd_neigh_hash); i++) {
+		hlist_for_each_entry_safe(e, n, tmp, &nobd_neigh_hash[i],
+					  hnode) {
+			if (e->netns != netns)
+				continue;
+			list_del(&e->pending);
+			hlist_del(&e->hnode);
+			kmem_cache_free(nobd_neigh_cache, e);
+			nobd_neigh_count--;
+		}
+	}
+	spin_unlock_bh(&nobd_neigh_lock);
+}
+
+/* snapshot of what was reported, held down changes come when they settle */
+int nobd_neigh_snap(struct nobd_snap_cur *c)
+{
+	struct nobd_neigh *e;
+	struct hlist_node *n;
+	struct nobd_ev ev;
+	int rc;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.hdr.type = NOBD_EV_NEIGH;
+	ev.neigh.op = NOBD_OP_NEW;
+	for (; c->pos < ARRAY_SIZE(nobd_neigh_hash); c->pos++) {
+		rc = nobd_snap_next(c);
+		if (rc <= 0)
+			return rc;
+		spin_lock_bh(&nobd_neigh_lock);
+		hlist_for_each_entry(e, n, &nobd_neigh_hash[c->pos], hnode) {
+			if (!e->rep_valid)
+				continue;
+			ev.hdr.netns = e->netns;
+			ev.neigh.ip = e->ip;
+			ev.neigh.ifindex = e->ifindex;
+			memcpy(ev.neigh.lladdr, e->rep_mac, ETH_ALEN);
+			ev.neigh.family = e->family;
+			ev.neigh.state = e->nud;
+			nobd_snap_emit(c, &ev);
+		}
+		spin_unlock_bh(&nobd_neigh_lock);
+	}
+	return 1;
+}
+
+static int nobd_neigh_show(struct seq_file *m, void *v)
+{
+	struct nobd_neigh *e;
+	struct hlist_node *n;
+	int i;
+
+	spin_lock_bh(&nobd_neigh_lock);
+	seq_printf(m, "# entries %u damped %lu\n", nobd_neigh_count,
+		   nobd_neigh_damped);
+	for (i = 0; i < ARRAY_SIZE(nobd_neigh_hash); i++) {
+		hlist_for_each_entry(e, n, &nobd_neigh_hash[i], hnode) {
+			if (e->family == AF_INET6)
+				seq_printf(m, "%pI6c", e->ip.ip6);
+			else
+				seq_printf(m, "%pI4", &e->ip.ip);
+			seq_printf(m, " ns %u if %u %pM state 0x%02x%s\n",
+				   e->netns, e->ifindex, e->mac, e->nud,
+				   list_empty(&e->pending) ? "" : " held");
+		}
+	}
+	spin_unlock_bh(&nobd_neigh_lock);
+	return 0;
+}
+
+static int nobd_neigh_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nobd_neigh_show, NULL);
+}
+
+static const struct file_operations nobd_neigh_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_neigh_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int nobd_neigh_init(void)
+{
+	int i;
+
+	nobd_neigh_cache = kmem_cache_create("nobd_neigh",
+					     sizeof(struct nobd_neigh), 0, 0,
+					     NULL);
+	if (!nobd_neigh_cache)
+		return -ENOMEM;
+	for (i = 0; i < ARRAY_SIZE(nobd_neigh_hash); i++)
+		INIT_HLIST_HEAD(&nobd_neigh_hash[i]);
+	proc_create("neigh", 0444, nobd_proc_dir, &nobd_neigh_fops);
+
+	return 0;
+}
+
+/* must be called once the netlink worker is stopped */
+void nobd_neigh_exit(void)
+{
+	struct nobd_neigh *e;
+	struct hlist_node *n, *tmp;
+	int i;
+
+	remove_proc_entry("neigh", nobd_proc_dir);
+	cancel_delayed_work_sync(&nobd_neigh_work);
+	for (i = 0; i < ARRAY_SIZE(nobd_neigh_hash); i++) {
+		hlist_for_each_entry_safe(e, n, tmp, &nobd_neigh_hash[i],
+					  hnode) {
+			hlist_del(&e->hnode);
+			kmem_cache_free(nobd_neigh_cache, e);
+		}
+	}
+	INIT_LIST_HEAD(&nobd_neigh_pending);
+	nobd_neigh_count = 0;
+	kmem_cache_destroy(nobd_neigh_cache);
+}
@@ -0,0 +1,371 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      Network namespaces: ids, per namespace enable and listeners.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/hash.h>
+#include <linux/idr.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/rtnetlink.h>
+#include <linux/netdevice.h>
+#include <linux/uaccess.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <net/net_namespace.h>
+
+#include "include/nobd_net.h"
+#include "include/nobd_nl.h"
+#include "include/nobd_br.h"
+#include "include/nobd_if.h"
+#include "include/nobd_proc.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt) "nobd_net: " fmt
+
+#define NOBD_NET_HBITS	8
+#define NOBD_NET_MAX_ID	0xffff
+
+static int netns_all;
+module_param(netns_all, int, 0644);
+MODULE_PARM_DESC(netns_all, "monitor namespaces created from now on, the initial one always is");
+
+/*
+ * Every namespace gets an entry when it is created, monitored or not, so
+ * its id is stable across enable and disable. Lookups come from notifier
+ * and softirq context and only take the RCU read lock.
+ */
+struct nobd_net {
+	struct hlist_node hnode;
+	struct rcu_head rcu;
+	struct net *net;
+	u16 id;
+	int enabled;
+	struct nobd_nl *nl;
+};
+
+static struct hlist_head nobd_net_hash[1 << NOBD_NET_HBITS];
+static DEFINE_MUTEX(nobd_net_lock);	/* writers, enable and disable */
+static DEFINE_IDA(nobd_net_ida);
+static unsigned int nobd_net_count;
+static unsigned int nobd_net_active;
+
+static struct hlist_head *nobd_net_bucket(struct net *net)
+{
+	return &nobd_net_hash[hash_ptr(net, NOBD_NET_HBITS)];
+}
+
+static struct nobd_net *nobd_net_find(struct net *net)
+{
+	struct nobd_net *nn;
+	struct hlist_node *n;
+
+	hlist_for_each_entry_rcu(nn, n, nobd_net_bucket(net), hnode) {
+		if (nn->net == net)
+			return nn;
+	}
+	return NULL;
+}
+
+/* id of net for its records, -1 if it is not monitored */
+int nobd_net_id(struct net *net)
+{
+	struct nobd_net *nn;
+	int id = -1;
+
+	rcu_read_lock();
+	nn = nobd_net_find(net);
+	if (nn && nn->enabled)
+		id = nn->id;
+	rcu_read_unlock();
+
+	return id;
+}
+
+/*
+ * The monitored namespace with the lowest id not below *id, for walks that
+ * resume by id. Returns it with a reference held and *id set, or NULL.
+ */
+struct net *nobd_net_next(int *id)
+{
+	struct nobd_net *nn, *best;
+	struct hlist_node *n;
+	struct net *net;
+	int i;
+
+	do {
+		best = NULL;
+		net = NULL;
+		rcu_read_lock();
+		for (i = 0; i < ARRAY_SIZE(nobd_net_hash); i++) {
+			hlist_for_each_entry_rcu(nn, n, &nobd_net_hash[i],
+						 hnode) {
+				if (!nn->enabled || nn->id < *id)
+					continue;
+				if (!best || nn->id < best->id)
+					best = nn;
+			}
+		}
+		if (best) {
+			*id = best->id;
+			/* NULL while dying, its records would not go out */
+			net = maybe_get_net(best->net);
+		}
+		rcu_read_unlock();
+	} while (best && !net && ++*id);
+
+	return net;
+}
+
+/* bridges of a namespace are only scanned while it is monitored */
+static void nobd_net_bridges(struct net *net, int reg)
+{
+	struct net_device *dev;
+
+	rtnl_lock();
+	for_each_netdev(net, dev) {
+		if (!(dev->priv_flags & IFF_EBRIDGE))
+			continue;
+		if (reg)
+			nobd_br_reg(netdev_priv(dev));
+		else
+			nobd_br_unreg(netdev_priv(dev));
+	}
+	rtnl_unlock();
+}
+
+/* called with nobd_net_lock held */
+static int nobd_net_enable(struct nobd_net *nn)
+{
+	if (nn->enabled)
+		return 0;
+	nn->nl = nobd_nl_start(nn->net, nn->id);
+	if (IS_ERR(nn->nl)) {
+		int err = PTR_ERR(nn->nl);
+
+		nn->nl = NULL;
+		return err;
+	}
+	nn->enabled = 1;
+	nobd_net_active++;
+	nobd_net_bridges(nn->net, 1);
+	return 0;
+}
+
+static void nobd_net_disable(struct nobd_net *nn)
+{
+	if (!nn->enabled)
+		return;
+	nn->enabled = 0;
+	nobd_net_active--;
+	/* no new records from now on, only those already in flight */
+	synchronize_rcu();
+	nobd_net_bridges(nn->net, 0);
+	nobd_if_purge(nn->net);
+	nobd_nl_stop(nn->nl);
+	nn->nl = NULL;
+}
+
+static int nobd_net_show(struct seq_file *m, void *v)
+{
+	struct net *net = m->private;
+	struct nobd_net *nn;
+
+	mutex_lock(&nobd_net_lock);
+	nn = nobd_net_find(net);
+	if (nn)
+		seq_printf(m, "id %u\nenabled %d\n", nn->id, nn->enabled);
+	mutex_unlock(&nobd_net_lock);
+	return 0;
+}
+
+static int nobd_net_open(struct inode *inode, struct file *file)
+{
+	return single_open_net(inode, file, nobd_net_show);
+}
+
+/* "1" starts monitoring the namespace the file belongs to, "0" stops it */
+static ssize_t nobd_net_write(struct file *file, const char __user *ubuf,
+			      size_t count, loff_t *ppos)
+{
+	struct net *net = ((struct seq_file *)file->private_data)->private;
+	struct nobd_net *nn;
+	char c;
+	int err = 0;
+
+	if (!count)
+		return 0;
+	if (get_user(c, ubuf))
+		return -EFAULT;
+	if (c != '0' && c != '1')
+		return -EINVAL;
+
+	mutex_lock(&nobd_net_lock);
+	nn = nobd_net_find(net);
+	if (!nn)
+		err = -ENOENT;
+	else if (c == '1')
+		err = nobd_net_enable(nn);
+	else
+		nobd_net_disable(nn);
+	mutex_unlock(&nobd_net_lock);
+
+	return err ? err : count;
+}
+
+static const struct file_operations nobd_net_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_net_open,
+	.read		= seq_read,
+	.write		= nobd_net_write,
+	.llseek		= seq_lseek,
+	.release	= single_release_net,
+};
+
+/* every namespace, for the host's side of the id mapping */
+static int nobd_net_list_show(struct seq_file *m, void *v)
+{
+	struct nobd_net *nn;
+	struct hlist_node *n;
+	int i;
+
+	mutex_lock(&nobd_net_lock);
+	seq_printf(m, "# namespaces %u monitored %u\n", nobd_net_count,
+		   nobd_net_active);
+	for (i = 0; i < ARRAY_SIZE(nobd_net_hash); i++) {
+		hlist_for_each_entry(nn, n, &nobd_net_hash[i], hnode)
+			seq_printf(m, "%u %s\n", nn->id,
+				   nn->enabled ? "on" : "off");
+	}
+	mutex_unlock(&nobd_net_lock);
+	return 0;
+}
+
+static int nobd_net_list_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nobd_net_list_show, NULL);
+}
+
+static const struct file_operations nobd_net_list_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_net_list_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int nobd_net_alloc_id(struct net *net)
+{
+	int id, err;
+
+	if (net == &init_net)
+		return 0;
+	do {
+		if (!ida_pre_get(&nobd_net_ida, GFP_KERNEL))
+			return -ENOMEM;
+		err = ida_get_new_above(&nobd_net_ida, 1, &id);
+	} while (err == -EAGAIN);
+	if (err)
+		return err;
+	if (id > NOBD_NET_MAX_ID) {
+		ida_remove(&nobd_net_ida, id);
+		return -ENOSPC;
+	}
+	return id;
+}
+
+static int nobd_net_pernet_init(struct net *net)
+{
+	struct nobd_net *nn;
+	int id;
+
+	nn = kzalloc(sizeof(*nn), GFP_KERNEL);
+	if (!nn)
+		return -ENOMEM;
+	id = nobd_net_alloc_id(net);
+	if (id < 0) {
+		kfree(nn);
+		return id;
+	}
+	nn->net = net;
+	nn->id = id;
+	if (!proc_net_fops_create(net, "nobd", 0600, &nobd_net_fops)) {
+		if (id)
+			ida_remove(&nobd_net_ida, id);
+		kfree(nn);
+		return -ENOMEM;
+	}
+
+	mutex_lock(&nobd_net_lock);
+	hlist_add_head_rcu(&nn->hnode, nobd_net_bucket(net));
+	nobd_net_count++;
+	/* a failed listener leaves the namespace unmonitored, not broken */
+	if ((net == &init_net || netns_all) && nobd_net_enable(nn))
+		pr_err("netns %u not monitored\n", id);
+	mutex_unlock(&nobd_net_lock);
+
+	return 0;
+}
+
+static void nobd_net_free(struct rcu_head *head)
+{
+	kfree(container_of(head, struct nobd_net, rcu));
+}
+
+static void nobd_net_pernet_exit(struct net *net)
+{
+	struct nobd_net *nn;
+
+	proc_net_remove(net, "nobd");
+	mutex_lock(&nobd_net_lock);
+	nn = nobd_net_find(net);
+	if (nn) {
+		nobd_net_disable(nn);
+		hlist_del_rcu(&nn->hnode);
+		nobd_net_count--;
+		if (nn->id)
+			ida_remove(&nobd_net_ida, nn->id);
+		call_rcu(&nn->rcu, nobd_net_free);
+	}
+	mutex_unlock(&nobd_net_lock);
+}
+
+static struct pernet_operations nobd_net_ops = {
+	.init = nobd_net_pernet_init,
+	.exit = nobd_net_pernet_exit,
+};
+
+/* needs the netlink side open, the notifiers rely on it being done */
+int nobd_net_init(void)
+{
+	int i, err;
+
+	for (i = 0; i < ARRAY_SIZE(nobd_net_hash); i++)
+		INIT_HLIST_HEAD(&nobd_net_hash[i]);
+	err = register_pernet_subsys(&nobd_net_ops);
+	if (err)
+		return err;
+	proc_create("netns", 0444, nobd_proc_dir, &nobd_net_list_fops);
+
+	return 0;
+}
+
+void nobd_net_exit(void)
+{
+	remove_proc_entry("netns", nobd_proc_dir);
+	unregister_pernet_subsys(&nobd_net_ops);
+	rcu_barrier();
+	ida_destroy(&nobd_net_ida);
+}
@@ -8,10 +8,25 @@
 #include <linux/if_link.h>
 #include <linux/rtnetlink.h>
 #include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+
+#include <linux/workqueue.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
 #include <net/sock.h>
+#include <net/net_namespace.h>
 
 #include "include/nobd_nl.h"
+#include "include/nobd_ring.h"
+#include "include/nobd_proc.h"
+#include "include/nobd_nl_state.h"
+#include "include/nobd_rt.h"
+#include "include/nobd_neigh.h"
+#include "include/nobd_stat.h"
+#include "include/nobd_nl_parse.h"
 
 
 #undef pr_fmt
@@ -26,16 +41,24 @@
 
 #define RTMGRP_NEIGH	4
 #define RTMGRP_IPV4_ROUTE	0x40
+#define RTMGRP_IPV6_ROUTE	0x400
 //#endif /* CONFIG_ARPD */
 
-#define nobd_GRP (RTMGRP_IPV4_ROUTE | RTMGRP_NEIGH | RTNLGRP_LINK | RTNLGRP_NEIGH)
-#define IFLA_RTA(r)  ((struct rtattr*)(((char*)(r)) + NLMSG_ALIGN(sizeof(struct ifinfomsg))))
-#define IFLA_PAYLOAD(n) NLMSG_PAYLOAD(n,sizeof(struct ifinfomsg))
+#define nobd_GRP (RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE | RTMGRP_NEIGH | \
+		  RTNLGRP_LINK | RTNLGRP_NEIGH)
 
 static int no_arp = 0;
 module_param(no_arp, int, 0644);
 MODULE_PARM_DESC(no_arp, "avoid reporting arp events");
 
+static int nl_budget = 64;
+module_param(nl_budget, int, 0644);
+MODULE_PARM_DESC(nl_budget, "netlink skbs handled per worker batch");
+
+static int nl_rcvbuf;
+module_param(nl_rcvbuf, int, 0444);
+MODULE_PARM_DESC(nl_rcvbuf, "netlink receive buffer in bytes, 0 keeps the default");
+
 
 struct msgnames_t {
 	int id;
@@ -53,7 +76,73 @@ struct msgnames_t {
 	{0,0}
 };
 
-static struct socket *nobd_socket;
+/* only touched by the single threaded worker */
+struct nobd_nl_stats {
+	unsigned long batches;
+	unsigned long full_batches;
+	unsigned long skbs;
+	unsigned long msgs;
+	unsigned long last_batch;
+	unsigned long max_batch;
+	unsigned long overruns;
+	unsigned long truncated;
+	unsigned long resyncs;
+	unsigned long resync_diffs;
+};
+
+/*
+ * Resync after an overrun: dump routes and neighbours of all families, then
+ * bridge ports, one at
+ * a time (a socket runs a single dump) and diff them against the last
+ * known state in nobd_nl_state.c. Dumps only make progress from recvmsg(),
+ * so while one runs the worker reads through a bounce buffer.
+ */
+enum {
+	NOBD_SYNC_IDLE,
+	NOBD_SYNC_ROUTE,
+	NOBD_SYNC_NEIGH,
+	NOBD_SYNC_LINK,
+	NOBD_SYNC_MAX,
+};
+
+static const struct {
+	u16 type;
+	u8 family;
+	u8 ev_type;
+} nobd_nl_dumps[NOBD_SYNC_MAX] = {
+	[NOBD_SYNC_ROUTE]	= { RTM_GETROUTE, AF_UNSPEC, NOBD_EV_ROUTE },
+	[NOBD_SYNC_NEIGH]	= { RTM_GETNEIGH, AF_UNSPEC, NOBD_EV_NEIGH },
+	[NOBD_SYNC_LINK]	= { RTM_GETLINK, AF_BRIDGE, NOBD_EV_LINK },
+};
+
+#define NOBD_NL_BUFSZ	8192
+#define NOBD_NL_RETRY	HZ	/* after a failed dump request */
+
+/*
+ * One listener per monitored namespace. All of them share the single
+ * threaded workqueue, which is what keeps nobd_nl_state.c lockless.
+ */
+struct nobd_nl {
+	struct list_head list;
+	struct socket *sock;
+	struct work_struct work;
+	struct work_struct purge;	/* drops the state of a stopped one */
+	struct delayed_work retry;	/* a dump request that failed */
+	u16 netns;
+	int closing;
+	int sync;			/* NOBD_SYNC_* stage running */
+	int want_sync;			/* start one once the stage is done */
+	int quiet;			/* seeding the state, report nothing */
+	u32 seq;
+	u32 gen;
+	struct nobd_nl_stats stats;
+};
+
+static struct workqueue_struct *nobd_nl_wq;
+static void *nobd_nl_buf;		/* bounce buffer of the worker */
+static LIST_HEAD(nobd_nl_list);
+static DEFINE_MUTEX(nobd_nl_lock);	/* the list */
+static struct nobd_nl_stats nobd_nl_gone;	/* of stopped listeners */
 
 static char *nobd_nl_lookup_name(struct msgnames_t *db,int id)
 {
@@ -70,15 +159,6 @@ static char *nobd_nl_lookup_name(struct msgnames_t *db,int id)
 	return name;
 }
 
-#ifndef NIPQUAD
-	#define NIPQUAD(addr) \
-	((unsigned char *)&addr)[0], \
-	((unsigned char *)&addr)[1], \
-	((unsigned char *)&addr)[2], \
-	((unsigned char *)&addr)[3]
-	#define NIPQUAD_FMT "%u.%u.%u.%u"
-#endif
-
 #if 0
 static void
 netlink_parse_rtattr(struct rtattr **tb, int max, struct rtattr *rta, int len)
@@ -91,125 +171,133 @@ netlink_parse_rtattr(struct rtattr **tb, int max, struct rtattr *rta, int len)
 }
 #endif
 
-static int nobd_nl_ev_route(struct nlmsghdr *nlh, void *buffer)
+/* a reply to our own resync dump, as opposed to a live notification */
+static int nobd_nl_is_dump(struct nobd_nl *nl, struct nlmsghdr *nlh)
 {
-	struct rtmsg *rtm;
-	struct rtattr *rta;
-	int rtl;
-	rtm = (struct rtmsg *)buffer;
-	rta = (struct rtattr*)RTM_RTA(rtm);
-	rtl = RTM_PAYLOAD(nlh);
-	printk("%s: family: %u\n", __func__, rtm->rtm_family);
-	/* parse each attr */
-	for (; RTA_OK(rta, rtl); rta = RTA_NEXT(rta, rtl)) {
-		if (rta->rta_type == RTA_DST) {
-			uint32_t dst_addr = *((uint32_t *)RTA_DATA(rta));
-			printk("dst " NIPQUAD_FMT "/%u\n", NIPQUAD(dst_addr),
-			       rtm->rtm_dst_len);
-		}
-		if (rta->rta_type == RTA_GATEWAY) {
-			uint32_t dst_gw = *((uint32_t *)RTA_DATA(rta));
-			printk("gw " NIPQUAD_FMT "\n", NIPQUAD(dst_gw));
-		}
-		if (rta->rta_type == RTA_OIF) {
-			uint32_t oif = *((uint32_t *)RTA_DATA(rta));
-			printk("oif_index %u\n", oif);
-		}
-	}
-	if (nlh->nlmsg_type == RTM_NEWROUTE) {
-		printk("new route\n");
-		/* dpa_rt_rule_add */
-	} else {
-		/* dpa_rt_rule_del */
-		printk("del route\n");
+	return nl->sync != NOBD_SYNC_IDLE &&
+		(nlh->nlmsg_flags & NLM_F_MULTI) &&
+		nlh->nlmsg_seq == nl->seq;
+}
+
+/*
+ * Live events are always reported and kept as the last known state, dump
+ * replies are only reported where they differ from it.
+ */
+static void nobd_nl_report(struct nobd_nl *nl, struct nobd_ev *ev,
+			   struct nlmsghdr *nlh)
+{
+	int dump = nobd_nl_is_dump(nl, nlh);
+	int changed;
+
+	ev->hdr.netns = nl->netns;
+	if (nobd_nl_state_is_del(ev))
+		changed = nobd_nl_state_del(ev);
+	else
+		changed = nobd_nl_state_set(ev, nl->gen);
+	/* the mirrored tables are those of the initial namespace */
+	if (changed && ev->hdr.type == NOBD_EV_ROUTE && !nl->netns)
+		nobd_rt_update(&ev->route);
+
+	if (!dump) {
+		nobd_ev_emit(ev);
+	} else if (changed && !nl->quiet) {
+		nl->stats.resync_diffs++;
+		nobd_ev_emit(ev);
 	}
+}
 
-	return 0;
+static int nobd_nl_request_dump(struct nobd_nl *nl, u16 type, u8 family)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct rtgenmsg g;
+	} req;
+	struct sockaddr_nl addr;
+	struct msghdr msg;
+	struct kvec iov;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.g));
+	req.nlh.nlmsg_type = type;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = ++nl->seq;
+	req.g.rtgen_family = family;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &addr;
+	msg.msg_namelen = sizeof(addr);
+	iov.iov_base = &req;
+	iov.iov_len = req.nlh.nlmsg_len;
+
+	return kernel_sendmsg(nl->sock, &msg, &iov, 1, iov.iov_len);
 }
 
-/* we handle only bridge if bind/unbind here,
-   the rest is done in notification chains */
-static int nobd_nl_ev_link(struct nlmsghdr *nlh, void *buffer)
+/* sweeps the stage that just finished, if any, and dumps the next one */
+static void nobd_nl_sync_step(struct nobd_nl *nl, int done)
 {
-	struct ifinfomsg *ifi;
-	struct rtattr *rta;
-//      struct interface *ifp;
-	int rtl;
-	int new_if = (nlh->nlmsg_type == RTM_NEWLINK);
-
-	ifi = (struct ifinfomsg *)buffer;
-	rta = (struct rtattr*)IFLA_RTA(ifi);
-	rtl = IFLA_PAYLOAD(nlh);
-
-	pr_debug("%s: ifi_family: %u\n", __func__, ifi->ifi_family);
-	if (ifi->ifi_family != AF_BRIDGE)
-		return 0;
-
-	if (new_if) {
-		printk("bridge if bind\n");
-	} else 
-		printk("bridge if unbind\n");
-	
-	/* parse each attr */
-	for (; RTA_OK(rta, rtl); rta = RTA_NEXT(rta, rtl)) {
-		if (rta->rta_type == IFLA_IFNAME) {
-			printk("name: %s, flags %#x, type %#x\n",(char *)RTA_DATA(rta), 
-			       ifi->ifi_flags,
-			       ifi->ifi_type);
-		}
+	int rc;
+
+	if (done && nl->sync == NOBD_SYNC_NEIGH)
+		nl->stats.resync_diffs += nobd_neigh_sweep(nl->netns, nl->gen);
+	else if (done)
+		nl->stats.resync_diffs +=
+			nobd_nl_state_sweep(nl->netns,
+					    nobd_nl_dumps[nl->sync].ev_type,
+					    nl->gen);
+
+	do {
+		nl->sync++;
+	} while (nl->sync == NOBD_SYNC_NEIGH && no_arp);
+
+	if (nl->sync >= NOBD_SYNC_MAX) {
+		nl->sync = NOBD_SYNC_IDLE;
+		if (!nl->quiet)
+			nl->stats.resyncs++;
+		nl->quiet = 0;
+		return;
 	}
-	printk("\n");
-	if (new_if) {
-		/* add */
-	} else {
-		/* del */
+
+	rc = nobd_nl_request_dump(nl, nobd_nl_dumps[nl->sync].type,
+				  nobd_nl_dumps[nl->sync].family);
+	if (rc < 0) {
+		pr_err("ns%u dump request err %d\n", nl->netns, rc);
+		/* start over later, still quiet if this was the seeding */
+		nl->sync = NOBD_SYNC_IDLE;
+		nl->want_sync = 1;
+		if (!nl->closing)
+			queue_delayed_work(nobd_nl_wq, &nl->retry,
+					   NOBD_NL_RETRY);
 	}
-	return 0;
 }
 
-static int nobd_nl_ev_arp(struct nlmsghdr *nlh, void *buffer)
+static void nobd_nl_sync_start(struct nobd_nl *nl)
 {
-	struct ndmsg *ndm;
-	struct rtattr *rta;
-	int rtl;
-	int new_neigh = 0;
-
-	ndm = (struct ndmsg *)buffer;
-	rta = (struct rtattr*)RTM_RTA(ndm);
-	rtl = RTM_PAYLOAD(nlh);
-	printk("%s: family: %u\n", __func__, ndm->ndm_family);
-	/* parse each attr */
-	for (; RTA_OK(rta, rtl); rta = RTA_NEXT(rta, rtl)) {
-		if (rta->rta_type == NDA_DST) {
-			uint32_t dst_addr = *((uint32_t *)RTA_DATA(rta));
-			printk("ip " NIPQUAD_FMT "\n", NIPQUAD(dst_addr));
-			continue;
-		}
-		if (rta->rta_type == NDA_LLADDR) {
-			#define MAX_BUF_LEN 6
-			uint8_t ha[MAX_BUF_LEN];
-			uint8_t *data = (uint8_t *)RTA_DATA(rta);
-			uint32_t data_len =
-				rta->rta_len < MAX_BUF_LEN ? rta->rta_len : MAX_BUF_LEN;
-			uint32_t i;
-
-			new_neigh = 1; /* NDA_LLADDR appears only in new entry */
-			memcpy(ha, data, data_len);
-			for (i = 0; i < data_len; i++) {
-				printk("%x:", ha[i]);
-			}
-			printk("\n");
-			continue;
-		}
-	}
-	if (new_neigh) {
-		printk("new arp entry\n");
-		/* dpa_arp_rule_add */
-	} else {
-		/* dpa_arp_rule_del */
-		printk("del arp entry\n");
-	}
-	return 0;
+	nl->want_sync = 0;
+	nl->gen++;
+	nl->sync = NOBD_SYNC_IDLE;
+	nobd_nl_sync_step(nl, 0);
+}
+
+/* NLMSG_DONE or NLMSG_ERROR closing our dump */
+static void nobd_nl_sync_done(struct nobd_nl *nl, int ok)
+{
+	if (nl->want_sync)
+		nobd_nl_sync_start(nl);
+	else
+		nobd_nl_sync_step(nl, ok);
+}
+
+/* neighbours keep their own shadow in nobd_neigh.c, which decides what to report */
+static void nobd_nl_neigh(struct nobd_nl *nl, struct nlmsghdr *nlh,
+			  struct nobd_ev_neigh *rec)
+{
+	int dump = nobd_nl_is_dump(nl, nlh);
+
+	if (nobd_neigh_update(rec, nl->netns, nl->gen,
+			      !(dump && nl->quiet)) && dump && !nl->quiet)
+		nl->stats.resync_diffs++;
 }
 
 static void nobd_nl_dump_skb(struct sk_buff *skb) 
@@ -231,69 +319,234 @@ static void nobd_nl_dump_skb(struct sk_buff *skb)
 #endif
 }
 
-/* Receive message from netlink and pass information to relevant function. */
-static void nobd_nl_data_ready(struct sock *sk, int bytes)
+/* Pass every message of one datagram to the relevant function. */
+static void nobd_nl_rcv(struct nobd_nl *nl, void *data, int len)
 {
-	int status = 0;
-	int ret = 0;
-	int len;
-	void *buf;
-	struct sk_buff *skb;
 	struct nlmsghdr *nlh;
-	
-	pr_debug("%s: got a message %u bytes\n", __func__, bytes);
-	while ((skb = skb_recv_datagram(sk, 0, 1, &ret)) == NULL) {
-		if (ret == -EAGAIN) {
-			printk(KERN_ERR "no data available\n");
+	struct nobd_ev ev;
+
+	for (nlh = (struct nlmsghdr *)data; NLMSG_OK(nlh, len);
+	    nlh = NLMSG_NEXT(nlh, len)) {
+		pr_debug("%s: nlmsg_len %u, nlmsg_type %u (%s)\n", __func__,
+			 nlh->nlmsg_len, nlh->nlmsg_type,
+			 nobd_nl_lookup_name(typenames, nlh->nlmsg_type));
+		nl->stats.msgs++;
+		switch (nobd_nl_parse(nlh, &ev, no_arp ? NOBD_NL_NO_NEIGH : 0)) {
+		case NOBD_NL_DONE:
+			if (nobd_nl_is_dump(nl, nlh))
+				nobd_nl_sync_done(nl, 1);
 			return;
+		case NOBD_NL_ERROR:
+			printk(KERN_ERR "nl message error\n");
+			if (nl->sync != NOBD_SYNC_IDLE &&
+			    nlh->nlmsg_seq == nl->seq)
+				nobd_nl_sync_done(nl, 0);
+			return;
+		case NOBD_NL_ROUTE:
+		case NOBD_NL_LINK:
+			nobd_nl_report(nl, &ev, nlh);
+			break;
+		case NOBD_NL_NEIGH:
+			nobd_nl_neigh(nl, nlh, &ev.neigh);
+			break;
 		}
-		pr_debug("recvfrom() error %d\n", -ret);
 	}
+}
 
-	len = skb->len;
-	nobd_nl_dump_skb(skb);
-	for (nlh = (struct nlmsghdr *)skb->data; NLMSG_OK(nlh, len);
-	    nlh = NLMSG_NEXT(nlh, status)) {
-		pr_debug("%s: nlmsg_len %u, nlmsg_type %u\n", __func__,
-		       nlh->nlmsg_len, nlh->nlmsg_type);
-		/* Finish of reading. */
-		if (nlh->nlmsg_type == NLMSG_DONE)
-			return;
+/* fast path: take up to budget skbs under one queue lock, no copy */
+static int nobd_nl_drain_skbs(struct nobd_nl *nl, int budget)
+{
+	struct sock *sk = nl->sock->sk;
+	struct sk_buff_head batch;
+	struct sk_buff *skb;
+	int n = 0;
+
+	__skb_queue_head_init(&batch);
+	spin_lock_bh(&sk->sk_receive_queue.lock);
+	while (n < budget &&
+	       (skb = __skb_dequeue(&sk->sk_receive_queue)) != NULL) {
+		__skb_queue_tail(&batch, skb);
+		n++;
+	}
+	spin_unlock_bh(&sk->sk_receive_queue.lock);
 
-		/* Error handling. */
-		if (nlh->nlmsg_type == NLMSG_ERROR) {
-			printk(KERN_ERR "nl message error\n");
-			return;
-		}
-		if (no_arp &&
-		    nlh->nlmsg_type != RTM_NEWNEIGH &&
-		    nlh->nlmsg_type != RTM_DELNEIGH) {
-			pr_debug("nlmsg_type: %i (%s)\n",(nlh->nlmsg_type), 
-			       nobd_nl_lookup_name(typenames,nlh->nlmsg_type));
+	while ((skb = __skb_dequeue(&batch)) != NULL) {
+		nobd_nl_dump_skb(skb);
+		nobd_nl_rcv(nl, skb->data, skb->len);
+		kfree_skb(skb);
+	}
+
+	return n;
+}
+
+/* resync path: recvmsg() is what lets the kernel continue our dump */
+static int nobd_nl_drain_copy(struct nobd_nl *nl, int budget)
+{
+	struct msghdr msg;
+	struct kvec iov;
+	int n, len;
+
+	for (n = 0; n < budget && nl->sync != NOBD_SYNC_IDLE; n++) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = nobd_nl_buf;
+		iov.iov_len = NOBD_NL_BUFSZ;
+		len = kernel_recvmsg(nl->sock, &msg, &iov, 1, NOBD_NL_BUFSZ,
+				     MSG_DONTWAIT);
+		if (len == -ENOBUFS) {
+			nl->stats.overruns++;
+			nl->want_sync = 1;
+			continue;
 		}
-		/* OK we got netlink message. */
-		buf = NLMSG_DATA(skb->data);
-		switch (nlh->nlmsg_type) {
-		case RTM_NEWROUTE:
-		case RTM_DELROUTE:
-			ret = nobd_nl_ev_route(nlh, buf);
-			break;
-		case RTM_NEWNEIGH:
-		case RTM_DELNEIGH:
-			if (!no_arp)
-				ret = nobd_nl_ev_arp(nlh, buf);
-			break;
-		case RTM_NEWLINK:
-		case RTM_DELLINK:
-			ret = nobd_nl_ev_link(nlh, buf);
+		if (len < 0)
 			break;
+		if (msg.msg_flags & MSG_TRUNC) {
+			nl->stats.truncated++;
+			continue;
 		}
+		nobd_nl_rcv(nl, nobd_nl_buf, len);
 	}
-	skb_orphan(skb);
-	kfree_skb(skb);
 
-	return;
+	return n;
 }
+
+/*
+ * Drains the receive queue in batches of at most nl_budget datagrams. Like
+ * NAPI, a full batch yields the cpu and requeues the work instead of
+ * looping until the queue is empty.
+ */
+static void nobd_nl_work_fn(struct work_struct *work)
+{
+	struct nobd_nl *nl = container_of(work, struct nobd_nl, work);
+	struct sock *sk = nl->sock->sk;
+	int budget = max(nl_budget, 1);
+	u64 start = nobd_stat_start();
+	int n;
+
+	/* netlink_overrun() flags the socket, messages are already lost */
+	if (sock_error(sk) == -ENOBUFS) {
+		nl->stats.overruns++;
+		nl->want_sync = 1;
+	}
+	if (nl->want_sync && nl->sync == NOBD_SYNC_IDLE &&
+	    !delayed_work_pending(&nl->retry))
+		nobd_nl_sync_start(nl);
+
+	if (nl->sync != NOBD_SYNC_IDLE)
+		n = nobd_nl_drain_copy(nl, budget);
+	else
+		n = nobd_nl_drain_skbs(nl, budget);
+
+	if (n) {
+		nl->stats.batches++;
+		nl->stats.skbs += n;
+		nl->stats.last_batch = n;
+		if (n > nl->stats.max_batch)
+			nl->stats.max_batch = n;
+		if (n == budget)
+			nl->stats.full_batches++;
+		pr_debug("%s: ns%u batch of %d skbs\n", __func__, nl->netns, n);
+	}
+
+	/* a full batch, or a resync that ended with live traffic queued */
+	if (!skb_queue_empty(&sk->sk_receive_queue) && !nl->closing)
+		queue_work(nobd_nl_wq, &nl->work);
+	nobd_stat_end(NOBD_ST_NL_WORK, start);
+}
+
+static void nobd_nl_retry_fn(struct work_struct *work)
+{
+	struct nobd_nl *nl = container_of(work, struct nobd_nl, retry.work);
+
+	if (!nl->closing)
+		queue_work(nobd_nl_wq, &nl->work);
+}
+
+/* runs on the workqueue as the state tables are only touched from there */
+static void nobd_nl_purge_fn(struct work_struct *work)
+{
+	struct nobd_nl *nl = container_of(work, struct nobd_nl, purge);
+
+	nobd_nl_state_purge(nl->netns);
+}
+
+/* Receive path runs in the sender's softirq, only hand off to the worker. */
+static void nobd_nl_data_ready(struct sock *sk, int bytes)
+{
+	struct nobd_nl *nl = sk->sk_user_data;
+	u64 start = nobd_stat_start();
+
+	pr_debug("%s: got a message %u bytes\n", __func__, bytes);
+	if (!nl->closing)
+		queue_work(nobd_nl_wq, &nl->work);
+	nobd_stat_end(NOBD_ST_NL_DATA_READY, start);
+}
+
+/* netlink_overrun() reports through here, the worker picks sk_err up */
+static void nobd_nl_error_report(struct sock *sk)
+{
+	struct nobd_nl *nl = sk->sk_user_data;
+
+	if (!nl->closing)
+		queue_work(nobd_nl_wq, &nl->work);
+}
+
+static void nobd_nl_stats_add(struct nobd_nl_stats *sum,
+			      const struct nobd_nl_stats *s)
+{
+	sum->batches += s->batches;
+	sum->full_batches += s->full_batches;
+	sum->skbs += s->skbs;
+	sum->msgs += s->msgs;
+	sum->last_batch = s->last_batch;
+	sum->max_batch = max(sum->max_batch, s->max_batch);
+	sum->overruns += s->overruns;
+	sum->truncated += s->truncated;
+	sum->resyncs += s->resyncs;
+	sum->resync_diffs += s->resync_diffs;
+}
+
+/* totals over every listener, stopped ones included, then one line each */
+static int nobd_nl_stats_show(struct seq_file *m, void *v)
+{
+	struct nobd_nl_stats sum = nobd_nl_gone;
+	struct nobd_nl *nl;
+	unsigned int n = 0;
+
+	mutex_lock(&nobd_nl_lock);
+	list_for_each_entry(nl, &nobd_nl_list, list) {
+		nobd_nl_stats_add(&sum, &nl->stats);
+		n++;
+	}
+	seq_printf(m, "batches %lu\nfull_batches %lu\nskbs %lu\nmsgs %lu\n"
+		   "last_batch %lu\nmax_batch %lu\nbudget %d\n",
+		   sum.batches, sum.full_batches, sum.skbs, sum.msgs,
+		   sum.last_batch, sum.max_batch, nl_budget);
+	seq_printf(m, "overruns %lu\ntruncated %lu\nresyncs %lu\n"
+		   "resync_diffs %lu\nstate_objs %u\nlisteners %u\n",
+		   sum.overruns, sum.truncated, sum.resyncs,
+		   sum.resync_diffs, nobd_nl_state_count(), n);
+	list_for_each_entry(nl, &nobd_nl_list, list)
+		seq_printf(m, "ns%u msgs %lu overruns %lu resyncs %lu "
+			   "rcvbuf %d\n", nl->netns, nl->stats.msgs,
+			   nl->stats.overruns, nl->stats.resyncs,
+			   nl->sock->sk->sk_rcvbuf);
+	mutex_unlock(&nobd_nl_lock);
+	return 0;
+}
+
+static int nobd_nl_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nobd_nl_stats_show, NULL);
+}
+
+static const struct file_operations nobd_nl_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_nl_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,24)
 extern struct neigh_table arp_tbl;
 void nobd_init_arp_neigh_tbl(struct neigh_table *tbl)
@@ -315,39 +568,155 @@ void nobd_init_arp_neigh_tbl(struct neigh_table *tbl)
 }
 #endif /* KERNEL_VERSION(2,6,24) */
 
-int nobd_nl_open(void)
+/*
+ * Starts listening to rtnetlink in net, tagging its records with netns.
+ * The socket doesn't pin the namespace, the caller stops it from the
+ * namespace's exit.
+ */
+struct nobd_nl *nobd_nl_start(struct net *net, u16 netns)
 {
+	struct nobd_nl *nl;
 	struct sock *sock;
 	struct sockaddr_nl addr;
-	int rc = sock_create_kern(AF_NETLINK,SOCK_RAW, NETLINK_ROUTE, &nobd_socket);
+	int rc;
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,24)
-	nobd_init_arp_neigh_tbl(&arp_tbl);
-#endif
+	nl = kzalloc(sizeof(*nl), GFP_KERNEL);
+	if (!nl)
+		return ERR_PTR(-ENOMEM);
+	nl->netns = netns;
+	INIT_WORK(&nl->work, nobd_nl_work_fn);
+	INIT_WORK(&nl->purge, nobd_nl_purge_fn);
+	INIT_DELAYED_WORK(&nl->retry, nobd_nl_retry_fn);
+
+	rc = sock_create_kern(AF_NETLINK,SOCK_RAW, NETLINK_ROUTE, &nl->sock);
 	if (rc < 0) {
 		printk(KERN_ERR "socket_create err %d\n", rc);
-		return rc;
+		kfree(nl);
+		return ERR_PTR(rc);
+	}
+	sk_change_net(nl->sock->sk, net);
+
+	if (nl_rcvbuf > 0) {
+		rc = kernel_setsockopt(nl->sock, SOL_SOCKET, SO_RCVBUFFORCE,
+				       (char *)&nl_rcvbuf, sizeof(nl_rcvbuf));
+		if (rc < 0)
+			printk(KERN_ERR "rcvbuf %d err %d\n", nl_rcvbuf, rc);
 	}
 
 	memset((void *)&addr, 0, sizeof(addr));
 	addr.nl_family = AF_NETLINK;
 	addr.nl_pid = 0;
 	addr.nl_groups = nobd_GRP;
-	rc = kernel_bind(nobd_socket, (struct sockaddr *)&addr, sizeof(addr));
+	rc = kernel_bind(nl->sock, (struct sockaddr *)&addr, sizeof(addr));
 	if (rc <0) {
 		printk(KERN_ERR "bind err\n");
-		return rc;
+		sk_release_kernel(nl->sock->sk);
+		kfree(nl);
+		return ERR_PTR(rc);
 	}
 
 	/* set the socket up */
-	sock = nobd_socket->sk;
+	sock = nl->sock->sk;
+	sock->sk_user_data = nl;
 	sock->sk_data_ready = nobd_nl_data_ready;
+	sock->sk_error_report = nobd_nl_error_report;
 	sock->sk_allocation = GFP_ATOMIC;
+
+	mutex_lock(&nobd_nl_lock);
+	list_add_tail(&nl->list, &nobd_nl_list);
+	mutex_unlock(&nobd_nl_lock);
+
+	/* quietly learn the current state, a later resync diffs against it */
+	nl->quiet = 1;
+	nl->want_sync = 1;
+	queue_work(nobd_nl_wq, &nl->work);
+	return nl;
+}
+
+/* forgets what was learned in the namespace, without reporting it gone */
+void nobd_nl_stop(struct nobd_nl *nl)
+{
+	mutex_lock(&nobd_nl_lock);
+	list_del(&nl->list);
+	nobd_nl_stats_add(&nobd_nl_gone, &nl->stats);
+	mutex_unlock(&nobd_nl_lock);
+
+	nl->closing = 1;
+	nl->sock->ops->shutdown(nl->sock, SHUT_RDWR);
+	/* each may queue the other until it sees closing */
+	cancel_delayed_work_sync(&nl->retry);
+	cancel_work_sync(&nl->work);
+	cancel_delayed_work_sync(&nl->retry);
+	sk_release_kernel(nl->sock->sk);
+
+	queue_work(nobd_nl_wq, &nl->purge);
+	flush_workqueue(nobd_nl_wq);
+	nobd_neigh_purge(nl->netns);
+	kfree(nl);
+}
+
+/* runs dw on the netlink worker, serialized with every listener */
+int nobd_nl_queue(struct delayed_work *dw, unsigned long delay)
+{
+	return queue_delayed_work(nobd_nl_wq, dw, delay);
+}
+
+/* some listener is still learning its namespace, its shadows are partial */
+int nobd_nl_seeding(void)
+{
+	struct nobd_nl *nl;
+	int seeding = 0;
+
+	mutex_lock(&nobd_nl_lock);
+	list_for_each_entry(nl, &nobd_nl_list, list) {
+		if (nl->quiet)
+			seeding = 1;
+	}
+	mutex_unlock(&nobd_nl_lock);
+
+	return seeding;
+}
+
+/* the parts shared by every namespace, listeners come from nobd_net.c */
+int nobd_nl_open(void)
+{
+	int rc;
+
+	rc = nobd_nl_state_init();
+	if (rc)
+		return rc;
+	rc = nobd_neigh_init();
+	if (rc)
+		goto err_state;
+	nobd_nl_buf = kmalloc(NOBD_NL_BUFSZ, GFP_KERNEL);
+	nobd_nl_wq = create_singlethread_workqueue("nobd_nl");
+	if (!nobd_nl_buf || !nobd_nl_wq) {
+		rc = -ENOMEM;
+		goto err_wq;
+	}
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,24)
+	nobd_init_arp_neigh_tbl(&arp_tbl);
+#endif
+
+	proc_create("nl_stats", 0444, nobd_proc_dir, &nobd_nl_stats_fops);
 	return 0;
+
+err_wq:
+	if (nobd_nl_wq)
+		destroy_workqueue(nobd_nl_wq);
+	kfree(nobd_nl_buf);
+	nobd_neigh_exit();
+err_state:
+	nobd_nl_state_exit();
+	return rc;
 }
 
+/* every listener must be stopped by now */
 void nobd_nl_close(void)
 {
-	nobd_socket->ops->shutdown(nobd_socket, SHUT_RDWR);
-	sock_release(nobd_socket);
+	remove_proc_entry("nl_stats", nobd_proc_dir);
+	destroy_workqueue(nobd_nl_wq);
+	kfree(nobd_nl_buf);
+	nobd_neigh_exit();
+	nobd_nl_state_exit();
 }
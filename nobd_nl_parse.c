@@ -0,0 +1,184 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      rtnetlink message parsers, shared with the userspace replay tool.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/socket.h>
+#else
+#include <string.h>
+#include <sys/socket.h>
+#endif
+#include <linux/netlink.h>
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+
+#include "include/nobd_nl_parse.h"
+
+#ifndef IFLA_RTA
+#define IFLA_RTA(r)  ((struct rtattr*)(((char*)(r)) + NLMSG_ALIGN(sizeof(struct ifinfomsg))))
+#define IFLA_PAYLOAD(n) NLMSG_PAYLOAD(n,sizeof(struct ifinfomsg))
+#endif
+
+/* the fixed header of the message has to fit before any attribute */
+#define nobd_nl_short(nlh, hdr) ((nlh)->nlmsg_len < NLMSG_LENGTH(sizeof(hdr)))
+
+/* RTA_DST and friends, 4 or 16 bytes as per the message family */
+static void nobd_nl_copy(void *dst, int size, struct rtattr *rta)
+{
+	int len = RTA_PAYLOAD(rta);
+
+	memcpy(dst, RTA_DATA(rta), len < size ? len : size);
+}
+
+static __u32 nobd_nl_u32(struct rtattr *rta)
+{
+	__u32 v = 0;
+
+	if (RTA_PAYLOAD(rta) >= sizeof(v))
+		memcpy(&v, RTA_DATA(rta), sizeof(v));
+	return v;
+}
+
+/* 1 with ev->route filled, 0 for cache routes and other families */
+int nobd_nl_parse_route(struct nlmsghdr *nlh, struct nobd_ev *ev)
+{
+	struct rtmsg *rtm = NLMSG_DATA(nlh);
+	struct rtattr *rta = RTM_RTA(rtm);
+	int rtl = RTM_PAYLOAD(nlh);
+
+	if (nobd_nl_short(nlh, struct rtmsg))
+		return 0;
+	if (rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6)
+		return 0;
+	/* IPv6 notifies and dumps its route cache, keep to the FIB */
+	if (rtm->rtm_flags & RTM_F_CLONED)
+		return 0;
+
+	memset(ev, 0, sizeof(*ev));
+	ev->hdr.type = NOBD_EV_ROUTE;
+	ev->route.family = rtm->rtm_family;
+	ev->route.dst_len = rtm->rtm_dst_len;
+	ev->route.table = rtm->rtm_table;
+	ev->route.op = nlh->nlmsg_type == RTM_NEWROUTE ?
+		NOBD_OP_NEW : NOBD_OP_DEL;
+	for (; RTA_OK(rta, rtl); rta = RTA_NEXT(rta, rtl)) {
+		switch (rta->rta_type) {
+		case RTA_DST:
+			nobd_nl_copy(ev->route.dst.b, sizeof(ev->route.dst), rta);
+			break;
+		case RTA_GATEWAY:
+			nobd_nl_copy(ev->route.gw.b, sizeof(ev->route.gw), rta);
+			break;
+		case RTA_OIF:
+			ev->route.oif = nobd_nl_u32(rta);
+			break;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Only bridge port bind/unbind (AF_BRIDGE) comes this way, the rest of
+ * the link events are taken from the notifier chains.
+ */
+int nobd_nl_parse_link(struct nlmsghdr *nlh, struct nobd_ev *ev)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct rtattr *rta = IFLA_RTA(ifi);
+	int rtl = IFLA_PAYLOAD(nlh);
+
+	if (nobd_nl_short(nlh, struct ifinfomsg))
+		return 0;
+	if (ifi->ifi_family != AF_BRIDGE)
+		return 0;
+
+	memset(ev, 0, sizeof(*ev));
+	ev->hdr.type = NOBD_EV_LINK;
+	ev->link.ifindex = ifi->ifi_index;
+	ev->link.class = NOBD_CLASS_BRPORT;
+	ev->link.op = nlh->nlmsg_type == RTM_NEWLINK ?
+		NOBD_LINK_BIND : NOBD_LINK_UNBIND;
+	for (; RTA_OK(rta, rtl); rta = RTA_NEXT(rta, rtl)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			/* one short, the record was zeroed */
+			nobd_nl_copy(ev->link.name, sizeof(ev->link.name) - 1,
+				     rta);
+			break;
+		case IFLA_MASTER:
+			ev->link.master = nobd_nl_u32(rta);
+			break;
+		}
+	}
+	return 1;
+}
+
+/* 1 with rec filled for IPv4/IPv6 neighbours */
+int nobd_nl_parse_neigh(struct nlmsghdr *nlh, struct nobd_ev_neigh *rec)
+{
+	struct ndmsg *ndm = NLMSG_DATA(nlh);
+	struct rtattr *rta = RTM_RTA(ndm);
+	int rtl = RTM_PAYLOAD(nlh);
+
+	if (nobd_nl_short(nlh, struct ndmsg))
+		return 0;
+	if (ndm->ndm_family != AF_INET && ndm->ndm_family != AF_INET6)
+		return 0;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->family = ndm->ndm_family;
+	rec->ifindex = ndm->ndm_ifindex;
+	rec->state = ndm->ndm_state;
+	rec->op = nlh->nlmsg_type == RTM_NEWNEIGH ? NOBD_OP_NEW : NOBD_OP_DEL;
+	for (; RTA_OK(rta, rtl); rta = RTA_NEXT(rta, rtl)) {
+		switch (rta->rta_type) {
+		case NDA_DST:
+			nobd_nl_copy(rec->ip.b, sizeof(rec->ip), rta);
+			break;
+		case NDA_LLADDR:
+			nobd_nl_copy(rec->lladdr, sizeof(rec->lladdr), rta);
+			break;
+		}
+	}
+	return 1;
+}
+
+/* one message of a datagram, see enum nobd_nl_msg */
+int nobd_nl_parse(struct nlmsghdr *nlh, struct nobd_ev *ev, int flags)
+{
+	switch (nlh->nlmsg_type) {
+	case NLMSG_DONE:
+		return NOBD_NL_DONE;
+	case NLMSG_ERROR:
+		return NOBD_NL_ERROR;
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		return nobd_nl_parse_route(nlh, ev) ? NOBD_NL_ROUTE :
+			NOBD_NL_SKIP;
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH:
+		if (flags & NOBD_NL_NO_NEIGH)
+			return NOBD_NL_SKIP;
+		if (!nobd_nl_parse_neigh(nlh, &ev->neigh))
+			return NOBD_NL_SKIP;
+		ev->hdr.type = NOBD_EV_NEIGH;
+		return NOBD_NL_NEIGH;
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		return nobd_nl_parse_link(nlh, ev) ? NOBD_NL_LINK :
+			NOBD_NL_SKIP;
+	}
+	return NOBD_NL_SKIP;
+}
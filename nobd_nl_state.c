@@ -0,0 +1,261 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      Last known rtnetlink state, used to diff a resync dump.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/jhash.h>
+
+#include "include/nobd_nl_state.h"
+#include "include/nobd_ring.h"
+#include "include/nobd_rt.h"
+#include "include/nobd_snap.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt) "nobd_nl_state: " fmt
+
+#define NOBD_NL_HBITS	10
+
+/*
+ * One object per route or bridge port of a namespace, holding the last
+ * record reported for it. Only the netlink worker touches the table, so there is
+ * no locking.
+ */
+struct nobd_nl_obj {
+	struct hlist_node hnode;
+	u32 gen;
+	struct nobd_ev ev;
+};
+
+static struct hlist_head nobd_nl_hash[1 << NOBD_NL_HBITS];
+static struct kmem_cache *nobd_nl_cache;
+static unsigned int nobd_nl_count;
+
+static u32 nobd_nl_key_hash(const struct nobd_ev *ev)
+{
+	switch (ev->hdr.type) {
+	case NOBD_EV_ROUTE:
+		return jhash2(ev->route.dst.ip6, 4, ev->route.dst_len |
+			      ev->route.table << 8 | ev->route.family << 16) ^
+			ev->hdr.netns;
+	case NOBD_EV_LINK:
+		return jhash_2words(ev->link.ifindex, ev->hdr.netns,
+				    NOBD_EV_LINK);
+	}
+	return 0;
+}
+
+static int nobd_nl_same_key(const struct nobd_ev *a, const struct nobd_ev *b)
+{
+	if (a->hdr.type != b->hdr.type || a->hdr.netns != b->hdr.netns)
+		return 0;
+
+	switch (a->hdr.type) {
+	case NOBD_EV_ROUTE:
+		return !memcmp(&a->route.dst, &b->route.dst,
+			       sizeof(a->route.dst)) &&
+			a->route.dst_len == b->route.dst_len &&
+			a->route.table == b->route.table &&
+			a->route.family == b->route.family;
+	case NOBD_EV_LINK:
+		return a->link.ifindex == b->link.ifindex;
+	}
+	return 0;
+}
+
+/* the record op meaning "gone" for each tracked type */
+static u8 nobd_nl_del_op(u8 type)
+{
+	return type == NOBD_EV_LINK ? NOBD_LINK_UNBIND : NOBD_OP_DEL;
+}
+
+int nobd_nl_state_is_del(const struct nobd_ev *ev)
+{
+	switch (ev->hdr.type) {
+	case NOBD_EV_ROUTE:
+		return ev->route.op == NOBD_OP_DEL;
+	case NOBD_EV_LINK:
+		return ev->link.op == NOBD_LINK_UNBIND;
+	}
+	return 0;
+}
+
+static struct nobd_nl_obj *nobd_nl_find(const struct nobd_ev *ev,
+					struct hlist_head **head)
+{
+	struct nobd_nl_obj *obj;
+	struct hlist_node *n;
+
+	*head = &nobd_nl_hash[nobd_nl_key_hash(ev) &
+			      ((1 << NOBD_NL_HBITS) - 1)];
+	hlist_for_each_entry(obj, n, *head, hnode) {
+		if (nobd_nl_same_key(&obj->ev, ev))
+			return obj;
+	}
+	return NULL;
+}
+
+/*
+ * Records ev as the current state of its object and marks it seen in gen.
+ * Returns non zero if the object is new or its record differs.
+ */
+int nobd_nl_state_set(const struct nobd_ev *ev, u32 gen)
+{
+	struct hlist_head *head;
+	struct nobd_nl_obj *obj = nobd_nl_find(ev, &head);
+	int changed = 1;
+
+	if (!obj) {
+		obj = kmem_cache_alloc(nobd_nl_cache, GFP_KERNEL);
+		if (!obj)
+			return 1;
+		hlist_add_head(&obj->hnode, head);
+		nobd_nl_count++;
+	} else {
+		changed = memcmp(obj->ev.raw, ev->raw, sizeof(ev->raw));
+	}
+	memcpy(&obj->ev, ev, sizeof(*ev));
+	obj->gen = gen;
+
+	return changed;
+}
+
+/* returns non zero if the object was known */
+int nobd_nl_state_del(const struct nobd_ev *ev)
+{
+	struct hlist_head *head;
+	struct nobd_nl_obj *obj = nobd_nl_find(ev, &head);
+
+	if (!obj)
+		return 0;
+	hlist_del(&obj->hnode);
+	kmem_cache_free(nobd_nl_cache, obj);
+	nobd_nl_count--;
+	return 1;
+}
+
+/* reports and forgets every object of type in netns not seen in gen */
+unsigned int nobd_nl_state_sweep(u16 netns, u8 type, u32 gen)
+{
+	struct nobd_nl_obj *obj;
+	struct hlist_node *n, *tmp;
+	unsigned int i, swept = 0;
+
+	for (i = 0; i < ARRAY_SIZE(nobd_nl_hash); i++) {
+		hlist_for_each_entry_safe(obj, n, tmp, &nobd_nl_hash[i],
+					  hnode) {
+			if (obj->ev.hdr.type != type ||
+			    obj->ev.hdr.netns != netns || obj->gen == gen)
+				continue;
+			/* op sits at a different offset in each payload */
+			switch (type) {
+			case NOBD_EV_ROUTE:
+				obj->ev.route.op = nobd_nl_del_op(type);
+				if (!netns)
+					nobd_rt_update(&obj->ev.route);
+				break;
+			case NOBD_EV_LINK:
+				obj->ev.link.op = nobd_nl_del_op(type);
+				break;
+			}
+			nobd_ev_emit(&obj->ev);
+			hlist_del(&obj->hnode);
+			kmem_cache_free(nobd_nl_cache, obj);
+			nobd_nl_count--;
+			swept++;
+		}
+		if (!(i & 63))
+			cond_resched();
+	}
+
+	return swept;
+}
+
+/* a namespace is no longer monitored, drop its objects silently */
+void nobd_nl_state_purge(u16 netns)
+{
+	struct nobd_nl_obj *obj;
+	struct hlist_node *n, *tmp;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(nobd_nl_hash); i++) {
+		hlist_for_each_entry_safe(obj, n, tmp, &nobd_nl_hash[i],
+					  hnode) {
+			if (obj->ev.hdr.netns != netns)
+				continue;
+			hlist_del(&obj->hnode);
+			kmem_cache_free(nobd_nl_cache, obj);
+			nobd_nl_count--;
+		}
+		if (!(i & 63))
+			cond_resched();
+	}
+}
+
+/* snapshot of the routes, from the netlink worker like every other access */
+int nobd_nl_state_snap(struct nobd_snap_cur *c)
+{
+	struct nobd_nl_obj *obj;
+	struct hlist_node *n;
+	int rc;
+
+	for (; c->pos < ARRAY_SIZE(nobd_nl_hash); c->pos++) {
+		rc = nobd_snap_next(c);
+		if (rc <= 0)
+			return rc;
+		hlist_for_each_entry(obj, n, &nobd_nl_hash[c->pos], hnode) {
+			/* bridge ports come with the links of nobd_nc.c */
+			if (obj->ev.hdr.type == NOBD_EV_ROUTE)
+				nobd_snap_emit(c, &obj->ev);
+		}
+	}
+	return 1;
+}
+
+unsigned int nobd_nl_state_count(void)
+{
+	return nobd_nl_count;
+}
+
+int nobd_nl_state_init(void)
+{
+	int i;
+
+	nobd_nl_cache = kmem_cache_create("nobd_nl_obj",
+					  sizeof(struct nobd_nl_obj), 0, 0,
+					  NULL);
+	if (!nobd_nl_cache)
+		return -ENOMEM;
+	for (i = 0; i < ARRAY_SIZE(nobd_nl_hash); i++)
+		INIT_HLIST_HEAD(&nobd_nl_hash[i]);
+
+	return 0;
+}
+
+void nobd_nl_state_exit(void)
+{
+	struct nobd_nl_obj *obj;
+	struct hlist_node *n, *tmp;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(nobd_nl_hash); i++) {
+		hlist_for_each_entry_safe(obj, n, tmp, &nobd_nl_hash[i],
+					  hnode) {
+			hlist_del(&obj->hnode);
+			kmem_cache_free(nobd_nl_cache, obj);
+		}
+	}
+	nobd_nl_count = 0;
+	kmem_cache_destroy(nobd_nl_cache);
+}
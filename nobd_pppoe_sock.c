@@ -16,11 +16,22 @@
 #include <linux/sched.h>
 #include <linux/file.h>
 #include <linux/if_pppox.h>
+#include <linux/ppp_channel.h>
+#include <linux/kprobes.h>
+#include <linux/hash.h>
+#include <linux/skbuff.h>
+#include <linux/wait.h>
+#include <linux/if_arp.h>
 #include <net/sock.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,24)
 #include <linux/fdtable.h>
 #endif
 
+#include "include/nobd_pppoe_sock.h"
+#include "include/nobd_ring.h"
+#include "include/nobd_stat.h"
+#include "include/nobd_net.h"
+
 #undef pr_fmt
 #define pr_fmt(fmt) "nobd_pppoe_sock: " fmt
 
@@ -76,16 +87,264 @@ static struct sock *get_pppox_sock_by_filp(struct file *filp)
 	return sk;
 }
 
+/*
+ * Leading members of ppp_generic.c's private struct ppp_file, which opens
+ * both struct ppp, the netdev_priv() of a unit, and struct channel. The
+ * unit number is the only way to match a unit that pppd renamed.
+ */
+struct nobd_ppp_file {
+	int kind;
+	struct sk_buff_head xq;
+	struct sk_buff_head rq;
+	wait_queue_head_t rwait;
+	atomic_t refcnt;
+	int hdrlen;
+	int index;		/* unit or channel number */
+	int dead;
+};
+
+/* and of struct channel, for the public channel it wraps */
+struct nobd_ppp_channel {
+	struct nobd_ppp_file file;
+	struct list_head list;
+	struct ppp_channel *chan;
+};
+
+/*
+ * Index of connected PPPoE channels. Every entry is hashed by its channel,
+ * and by the unit it was connected to until the unit is seen by ifindex.
+ * Entries on no unit sit on nobd_px_unbound. Units and their ifindexes are
+ * per namespace, so is every match.
+ */
+struct nobd_px {
+	struct hlist_node chan_node;
+	struct hlist_node if_node;	/* nobd_px_if, nobd_px_unit or unbound */
+	struct ppp_channel *chan;
+	struct net *net;		/* of the socket, which holds it */
+	int unit;			/* -1 when on no unit */
+	int ifindex;			/* of the unit once seen, BIND sent */
+	int chan_index;			/* taken then, chan may be gone later */
+	int pppoe_ifindex;
+	__be16 sid;
+	u8 remote[ETH_ALEN];
+	pid_t pid;
+	unsigned int gen;		/* last resync that saw it */
+};
+
+#define NOBD_PX_HBITS	8
+
+static DEFINE_SPINLOCK(nobd_px_lock);
+static struct hlist_head nobd_px_chan[1 << NOBD_PX_HBITS];
+static struct hlist_head nobd_px_if[1 << NOBD_PX_HBITS];
+static struct hlist_head nobd_px_unit[1 << NOBD_PX_HBITS];
+static HLIST_HEAD(nobd_px_unbound);
+static unsigned int nobd_px_gen;
+/* the connect and unregister hooks are in, no walk needed */
+static int nobd_px_hooked;
+
+static void nobd_pppoe_record(struct nobd_px *px, int ifindex, int op)
+{
+	struct nobd_ev *ev;
+	unsigned long flags;
+	int netns = nobd_net_id(px->net);
+
+	if (netns < 0)
+		return;
+	ev = nobd_ev_reserve(NOBD_EV_PPPOE, &flags);
+	if (!ev)
+		return;
+	ev->hdr.netns = netns;
+	ev->pppoe.ifindex = ifindex;
+	ev->pppoe.pppoe_ifindex = px->pppoe_ifindex;
+	ev->pppoe.chan = px->chan_index;
+	ev->pppoe.pid = px->pid;
+	ev->pppoe.sid = px->sid;
+	memcpy(ev->pppoe.remote, px->remote, sizeof(ev->pppoe.remote));
+	ev->pppoe.op = op;
+	nobd_ev_commit(ev, flags);
+}
+
+/* the pppox_sock embedding chan, NULL if chan isn't a PPPoE channel */
+static struct pppox_sock *nobd_px_chan_sock(struct ppp_channel *chan)
+{
+	struct pppox_sock *po = container_of(chan, struct pppox_sock, chan);
+	struct sock *sk;
+
+	/* pppoe_connect() points chan.private at the owning socket */
+	if (chan->private != (void *)po)
+		return NULL;
+	sk = sk_pppox(po);
+	if (sk->sk_family != AF_PPPOX || sk->sk_protocol != PX_PROTO_OE)
+		return NULL;
+	return po;
+}
+
+/* unit number of a ppp_generic unit, -1 for any other device */
+static int nobd_ppp_unit(struct net_device *dev)
+{
+	if (dev->type != ARPHRD_PPP)
+		return -1;
+	return ((struct nobd_ppp_file *)netdev_priv(dev))->index;
+}
+
+static struct nobd_px *nobd_px_find_chan(struct ppp_channel *chan)
+{
+	struct nobd_px *px;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(px, n,
+			     &nobd_px_chan[hash_ptr(chan, NOBD_PX_HBITS)],
+			     chan_node) {
+		if (px->chan == chan)
+			return px;
+	}
+	return NULL;
+}
+
+/* files px by the unit it is on, or as unbound, leaving any it was bound to */
+static void nobd_px_set_unit(struct nobd_px *px, int unit)
+{
+	if (px->ifindex)
+		nobd_pppoe_record(px, px->ifindex, NOBD_LINK_UNBIND);
+	hlist_del(&px->if_node);
+	px->unit = unit;
+	px->ifindex = 0;
+	if (unit < 0)
+		hlist_add_head(&px->if_node, &nobd_px_unbound);
+	else
+		hlist_add_head(&px->if_node,
+			       &nobd_px_unit[hash_32(unit, NOBD_PX_HBITS)]);
+}
+
+/*
+ * O(1): by ifindex once bound, else by the unit number of dev, which binds
+ * the entry to dev and reports it.
+ */
+static struct nobd_px *nobd_px_find_dev(struct net_device *dev)
+{
+	struct nobd_px *px;
+	struct hlist_node *n;
+	int unit;
+
+	hlist_for_each_entry(px, n,
+			     &nobd_px_if[hash_32(dev->ifindex, NOBD_PX_HBITS)],
+			     if_node) {
+		if (px->ifindex == dev->ifindex && px->net == dev_net(dev))
+			return px;
+	}
+	unit = nobd_ppp_unit(dev);
+	if (unit < 0)
+		return NULL;
+	hlist_for_each_entry(px, n,
+			     &nobd_px_unit[hash_32(unit, NOBD_PX_HBITS)],
+			     if_node) {
+		/* a failed or undone connect leaves the channel elsewhere */
+		if (px->unit == unit && px->net == dev_net(dev) &&
+		    ppp_unit_number(px->chan) == unit) {
+			hlist_del(&px->if_node);
+			px->ifindex = dev->ifindex;
+			px->chan_index = ppp_channel_index(px->chan);
+			hlist_add_head(&px->if_node,
+				       &nobd_px_if[hash_32(dev->ifindex,
+							   NOBD_PX_HBITS)]);
+			nobd_pppoe_record(px, px->ifindex, NOBD_LINK_BIND);
+			return px;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Indexes the channel of po on unit, -1 to have it looked up. Nothing is
+ * reported until the unit is matched to its device, a known channel is
+ * just marked as seen.
+ */
+static void nobd_px_add(struct pppox_sock *po, int unit, pid_t pid)
+{
+	struct nobd_px *px;
+
+	spin_lock_bh(&nobd_px_lock);
+	px = nobd_px_find_chan(&po->chan);
+	if (px) {
+		px->gen = nobd_px_gen;
+		if (unit >= 0)
+			nobd_px_set_unit(px, unit);
+		else if (!px->ifindex &&
+			 px->unit != ppp_unit_number(&po->chan))
+			nobd_px_set_unit(px, ppp_unit_number(&po->chan));
+		goto out;
+	}
+	px = kmalloc(sizeof(*px), GFP_ATOMIC);
+	if (!px) {
+		pr_err("insufficient mm for pppoe index\n");
+		goto out;
+	}
+	px->chan = &po->chan;
+	px->net = sock_net(sk_pppox(po));
+	px->pppoe_ifindex = po->pppoe_ifindex;
+	px->sid = po->pppoe_pa.sid;
+	memcpy(px->remote, po->pppoe_pa.remote, ETH_ALEN);
+	px->pid = pid;
+	px->ifindex = 0;
+	px->chan_index = 0;
+	px->gen = nobd_px_gen;
+	hlist_add_head(&px->chan_node,
+		       &nobd_px_chan[hash_ptr(px->chan, NOBD_PX_HBITS)]);
+	INIT_HLIST_NODE(&px->if_node);
+	hlist_add_head(&px->if_node, &nobd_px_unbound);
+	nobd_px_set_unit(px, unit >= 0 ? unit : ppp_unit_number(px->chan));
+out:
+	spin_unlock_bh(&nobd_px_lock);
+}
+
+/* never touches px->chan, which a sweep finds closed already */
+static void nobd_px_free(struct nobd_px *px, int report)
+{
+	if (report && px->ifindex)
+		nobd_pppoe_record(px, px->ifindex, NOBD_LINK_UNBIND);
+	hlist_del(&px->chan_node);
+	hlist_del(&px->if_node);
+	kfree(px);
+}
+
+static void nobd_px_del(struct ppp_channel *chan)
+{
+	struct nobd_px *px;
+
+	spin_lock_bh(&nobd_px_lock);
+	px = nobd_px_find_chan(chan);
+	if (px)
+		nobd_px_free(px, 1);
+	spin_unlock_bh(&nobd_px_lock);
+}
+
+/* drops every entry, or with report only those the last resync missed */
+static void nobd_px_sweep(int report)
+{
+	struct nobd_px *px;
+	struct hlist_node *n, *tmp;
+	int i;
+
+	spin_lock_bh(&nobd_px_lock);
+	for (i = 0; i < ARRAY_SIZE(nobd_px_chan); i++) {
+		hlist_for_each_entry_safe(px, n, tmp, &nobd_px_chan[i],
+					  chan_node) {
+			if (!report || px->gen != nobd_px_gen)
+				nobd_px_free(px, report);
+		}
+	}
+	spin_unlock_bh(&nobd_px_lock);
+}
+
+/* caller holds files->file_lock, see __get_files_struct() */
 static void detect_pppox_sock_files(struct files_struct *files, 
-				    struct task_struct *tsk /* just for printout */, 
-				    struct net_device *dev)
+				    struct task_struct *tsk)
 {
 	int i, j;
 	struct fdtable *fdt;
 
 	j = 0;
 
-	spin_lock(&files->file_lock);
 	fdt = files_fdtable(files);
 	for (;;) {
 		unsigned long set;
@@ -100,19 +359,12 @@ static void detect_pppox_sock_files(struct files_struct *files,
 					struct sock *sk = get_pppox_sock_by_filp(filep);
 					if (sk) {
 						struct pppox_sock *po;
-						lock_sock(sk);
+						bh_lock_sock(sk);
 						po = pppox_sk(sk);
-						/* HAIM FIXME : need a way to map between pppoe_dev and event_dev  */
-//      					if (po->pppoe_dev == dev) {
-							printk(KERN_INFO "(%s:%d) found pppoe sock!\n", __func__, __LINE__);
-							printk(KERN_INFO "Task %s,pid = %d,state = %ld, "
-									 "ch %u, ev_dev %s ev_dev_index %d, "
-									 "pppoe_dev %s index %d\n",
-							       tsk->comm, tsk->pid, tsk->state, ppp_channel_index(&po->chan),
-							       dev->name, dev->ifindex,
-							       po->pppoe_dev->name, po->pppoe_ifindex);
-//      					}
-						release_sock(sk);
+						if (sk->sk_protocol == PX_PROTO_OE &&
+						    (sk->sk_state & PPPOX_CONNECTED))
+							nobd_px_add(po, -1, tsk->pid);
+						bh_unlock_sock(sk);
 						__sock_put(sk);
 					}
 				}
@@ -121,21 +373,134 @@ static void detect_pppox_sock_files(struct files_struct *files,
 			set >>= 1;
 		}
 	}
-	spin_unlock(&files->file_lock);
 }
 
-void find_dev_pppoe_socks(struct net_device *dev)
+/* one full walk of every process' fds, marks every live session seen */
+static void nobd_px_seed(void)
 {
 	struct task_struct *tsk;
 	struct files_struct *files;
 
+	spin_lock_bh(&nobd_px_lock);
+	nobd_px_gen++;
+	spin_unlock_bh(&nobd_px_lock);
+
 	read_lock_bh(&tasklist_lock);
 	for_each_process(tsk) {
 		files = __get_files_struct(tsk);
 		if (files) {
-			detect_pppox_sock_files(files, tsk, dev);
+			detect_pppox_sock_files(files, tsk);
 		}
 		__put_files_struct(tsk);
 	}
 	read_unlock_bh(&tasklist_lock);
 }
+
+#ifdef CONFIG_KPROBES
+/*
+ * pppd connects a channel to its unit only once pppoe_connect() registered
+ * it, and the channel goes through pppox_unbind_sock(). These two calls
+ * keep the index current without any walk, and the first one tells the
+ * unit of the channel.
+ */
+static int nobd_jp_connect(void *pch, int unit)
+{
+	struct ppp_channel *chan = ((struct nobd_ppp_channel *)pch)->chan;
+	struct pppox_sock *po = chan ? nobd_px_chan_sock(chan) : NULL;
+
+	if (po)
+		nobd_px_add(po, unit, current->tgid);
+	jprobe_return();
+	return 0;
+}
+
+static void nobd_jp_unregister(struct ppp_channel *chan)
+{
+	nobd_px_del(chan);
+	jprobe_return();
+}
+
+static struct jprobe nobd_jp_conn = {
+	.entry = nobd_jp_connect,
+	.kp.symbol_name = "ppp_connect_channel",
+};
+
+static struct jprobe nobd_jp_unreg = {
+	.entry = nobd_jp_unregister,
+	.kp.symbol_name = "ppp_unregister_channel",
+};
+
+static struct jprobe *nobd_jps[] = { &nobd_jp_conn, &nobd_jp_unreg };
+#endif /* CONFIG_KPROBES */
+
+/*
+ * Without the hooks nothing keeps the index current, nor holds the channels
+ * of its entries: walk for what came and went before any entry is matched.
+ * Only those are reported, the sessions already known are left alone.
+ */
+static void nobd_px_resync(void)
+{
+	if (nobd_px_hooked)
+		return;
+	nobd_px_seed();
+	nobd_px_sweep(1);
+}
+
+void find_dev_pppoe_socks(struct net_device *dev, int op)
+{
+	struct nobd_px *px;
+	u64 start = nobd_stat_start();
+
+	nobd_px_resync();
+	spin_lock_bh(&nobd_px_lock);
+	px = nobd_px_find_dev(dev);
+	if (px)
+		nobd_pppoe_record(px, dev->ifindex, op);
+	spin_unlock_bh(&nobd_px_lock);
+	nobd_stat_end(NOBD_ST_PPPOE_FIND, start);
+}
+
+/* a ppp unit went away, its channel may be connected to a new one later */
+void nobd_pppoe_dev_gone(struct net_device *dev)
+{
+	struct nobd_px *px;
+
+	nobd_px_resync();
+	spin_lock_bh(&nobd_px_lock);
+	px = nobd_px_find_dev(dev);
+	if (px)
+		nobd_px_set_unit(px, -1);
+	spin_unlock_bh(&nobd_px_lock);
+}
+
+int nobd_pppoe_init(void)
+{
+	int i, err = 0;
+
+	for (i = 0; i < ARRAY_SIZE(nobd_px_chan); i++) {
+		INIT_HLIST_HEAD(&nobd_px_chan[i]);
+		INIT_HLIST_HEAD(&nobd_px_if[i]);
+		INIT_HLIST_HEAD(&nobd_px_unit[i]);
+	}
+#ifdef CONFIG_KPROBES
+	/* ppp_connect_channel() is static and may have been inlined */
+	err = register_jprobes(nobd_jps, ARRAY_SIZE(nobd_jps));
+	if (err)
+		pr_warning("register_jprobes err %d, walking fds on ppp events\n",
+			   err);
+	else
+		nobd_px_hooked = 1;
+#endif
+	nobd_px_seed();
+
+	return 0;
+}
+
+void nobd_pppoe_exit(void)
+{
+#ifdef CONFIG_KPROBES
+	if (nobd_px_hooked)
+		unregister_jprobes(nobd_jps, ARRAY_SIZE(nobd_jps));
+#endif
+	nobd_px_sweep(0);
+}
@@ -0,0 +1,282 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      /proc/nobd, text rendering of the binary event records.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/proc_fs.h>
+#include <linux/uaccess.h>
+#include <linux/in.h>
+
+#include "include/nobd_proc.h"
+#include "include/nobd_ring.h"
+#include "include/nobd_ct.h"
+#include "include/nobd_rl.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt) "nobd_proc: " fmt
+
+#define NOBD_LINE_LEN	256
+
+struct proc_dir_entry *nobd_proc_dir;
+
+static const char *nobd_ct_ops[] = {
+	[NOBD_CT_NEW]		= "new",
+	[NOBD_CT_DESTROY]	= "destroy",
+	[NOBD_CT_RELATED]	= "related",
+	[NOBD_CT_HELPER]	= "helper",
+	[NOBD_CT_TIMEOUT]	= "timeout",
+	[NOBD_CT_SHORT]		= "short",
+	[NOBD_CT_CLOSED]	= "closed",
+};
+
+static const char *nobd_link_ops[] = {
+	[NOBD_LINK_REGISTER]	= "register",
+	[NOBD_LINK_UNREGISTER]	= "unregister",
+	[NOBD_LINK_UP]		= "up",
+	[NOBD_LINK_DOWN]	= "down",
+	[NOBD_LINK_GOING_DOWN]	= "going_down",
+	[NOBD_LINK_CHANGE]	= "change",
+	[NOBD_LINK_BIND]	= "bind",
+	[NOBD_LINK_UNBIND]	= "unbind",
+};
+
+static const char *nobd_link_classes[] = {
+	[NOBD_CLASS_ETH]	= "eth",
+	[NOBD_CLASS_BRIDGE]	= "br",
+	[NOBD_CLASS_BRPORT]	= "brport",
+	[NOBD_CLASS_VLAN]	= "vlan",
+	[NOBD_CLASS_PPP]	= "ppp",
+};
+
+static const char *nobd_snap_ops[] = {
+	[NOBD_SNAP_BEGIN]	= "begin",
+	[NOBD_SNAP_END]		= "end",
+	[NOBD_SNAP_ABORT]	= "abort",
+};
+
+static const char *nobd_snap_what[NOBD_EV_MAX] = {
+	[NOBD_EV_NONE]	= "all",
+	[NOBD_EV_CT]	= "ct",
+	[NOBD_EV_ROUTE]	= "route",
+	[NOBD_EV_NEIGH]	= "neigh",
+	[NOBD_EV_LINK]	= "link",
+	[NOBD_EV_FDB]	= "fdb",
+};
+
+#define NOBD_NAME(tbl, i) \
+	((i) < ARRAY_SIZE(tbl) && tbl[i] ? tbl[i] : "?")
+static const char *nobd_ops[] = {
+	[NOBD_OP_NEW]		= "new",
+	[NOBD_OP_DEL]		= "del",
+	[NOBD_OP_MOVE]		= "move",
+	[NOBD_OP_CHANGE]	= "change",
+};
+
+#define NOBD_OP(op) NOBD_NAME(nobd_ops, op)
+
+/* %pI4 or %pI6c as per family, with the port as in [::1]:80 when given */
+static int nobd_addr_format(char *buf, size_t len, u8 family,
+			    const union nobd_addr *addr, int port)
+{
+	if (family == AF_INET6 && port >= 0)
+		return snprintf(buf, len, "[%pI6c]:%u", addr->ip6, port);
+	if (family == AF_INET6)
+		return snprintf(buf, len, "%pI6c", addr->ip6);
+	if (port >= 0)
+		return snprintf(buf, len, "%pI4:%u", &addr->ip, port);
+	return snprintf(buf, len, "%pI4", &addr->ip);
+}
+
+static int nobd_ev_format(const struct nobd_ev *ev, int cpu, char *buf,
+			  size_t len)
+{
+	char a[48], b[48];
+	const char *helper;
+	int n, i;
+	u64 ts = ev->hdr.ts;
+	u32 ns = do_div(ts, NSEC_PER_SEC);
+
+	n = snprintf(buf, len, "%u %llu.%06u cpu%d ns%u ", ev->hdr.seq,
+		     (unsigned long long)ts, ns / NSEC_PER_USEC, cpu,
+		     ev->hdr.netns);
+
+	switch (ev->hdr.type) {
+	case NOBD_EV_CT:
+		nobd_addr_format(a, sizeof(a), ev->ct.family, &ev->ct.src,
+				 ntohs(ev->ct.sport));
+		nobd_addr_format(b, sizeof(b), ev->ct.family, &ev->ct.dst,
+				 ntohs(ev->ct.dport));
+		n += snprintf(buf + n, len - n, "ct %s proto %u %s -> %s",
+			      NOBD_NAME(nobd_ct_ops, ev->ct.op), ev->ct.proto,
+			      a, b);
+		helper = nobd_ct_helper_name(ev->ct.helper);
+		if (helper)
+			n += snprintf(buf + n, len - n, " helper %.16s", helper);
+		if (ev->ct.count > 1)
+			n += snprintf(buf + n, len - n, " x%u", ev->ct.count);
+		if (ev->ct.sample_n > 1)
+			n += snprintf(buf + n, len - n, " 1/%u",
+				      ev->ct.sample_n);
+		if (ev->ct.duration)
+			n += snprintf(buf + n, len - n, " %ums",
+				      ev->ct.duration);
+		break;
+	case NOBD_EV_ROUTE:
+		nobd_addr_format(a, sizeof(a), ev->route.family, &ev->route.dst,
+				 -1);
+		nobd_addr_format(b, sizeof(b), ev->route.family, &ev->route.gw,
+				 -1);
+		n += snprintf(buf + n, len - n,
+			      "route %s %s/%u gw %s oif %u table %u",
+			      NOBD_OP(ev->route.op), a, ev->route.dst_len, b,
+			      ev->route.oif, ev->route.table);
+		break;
+	case NOBD_EV_NEIGH:
+		nobd_addr_format(a, sizeof(a), ev->neigh.family, &ev->neigh.ip,
+				 -1);
+		n += snprintf(buf + n, len - n,
+			      "neigh %s %s lladdr %pM if %u state 0x%02x",
+			      NOBD_OP(ev->neigh.op), a, ev->neigh.lladdr, ev->neigh.ifindex,
+			      ev->neigh.state);
+		if (ev->neigh.flaps)
+			n += snprintf(buf + n, len - n, " flaps %u",
+				      ev->neigh.flaps);
+		break;
+	case NOBD_EV_LINK:
+		n += snprintf(buf + n, len - n, "link %s %s %.16s if %u master %u",
+			      NOBD_NAME(nobd_link_classes, ev->link.class),
+			      NOBD_NAME(nobd_link_ops, ev->link.op),
+			      ev->link.name, ev->link.ifindex, ev->link.master);
+		break;
+	case NOBD_EV_FDB:
+		n += snprintf(buf + n, len - n,
+			      "fdb %s br %u %pM port %u local %u static %u age %u",
+			      NOBD_OP(ev->fdb.op), ev->fdb.br_ifindex, ev->fdb.mac,
+			      ev->fdb.port_ifindex,
+			      !!(ev->fdb.flags & NOBD_FDB_LOCAL),
+			      !!(ev->fdb.flags & NOBD_FDB_STATIC), ev->fdb.age);
+		if (ev->fdb.op == NOBD_OP_MOVE)
+			n += snprintf(buf + n, len - n, " from %u",
+				      ev->fdb.old_port_ifindex);
+		break;
+	case NOBD_EV_VLAN:
+		n += snprintf(buf + n, len - n, "vlan %s %.16s if %u vid %u real %u",
+			      NOBD_NAME(nobd_link_ops, ev->vlan.op),
+			      ev->vlan.name, ev->vlan.ifindex, ev->vlan.vid,
+			      ev->vlan.real_ifindex);
+		break;
+	case NOBD_EV_PPPOE:
+		n += snprintf(buf + n, len - n,
+			      "pppoe %s if %u sid %u remote %pM dev %u ch %u pid %u",
+			      NOBD_NAME(nobd_link_ops, ev->pppoe.op),
+			      ev->pppoe.ifindex, ntohs(ev->pppoe.sid),
+			      ev->pppoe.remote, ev->pppoe.pppoe_ifindex,
+			      ev->pppoe.chan, ev->pppoe.pid);
+		break;
+	case NOBD_EV_DROPS:
+		n += snprintf(buf + n, len - n, "drops %ums",
+			      ev->drops.interval_ms);
+		for (i = 0; i < NOBD_RL_MAX; i++) {
+			if (ev->drops.dropped[i])
+				n += snprintf(buf + n, len - n, " %s %u",
+					      nobd_rl_name(i),
+					      ev->drops.dropped[i]);
+		}
+		break;
+	case NOBD_EV_SNAP:
+		n += snprintf(buf + n, len - n, "snap %s %s id %u",
+			      NOBD_NAME(nobd_snap_ops, ev->snap.op),
+			      NOBD_NAME(nobd_snap_what, ev->snap.what),
+			      ev->snap.id);
+		if (ev->snap.op != NOBD_SNAP_BEGIN)
+			n += snprintf(buf + n, len - n, " records %u lost %u",
+				      ev->snap.count, ev->snap.lost);
+		break;
+	default:
+		n += snprintf(buf + n, len - n, "type %u", ev->hdr.type);
+		break;
+	}
+	if (n >= len - 1)
+		n = len - 2;
+	buf[n++] = '\n';
+	buf[n] = '\0';
+
+	return n;
+}
+
+/* text is only produced here, reading consumes the rings like /dev/nobd */
+static ssize_t nobd_proc_events_read(struct file *filp, char __user *ubuf,
+				     size_t count, loff_t *ppos)
+{
+	char line[NOBD_LINE_LEN];
+	struct nobd_ev ev;
+	const struct nobd_ev *p;
+	ssize_t done = 0;
+	int cpu, len;
+
+	while ((p = nobd_ring_oldest(&cpu)) != NULL) {
+		memcpy(&ev, p, sizeof(ev));
+		if (ev.hdr.version != NOBD_EV_VERSION) {
+			nobd_ring_consume(cpu);
+			continue;
+		}
+		len = nobd_ev_format(&ev, cpu, line, sizeof(line));
+		if (len > count - done)
+			break;
+		if (copy_to_user(ubuf + done, line, len))
+			return done ? done : -EFAULT;
+		nobd_ring_consume(cpu);
+		done += len;
+	}
+
+	return done;
+}
+
+static int nobd_proc_events_open(struct inode *inode, struct file *filp)
+{
+	return nobd_ring_claim();
+}
+
+static int nobd_proc_events_release(struct inode *inode, struct file *filp)
+{
+	nobd_ring_unclaim();
+	return 0;
+}
+
+static const struct file_operations nobd_proc_events_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_proc_events_open,
+	.read		= nobd_proc_events_read,
+	.release	= nobd_proc_events_release,
+};
+
+int nobd_proc_init(void)
+{
+	nobd_proc_dir = proc_mkdir("nobd", NULL);
+	if (!nobd_proc_dir)
+		return -ENOMEM;
+
+	if (!proc_create("events", 0400, nobd_proc_dir,
+			 &nobd_proc_events_fops)) {
+		remove_proc_entry("nobd", NULL);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void nobd_proc_exit(void)
+{
+	remove_proc_entry("events", nobd_proc_dir);
+	remove_proc_entry("nobd", NULL);
+}
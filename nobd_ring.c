@@ -0,0 +1,339 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      Per-CPU event rings exported through the /dev/nobd misc device.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
+#include <linux/uaccess.h>
+
+#include "include/nobd_ring.h"
+#include "include/nobd_rl.h"
+#include "include/nobd_filter.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt) "nobd_ring: " fmt
+
+static int ring_pages = 16;
+module_param(ring_pages, int, 0444);
+MODULE_PARM_DESC(ring_pages, "record pages per cpu ring, rounded up to a power of two");
+
+/* kernel private copy of the producer index, userspace may scribble on ctl */
+struct nobd_ring {
+	struct nobd_ring_ctl *ctl;
+	struct nobd_ev *ev;
+	u32 head;
+};
+
+static DEFINE_PER_CPU(struct nobd_ring, nobd_rings);
+static DECLARE_WAIT_QUEUE_HEAD(nobd_ring_wq);
+static atomic_t nobd_ring_seq = ATOMIC_INIT(0);
+static atomic_t nobd_ring_busy = ATOMIC_INIT(0);
+static void *nobd_ring_base;
+static unsigned long nobd_ring_stride;
+static u32 nobd_ring_mask;
+
+/*
+ * Returns a slot on the local cpu ring with irqs disabled, or NULL when the
+ * ring is full. Must be paired with nobd_ev_commit().
+ */
+struct nobd_ev *nobd_ev_reserve(u8 type, unsigned long *flags)
+{
+	struct nobd_ring *r;
+	struct nobd_ev *ev;
+	u32 tail;
+
+	if (unlikely(!nobd_ring_base))
+		return NULL;
+	local_irq_save(*flags);
+	r = &__get_cpu_var(nobd_rings);
+	tail = ACCESS_ONCE(r->ctl->tail);
+	if (unlikely(r->head - tail > nobd_ring_mask)) {
+		r->ctl->drops++;
+		local_irq_restore(*flags);
+		return NULL;
+	}
+	ev = &r->ev[r->head & nobd_ring_mask];
+	memset(ev, 0, sizeof(*ev));
+	ev->hdr.version = NOBD_EV_VERSION;
+	ev->hdr.type = type;
+
+	return ev;
+}
+
+/* moves head past a reserved slot and restores irqs */
+static void nobd_ev_publish(struct nobd_ev *ev, unsigned long flags)
+{
+	struct nobd_ring *r = &__get_cpu_var(nobd_rings);
+
+	ev->hdr.seq = atomic_inc_return(&nobd_ring_seq);
+	/* held records come stamped with the time of their first event */
+	if (!ev->hdr.ts)
+		ev->hdr.ts = ktime_to_ns(ktime_get_real());
+	/* record body must be visible before the consumer sees head move */
+	smp_wmb();
+	r->ctl->head = ++r->head;
+	local_irq_restore(flags);
+
+	smp_mb();
+	if (waitqueue_active(&nobd_ring_wq))
+		wake_up_interruptible(&nobd_ring_wq);
+}
+
+/*
+ * Publishes a filled slot, unless the filter or the rate limiter turn it
+ * down, in which case the slot is simply reused by the next reserve. Ct
+ * records already went through the filter before they were coalesced,
+ * drop reports skip it as snapshot markers do. Returns non zero if the
+ * record went out.
+ */
+int nobd_ev_commit(struct nobd_ev *ev, unsigned long flags)
+{
+	if ((ev->hdr.type != NOBD_EV_CT && ev->hdr.type != NOBD_EV_DROPS &&
+	     !nobd_flt_pass(ev->hdr.type, ev->hdr.netns, ev->raw)) ||
+	    !nobd_rl_admit(nobd_rl_class(ev))) {
+		local_irq_restore(flags);
+		return 0;
+	}
+	nobd_ev_publish(ev, flags);
+	return 1;
+}
+
+/* copies a record built elsewhere, for callers that keep state around it */
+void nobd_ev_emit(const struct nobd_ev *src)
+{
+	struct nobd_ev *ev;
+	unsigned long flags;
+
+	ev = nobd_ev_reserve(src->hdr.type, &flags);
+	if (!ev)
+		return;
+	ev->hdr.netns = src->hdr.netns;
+	memcpy(ev->raw, src->raw, sizeof(ev->raw));
+	nobd_ev_commit(ev, flags);
+}
+
+/*
+ * Snapshot records skip the rate limiter, the walkers pace themselves with
+ * nobd_ring_room() instead, and markers skip the filter as well. Returns 1
+ * if the record went out, 0 if it was filtered, -ENOSPC if the ring is full.
+ */
+int nobd_ev_emit_snap(const struct nobd_ev *src)
+{
+	struct nobd_ev *ev;
+	unsigned long flags;
+
+	if (src->hdr.type != NOBD_EV_SNAP &&
+	    !nobd_flt_pass(src->hdr.type, src->hdr.netns, src->raw))
+		return 0;
+	ev = nobd_ev_reserve(src->hdr.type, &flags);
+	if (!ev)
+		return -ENOSPC;
+	ev->hdr.netns = src->hdr.netns;
+	memcpy(ev->raw, src->raw, sizeof(ev->raw));
+	nobd_ev_publish(ev, flags);
+	return 1;
+}
+
+/* the local ring is at most half full, the other half is for live records */
+int nobd_ring_room(void)
+{
+	struct nobd_ring *r;
+	int room;
+
+	if (unlikely(!nobd_ring_base))
+		return 0;
+	r = &get_cpu_var(nobd_rings);
+	room = r->head - ACCESS_ONCE(r->ctl->tail) <= nobd_ring_mask / 2;
+	put_cpu_var(nobd_rings);
+
+	return room;
+}
+
+static int nobd_ring_pending(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct nobd_ring *r = &per_cpu(nobd_rings, cpu);
+
+		if (ACCESS_ONCE(r->ctl->tail) != r->head)
+			return 1;
+	}
+	return 0;
+}
+
+/* the consumer owns every tail, so there can be only one */
+int nobd_ring_claim(void)
+{
+	if (atomic_cmpxchg(&nobd_ring_busy, 0, 1))
+		return -EBUSY;
+	return 0;
+}
+
+void nobd_ring_unclaim(void)
+{
+	atomic_set(&nobd_ring_busy, 0);
+}
+
+/* in-kernel consumer: oldest unread record over all rings, by sequence */
+const struct nobd_ev *nobd_ring_oldest(int *cpu)
+{
+	const struct nobd_ev *ev, *oldest = NULL;
+	int i;
+
+	for_each_possible_cpu(i) {
+		struct nobd_ring *r = &per_cpu(nobd_rings, i);
+		u32 tail = r->ctl->tail;
+
+		if (tail == ACCESS_ONCE(r->head))
+			continue;
+		smp_rmb();
+		ev = &r->ev[tail & nobd_ring_mask];
+		if (!oldest || (s32)(ev->hdr.seq - oldest->hdr.seq) < 0) {
+			oldest = ev;
+			*cpu = i;
+		}
+	}
+
+	return oldest;
+}
+
+void nobd_ring_consume(int cpu)
+{
+	struct nobd_ring *r = &per_cpu(nobd_rings, cpu);
+
+	smp_mb();
+	r->ctl->tail++;
+}
+
+static int nobd_ring_open(struct inode *inode, struct file *filp)
+{
+	return nobd_ring_claim();
+}
+
+static int nobd_ring_release(struct inode *inode, struct file *filp)
+{
+	nobd_ring_unclaim();
+	return 0;
+}
+
+static int nobd_ring_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (vma->vm_pgoff ||
+	    size > nobd_ring_stride * nr_cpu_ids)
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, nobd_ring_base, 0);
+}
+
+static unsigned int nobd_ring_poll(struct file *filp, poll_table *wait)
+{
+	poll_wait(filp, &nobd_ring_wq, wait);
+	if (nobd_ring_pending())
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static long nobd_ring_ioctl(struct file *filp, unsigned int cmd,
+			    unsigned long arg)
+{
+	struct nobd_geometry geo;
+
+	switch (cmd) {
+	case NOBD_IOC_GEOMETRY:
+		geo.version = NOBD_EV_VERSION;
+		geo.nr_rings = nr_cpu_ids;
+		geo.ring_bytes = nobd_ring_stride;
+		geo.ev_offset = PAGE_SIZE;
+		geo.nr_ev = nobd_ring_mask + 1;
+		geo.ev_size = sizeof(struct nobd_ev);
+		if (copy_to_user((void __user *)arg, &geo, sizeof(geo)))
+			return -EFAULT;
+		return 0;
+	}
+
+	return -ENOTTY;
+}
+
+static const struct file_operations nobd_ring_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_ring_open,
+	.release	= nobd_ring_release,
+	.mmap		= nobd_ring_mmap,
+	.poll		= nobd_ring_poll,
+	.unlocked_ioctl	= nobd_ring_ioctl,
+};
+
+static struct miscdevice nobd_ring_dev = {
+	.minor	= MISC_DYNAMIC_MINOR,
+	.name	= NOBD_DEV_NAME,
+	.fops	= &nobd_ring_fops,
+};
+
+int nobd_ring_init(void)
+{
+	int cpu, err;
+	unsigned long pages;
+
+	BUILD_BUG_ON(sizeof(struct nobd_ev) != NOBD_EV_SIZE);
+	BUILD_BUG_ON(sizeof(struct nobd_ring_ctl) > PAGE_SIZE);
+
+	if (ring_pages < 1)
+		ring_pages = 1;
+	pages = roundup_pow_of_two(ring_pages);
+	nobd_ring_mask = pages * PAGE_SIZE / sizeof(struct nobd_ev) - 1;
+	nobd_ring_stride = (pages + 1) * PAGE_SIZE;
+
+	nobd_ring_base = vmalloc_user(nobd_ring_stride * nr_cpu_ids);
+	if (!nobd_ring_base) {
+		pr_err("insufficient mm for %u rings\n", nr_cpu_ids);
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct nobd_ring *r = &per_cpu(nobd_rings, cpu);
+		void *p = nobd_ring_base + cpu * nobd_ring_stride;
+
+		r->ctl = p;
+		r->ev = p + PAGE_SIZE;
+		r->head = 0;
+	}
+
+	err = misc_register(&nobd_ring_dev);
+	if (err) {
+		pr_err("misc_register err %d\n", err);
+		vfree(nobd_ring_base);
+		nobd_ring_base = NULL;
+		return err;
+	}
+	pr_info("%u rings of %u records\n", nr_cpu_ids, nobd_ring_mask + 1);
+
+	return 0;
+}
+
+void nobd_ring_exit(void)
+{
+	misc_deregister(&nobd_ring_dev);
+	vfree(nobd_ring_base);
+	nobd_ring_base = NULL;
+}
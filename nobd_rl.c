@@ -0,0 +1,281 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      Per event class token buckets in front of the rings.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/jiffies.h>
+#include <linux/workqueue.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+
+#include "include/nobd_rl.h"
+#include "include/nobd_ring.h"
+#include "include/nobd_proc.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt) "nobd_rl: " fmt
+
+/* indexed by enum nobd_rl_class, 0 leaves a class unlimited */
+static unsigned int rl_rate[NOBD_RL_MAX];
+module_param_array(rl_rate, uint, NULL, 0644);
+MODULE_PARM_DESC(rl_rate, "records per second for ct_new,ct_destroy,route,neigh,link,fdb,pppoe,vlan, 0 is unlimited");
+
+static unsigned int rl_burst[NOBD_RL_MAX];
+module_param_array(rl_burst, uint, NULL, 0644);
+MODULE_PARM_DESC(rl_burst, "bucket depth per class in records, 0 is one second of rl_rate");
+
+static unsigned int rl_report_ms = 1000;
+module_param(rl_report_ms, uint, 0644);
+MODULE_PARM_DESC(rl_report_ms, "interval of the suppressed records report");
+
+static const char *nobd_rl_names[NOBD_RL_MAX] = {
+	[NOBD_RL_CT_NEW]	= "ct_new",
+	[NOBD_RL_CT_DESTROY]	= "ct_destroy",
+	[NOBD_RL_ROUTE]		= "route",
+	[NOBD_RL_NEIGH]		= "neigh",
+	[NOBD_RL_LINK]		= "link",
+	[NOBD_RL_FDB]		= "fdb",
+	[NOBD_RL_PPPOE]		= "pppoe",
+	[NOBD_RL_VLAN]		= "vlan",
+};
+
+/*
+ * Tokens are kept in 1/HZ units so a jiffy refills exactly rate of them
+ * and a record costs HZ. Records are not paid from the shared bucket:
+ * every cpu takes a batch of tokens at a time and spends them on its own,
+ * so the lock is taken once a batch and not once a record.
+ */
+struct nobd_rl_bucket {
+	spinlock_t lock;
+	u64 tokens;
+	unsigned long last;
+	unsigned long reported;		/* dropped at the last report */
+};
+
+struct nobd_rl_cpu {
+	u64 tokens;
+	unsigned long dry;		/* jiffy the shared bucket ran dry */
+	unsigned long passed;
+	unsigned long dropped;
+};
+
+static struct nobd_rl_bucket nobd_rl[NOBD_RL_MAX];
+static DEFINE_PER_CPU(struct nobd_rl_cpu, nobd_rl_cpu[NOBD_RL_MAX]);
+static unsigned long nobd_rl_last_report;
+
+static void nobd_rl_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(nobd_rl_work, nobd_rl_work_fn);
+
+const char *nobd_rl_name(int class)
+{
+	if (class < 0 || class >= NOBD_RL_MAX)
+		return "?";
+	return nobd_rl_names[class];
+}
+
+/* rate limiter class of a record, -1 is exempt */
+int nobd_rl_class(const struct nobd_ev *ev)
+{
+	switch (ev->hdr.type) {
+	case NOBD_EV_CT:
+		switch (ev->ct.op) {
+		case NOBD_CT_DESTROY:
+		case NOBD_CT_TIMEOUT:
+		case NOBD_CT_CLOSED:
+		case NOBD_CT_SHORT:
+			return NOBD_RL_CT_DESTROY;
+		}
+		return NOBD_RL_CT_NEW;
+	case NOBD_EV_ROUTE:
+		return NOBD_RL_ROUTE;
+	case NOBD_EV_NEIGH:
+		return NOBD_RL_NEIGH;
+	case NOBD_EV_LINK:
+		return NOBD_RL_LINK;
+	case NOBD_EV_FDB:
+		return NOBD_RL_FDB;
+	case NOBD_EV_VLAN:
+		return NOBD_RL_VLAN;
+	case NOBD_EV_PPPOE:
+		return NOBD_RL_PPPOE;
+	}
+	return -1;
+}
+
+/*
+ * Refills the shared bucket of class and moves up to a batch of its tokens
+ * to c, about 1/64 of a second of rate. Returns non zero if c got any.
+ */
+static int nobd_rl_take(int class, struct nobd_rl_cpu *c, unsigned int rate)
+{
+	struct nobd_rl_bucket *b = &nobd_rl[class];
+	unsigned int burst = ACCESS_ONCE(rl_burst[class]);
+	u64 cap = (u64)(burst ? burst : rate) * HZ;
+	u64 batch = (u64)clamp(rate / 64, 1U, 64U) * HZ;
+	unsigned long now;
+
+	spin_lock(&b->lock);
+	now = jiffies;
+	b->tokens += (u64)(now - b->last) * rate;
+	b->last = now;
+	if (b->tokens > cap)
+		b->tokens = cap;
+	if (b->tokens < HZ) {
+		spin_unlock(&b->lock);
+		/* nothing comes in before the next jiffy */
+		c->dry = now;
+		return 0;
+	}
+	/* running low, share what is left a record at a time */
+	if (b->tokens < batch)
+		batch = HZ;
+	b->tokens -= batch;
+	spin_unlock(&b->lock);
+	c->tokens += batch;
+
+	return 1;
+}
+
+/*
+ * Returns non zero if a record of class may go to the rings. Called with
+ * irqs off from nobd_ev_commit(), which keeps the cpu and its state ours.
+ */
+int nobd_rl_admit(int class)
+{
+	struct nobd_rl_cpu *c;
+	unsigned int rate;
+
+	if (class < 0 || class >= NOBD_RL_MAX)
+		return 1;
+	c = &__get_cpu_var(nobd_rl_cpu)[class];
+	rate = ACCESS_ONCE(rl_rate[class]);
+	if (!rate) {
+		c->passed++;
+		return 1;
+	}
+
+	if (c->tokens < HZ &&
+	    (c->dry == jiffies || !nobd_rl_take(class, c, rate))) {
+		c->dropped++;
+		return 0;
+	}
+	c->tokens -= HZ;
+	c->passed++;
+
+	return 1;
+}
+
+static void nobd_rl_sum(int class, unsigned long *passed,
+			unsigned long *dropped)
+{
+	struct nobd_rl_cpu *c;
+	int cpu;
+
+	*passed = *dropped = 0;
+	for_each_possible_cpu(cpu) {
+		c = &per_cpu(nobd_rl_cpu, cpu)[class];
+		*passed += ACCESS_ONCE(c->passed);
+		*dropped += ACCESS_ONCE(c->dropped);
+	}
+}
+
+/*
+ * Reports what each class lost since the previous report. The counts are
+ * only advanced once the record made it to a ring, so none are lost.
+ */
+static void nobd_rl_report(void)
+{
+	u32 dropped[NOBD_RL_MAX];
+	struct nobd_ev *ev;
+	unsigned long flags, now = jiffies;
+	unsigned long passed, total;
+	int i, any = 0;
+
+	for (i = 0; i < NOBD_RL_MAX; i++) {
+		nobd_rl_sum(i, &passed, &total);
+		dropped[i] = total - nobd_rl[i].reported;
+		any |= dropped[i] != 0;
+	}
+	if (!any) {
+		nobd_rl_last_report = now;
+		return;
+	}
+
+	ev = nobd_ev_reserve(NOBD_EV_DROPS, &flags);
+	if (!ev)
+		return;
+	ev->drops.interval_ms = jiffies_to_msecs(now - nobd_rl_last_report);
+	memcpy(ev->drops.dropped, dropped, sizeof(dropped));
+	if (!nobd_ev_commit(ev, flags))
+		return;
+
+	for (i = 0; i < NOBD_RL_MAX; i++)
+		nobd_rl[i].reported += dropped[i];
+	nobd_rl_last_report = now;
+}
+
+static void nobd_rl_work_fn(struct work_struct *work)
+{
+	nobd_rl_report();
+	schedule_delayed_work(&nobd_rl_work,
+			      msecs_to_jiffies(max(rl_report_ms, 10U)));
+}
+
+static int nobd_rl_show(struct seq_file *m, void *v)
+{
+	unsigned long passed, dropped;
+	int i;
+
+	for (i = 0; i < NOBD_RL_MAX; i++) {
+		nobd_rl_sum(i, &passed, &dropped);
+		seq_printf(m, "%-10s rate %u burst %u passed %lu dropped %lu\n",
+			   nobd_rl_names[i], rl_rate[i], rl_burst[i], passed,
+			   dropped);
+	}
+	return 0;
+}
+
+static int nobd_rl_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nobd_rl_show, NULL);
+}
+
+static const struct file_operations nobd_rl_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_rl_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int nobd_rl_init(void)
+{
+	int i;
+
+	for (i = 0; i < NOBD_RL_MAX; i++)
+		spin_lock_init(&nobd_rl[i].lock);
+	if (!proc_create("ratelimit", 0444, nobd_proc_dir, &nobd_rl_fops))
+		return -ENOMEM;
+	nobd_rl_last_report = jiffies;
+	schedule_delayed_work(&nobd_rl_work, msecs_to_jiffies(rl_report_ms));
+
+	return 0;
+}
+
+void nobd_rl_exit(void)
+{
+	cancel_delayed_work_sync(&nobd_rl_work);
+	remove_proc_entry("ratelimit", nobd_proc_dir);
+}
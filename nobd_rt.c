@@ -0,0 +1,392 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      Mirror of the IPv4 and IPv6 main tables with longest prefix match.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/bitops.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/rtnetlink.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+
+#include "include/nobd_rt.h"
+#include "include/nobd_proc.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt) "nobd_rt: " fmt
+
+/*
+ * Path compressed binary trie, one per family. A node either carries a
+ * route or is a glue node with two children, so a lookup visits at most
+ * one node per prefix length. Keys are host order words with the bits
+ * past plen cleared.
+ */
+struct nobd_rt_key {
+	u32 w[4];
+};
+
+struct nobd_rt_node {
+	struct nobd_rt_node *child[2];
+	struct nobd_rt_key key;
+	u8 plen;
+	u8 has_route;
+	struct nobd_rt_route rt;
+};
+
+enum {
+	NOBD_RT_V4,
+	NOBD_RT_V6,
+	NOBD_RT_MAX,
+};
+
+static const u8 nobd_rt_maxlen[NOBD_RT_MAX] = { 32, 128 };
+
+/* written by the netlink worker only, looked up from any context */
+static DEFINE_RWLOCK(nobd_rt_lock);
+static struct nobd_rt_node *nobd_rt_root[NOBD_RT_MAX];
+static unsigned int nobd_rt_routes;
+static unsigned int nobd_rt_nodes;
+
+static inline int nobd_rt_bit(const struct nobd_rt_key *key, u8 pos)
+{
+	return (key->w[pos >> 5] >> (31 - (pos & 31))) & 1;
+}
+
+/* length of the prefix shared by a and b, capped at max */
+static u8 nobd_rt_common(const struct nobd_rt_key *a,
+			 const struct nobd_rt_key *b, u8 max)
+{
+	unsigned int i, n = 128;
+	u32 x;
+
+	for (i = 0; i < 4; i++) {
+		x = a->w[i] ^ b->w[i];
+		if (x) {
+			n = i * 32 + 32 - fls(x);
+			break;
+		}
+	}
+	return min_t(unsigned int, n, max);
+}
+
+/* prefix match of key against node n */
+static inline int nobd_rt_covers(const struct nobd_rt_node *n,
+				 const struct nobd_rt_key *key)
+{
+	return nobd_rt_common(key, &n->key, n->plen) == n->plen;
+}
+
+static void nobd_rt_key_mask(struct nobd_rt_key *key, u8 plen)
+{
+	unsigned int i;
+
+	for (i = 0; i < 4; i++, plen = plen > 32 ? plen - 32 : 0) {
+		if (plen >= 32)
+			continue;
+		key->w[i] &= plen ? ~0U << (32 - plen) : 0;
+	}
+}
+
+static int nobd_rt_key_from(struct nobd_rt_key *key, u8 family,
+			    const union nobd_addr *addr)
+{
+	unsigned int i;
+
+	memset(key, 0, sizeof(*key));
+	switch (family) {
+	case AF_INET:
+		key->w[0] = ntohl(addr->ip);
+		return NOBD_RT_V4;
+	case AF_INET6:
+		for (i = 0; i < 4; i++)
+			key->w[i] = ntohl(addr->ip6[i]);
+		return NOBD_RT_V6;
+	}
+	return -1;
+}
+
+static struct nobd_rt_node *nobd_rt_node_init(struct nobd_rt_node *n,
+					      const struct nobd_rt_key *key,
+					      u8 plen)
+{
+	memset(n, 0, sizeof(*n));
+	n->key = *key;
+	nobd_rt_key_mask(&n->key, plen);
+	n->plen = plen;
+	nobd_rt_nodes++;
+	return n;
+}
+
+/*
+ * Returns the node for key/plen, creating it and at most one glue node
+ * from the two spares. Used spares are cleared.
+ */
+static struct nobd_rt_node *nobd_rt_insert(struct nobd_rt_node **pp,
+					   const struct nobd_rt_key *key,
+					   u8 plen, struct nobd_rt_node **spare)
+{
+	struct nobd_rt_node *n, *new, *glue;
+	u8 match;
+
+	while ((n = *pp) != NULL) {
+		match = nobd_rt_common(key, &n->key, min(plen, n->plen));
+		if (match == n->plen) {
+			if (n->plen == plen)
+				return n;
+			pp = &n->child[nobd_rt_bit(key, n->plen)];
+			continue;
+		}
+		new = nobd_rt_node_init(spare[0], key, plen);
+		spare[0] = NULL;
+		if (match == plen) {
+			/* the new prefix covers n */
+			new->child[nobd_rt_bit(&n->key, plen)] = n;
+			*pp = new;
+			return new;
+		}
+		glue = nobd_rt_node_init(spare[1], key, match);
+		spare[1] = NULL;
+		glue->child[nobd_rt_bit(&n->key, match)] = n;
+		glue->child[nobd_rt_bit(key, match)] = new;
+		*pp = glue;
+		return new;
+	}
+
+	new = nobd_rt_node_init(spare[0], key, plen);
+	spare[0] = NULL;
+	*pp = new;
+	return new;
+}
+
+/* drops *pp if it no longer carries a route and has a child to spare */
+static void nobd_rt_collapse(struct nobd_rt_node **pp)
+{
+	struct nobd_rt_node *n = *pp;
+
+	if (!n || n->has_route || (n->child[0] && n->child[1]))
+		return;
+	*pp = n->child[0] ? n->child[0] : n->child[1];
+	kfree(n);
+	nobd_rt_nodes--;
+}
+
+static void nobd_rt_remove(struct nobd_rt_node **pp,
+			   const struct nobd_rt_key *key, u8 plen)
+{
+	struct nobd_rt_node **parent = NULL;
+	struct nobd_rt_node *n;
+
+	while ((n = *pp) != NULL) {
+		if (n->plen > plen || !nobd_rt_covers(n, key))
+			return;
+		if (n->plen == plen)
+			break;
+		parent = pp;
+		pp = &n->child[nobd_rt_bit(key, n->plen)];
+	}
+	if (!n || !n->has_route)
+		return;
+
+	n->has_route = 0;
+	nobd_rt_routes--;
+	nobd_rt_collapse(pp);
+	if (parent)
+		nobd_rt_collapse(parent);
+}
+
+/* fed with every route record the netlink worker reports or sweeps */
+void nobd_rt_update(const struct nobd_ev_route *rec)
+{
+	struct nobd_rt_node *spare[2] = { NULL, NULL };
+	struct nobd_rt_node *n;
+	struct nobd_rt_key key;
+	int fam;
+
+	fam = nobd_rt_key_from(&key, rec->family, &rec->dst);
+	if (fam < 0 || rec->table != RT_TABLE_MAIN ||
+	    rec->dst_len > nobd_rt_maxlen[fam])
+		return;
+	nobd_rt_key_mask(&key, rec->dst_len);
+
+	if (rec->op == NOBD_OP_DEL) {
+		write_lock_bh(&nobd_rt_lock);
+		nobd_rt_remove(&nobd_rt_root[fam], &key, rec->dst_len);
+		write_unlock_bh(&nobd_rt_lock);
+		return;
+	}
+
+	spare[0] = kmalloc(sizeof(*n), GFP_KERNEL);
+	spare[1] = kmalloc(sizeof(*n), GFP_KERNEL);
+	if (!spare[0] || !spare[1]) {
+		pr_err("no memory for a route\n");
+		goto out;
+	}
+
+	write_lock_bh(&nobd_rt_lock);
+	n = nobd_rt_insert(&nobd_rt_root[fam], &key, rec->dst_len, spare);
+	if (!n->has_route)
+		nobd_rt_routes++;
+	n->has_route = 1;
+	n->rt.dst = rec->dst;
+	n->rt.gw = rec->gw;
+	n->rt.oif = rec->oif;
+	n->rt.dst_len = rec->dst_len;
+	n->rt.family = rec->family;
+	write_unlock_bh(&nobd_rt_lock);
+out:
+	kfree(spare[0]);
+	kfree(spare[1]);
+}
+
+static int nobd_rt_match(int fam, const struct nobd_rt_key *key,
+			 struct nobd_rt_route *rt)
+{
+	struct nobd_rt_node *n, *best = NULL;
+
+	read_lock(&nobd_rt_lock);
+	for (n = nobd_rt_root[fam]; n; n = n->child[nobd_rt_bit(key, n->plen)]) {
+		if (!nobd_rt_covers(n, key))
+			break;
+		if (n->has_route)
+			best = n;
+		if (n->plen == nobd_rt_maxlen[fam])
+			break;
+	}
+	if (best)
+		*rt = best->rt;
+	read_unlock(&nobd_rt_lock);
+
+	return best ? 0 : -ENOENT;
+}
+
+/* longest prefix match of an IPv4 destination */
+int nobd_rt_lookup(__be32 daddr, struct nobd_rt_route *rt)
+{
+	struct nobd_rt_key key = { .w = { ntohl(daddr) } };
+
+	return nobd_rt_match(NOBD_RT_V4, &key, rt);
+}
+EXPORT_SYMBOL_GPL(nobd_rt_lookup);
+
+/* longest prefix match of an IPv6 destination */
+int nobd_rt6_lookup(const struct in6_addr *daddr, struct nobd_rt_route *rt)
+{
+	struct nobd_rt_key key;
+
+	nobd_rt_key_from(&key, AF_INET6, (const union nobd_addr *)daddr);
+	return nobd_rt_match(NOBD_RT_V6, &key, rt);
+}
+EXPORT_SYMBOL_GPL(nobd_rt6_lookup);
+
+/* exact match of dst/dst_len */
+int nobd_rt_get(u8 family, const union nobd_addr *dst, u8 dst_len,
+		struct nobd_rt_route *rt)
+{
+	struct nobd_rt_node *n;
+	struct nobd_rt_key key;
+	int fam, rc = -ENOENT;
+
+	fam = nobd_rt_key_from(&key, family, dst);
+	if (fam < 0 || dst_len > nobd_rt_maxlen[fam])
+		return -ENOENT;
+	nobd_rt_key_mask(&key, dst_len);
+
+	read_lock(&nobd_rt_lock);
+	for (n = nobd_rt_root[fam]; n && n->plen <= dst_len;
+	     n = n->child[nobd_rt_bit(&key, n->plen)]) {
+		if (!nobd_rt_covers(n, &key))
+			break;
+		if (n->plen == dst_len) {
+			if (n->has_route) {
+				*rt = n->rt;
+				rc = 0;
+			}
+			break;
+		}
+	}
+	read_unlock(&nobd_rt_lock);
+
+	return rc;
+}
+EXPORT_SYMBOL_GPL(nobd_rt_get);
+
+/* in order, so covering prefixes come before what they cover */
+static void nobd_rt_show_node(struct seq_file *m, struct nobd_rt_node *n)
+{
+	if (!n)
+		return;
+	if (n->has_route && n->rt.family == AF_INET6)
+		seq_printf(m, "%pI6c/%u gw %pI6c oif %u\n", n->rt.dst.ip6,
+			   n->rt.dst_len, n->rt.gw.ip6, n->rt.oif);
+	else if (n->has_route)
+		seq_printf(m, "%pI4/%u gw %pI4 oif %u\n", &n->rt.dst.ip,
+			   n->rt.dst_len, &n->rt.gw.ip, n->rt.oif);
+	nobd_rt_show_node(m, n->child[0]);
+	nobd_rt_show_node(m, n->child[1]);
+}
+
+static int nobd_rt_show(struct seq_file *m, void *v)
+{
+	read_lock_bh(&nobd_rt_lock);
+	seq_printf(m, "# routes %u nodes %u\n", nobd_rt_routes, nobd_rt_nodes);
+	nobd_rt_show_node(m, nobd_rt_root[NOBD_RT_V4]);
+	nobd_rt_show_node(m, nobd_rt_root[NOBD_RT_V6]);
+	read_unlock_bh(&nobd_rt_lock);
+	return 0;
+}
+
+static int nobd_rt_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nobd_rt_show, NULL);
+}
+
+static const struct file_operations nobd_rt_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_rt_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void nobd_rt_free(struct nobd_rt_node *n)
+{
+	if (!n)
+		return;
+	nobd_rt_free(n->child[0]);
+	nobd_rt_free(n->child[1]);
+	kfree(n);
+}
+
+int nobd_rt_init(void)
+{
+	if (!proc_create("routes", 0444, nobd_proc_dir, &nobd_rt_fops))
+		return -ENOMEM;
+	return 0;
+}
+
+void nobd_rt_exit(void)
+{
+	int i;
+
+	remove_proc_entry("routes", nobd_proc_dir);
+	write_lock_bh(&nobd_rt_lock);
+	for (i = 0; i < NOBD_RT_MAX; i++) {
+		nobd_rt_free(nobd_rt_root[i]);
+		nobd_rt_root[i] = NULL;
+	}
+	nobd_rt_routes = nobd_rt_nodes = 0;
+	write_unlock_bh(&nobd_rt_lock);
+}
@@ -0,0 +1,361 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      Snapshots of the current state, streamed through the rings.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/ctype.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/uaccess.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+
+#include "include/nobd_snap.h"
+#include "include/nobd_ring.h"
+#include "include/nobd_proc.h"
+#include "include/nobd_nl.h"
+#include "include/nobd_nl_state.h"
+#include "include/nobd_neigh.h"
+#include "include/nobd_br.h"
+#include "include/nobd_nc.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt) "nobd_snap: " fmt
+
+#define NOBD_SNAP_PAUSE	(HZ / 10)	/* before retrying a full ring */
+
+static int snap_on_load;
+module_param(snap_on_load, int, 0444);
+MODULE_PARM_DESC(snap_on_load, "stream a snapshot of every stage once loaded");
+
+static unsigned int snap_chunk = 64;
+module_param(snap_chunk, uint, 0644);
+MODULE_PARM_DESC(snap_chunk, "buckets walked per snapshot run before yielding");
+
+/*
+ * Links go first so the records after them can be resolved. Routes and
+ * neighbours come from the netlink shadows, which are only complete once
+ * every listener has seeded them.
+ */
+static const struct {
+	const char *name;
+	u8 type;
+	int nl;
+	int (*walk)(struct nobd_snap_cur *c);
+} nobd_snap_stages[] = {
+	{ "link",	NOBD_EV_LINK,	0, nobd_nc_snap_links },
+	{ "route",	NOBD_EV_ROUTE,	1, nobd_nl_state_snap },
+	{ "neigh",	NOBD_EV_NEIGH,	1, nobd_neigh_snap },
+	{ "fdb",	NOBD_EV_FDB,	0, nobd_br_snap },
+	{ "ct",		NOBD_EV_CT,	0, nobd_ct_snap },
+};
+
+#define NOBD_SNAP_STAGES ARRAY_SIZE(nobd_snap_stages)
+#define NOBD_SNAP_ALL	((1 << NOBD_SNAP_STAGES) - 1)
+
+enum {
+	NOBD_SNAP_IDLE,
+	NOBD_SNAP_START,	/* the opening marker is due */
+	NOBD_SNAP_STAGE,	/* the stage's BEGIN is due */
+	NOBD_SNAP_WALK,
+	NOBD_SNAP_STAGE_END,	/* the stage's END is due */
+	NOBD_SNAP_FINISH,	/* the closing marker is due */
+};
+
+/* a single snapshot at a time, walked from the netlink worker */
+static struct {
+	int state;
+	u32 id;
+	unsigned int mask;	/* stages asked for */
+	unsigned int stage;
+	struct nobd_snap_cur cur;
+	u32 count;		/* records of every stage so far */
+	u32 lost;
+	unsigned long pauses;
+} nobd_snap;
+
+static DEFINE_MUTEX(nobd_snap_lock);
+
+static void nobd_snap_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(nobd_snap_work, nobd_snap_work_fn);
+
+/* 1 to walk the next bucket, 0 when the run is over, -ENOSPC to back off */
+int nobd_snap_next(struct nobd_snap_cur *c)
+{
+	if (!c->budget)
+		return 0;
+	if (!nobd_ring_room())
+		return -ENOSPC;
+	c->budget--;
+	return 1;
+}
+
+/* room was checked per bucket, a record that still finds none is lost */
+void nobd_snap_emit(struct nobd_snap_cur *c, const struct nobd_ev *ev)
+{
+	int rc = nobd_ev_emit_snap(ev);
+
+	if (rc > 0)
+		c->count++;
+	else if (rc < 0)
+		c->lost++;
+}
+
+static int nobd_snap_marker(u8 op, u8 what, u32 count, u32 lost)
+{
+	struct nobd_ev ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.hdr.type = NOBD_EV_SNAP;
+	ev.snap.id = nobd_snap.id;
+	ev.snap.op = op;
+	ev.snap.what = what;
+	ev.snap.count = count;
+	ev.snap.lost = lost;
+	return nobd_ev_emit_snap(&ev);
+}
+
+/* the stage asked for at or after stage, NOBD_SNAP_STAGES if none */
+static unsigned int nobd_snap_stage_from(unsigned int stage)
+{
+	while (stage < NOBD_SNAP_STAGES && !(nobd_snap.mask & (1 << stage)))
+		stage++;
+	return stage;
+}
+
+/*
+ * Runs a bounded part of the snapshot and requeues itself: right away when
+ * the budget ran out, so listeners sharing the worker get their turn, and
+ * after NOBD_SNAP_PAUSE when the consumer is behind. Markers are never
+ * dropped, a full ring leaves the state as it is to retry later.
+ */
+static void nobd_snap_work_fn(struct work_struct *work)
+{
+	struct nobd_snap_cur *c = &nobd_snap.cur;
+	unsigned long delay = 0;
+	unsigned int budget;
+	u8 type;
+	int rc = 0;
+
+	mutex_lock(&nobd_snap_lock);
+	c->budget = max(snap_chunk, 1U);
+	while (nobd_snap.state != NOBD_SNAP_IDLE) {
+		type = nobd_snap_stages[min_t(unsigned int, nobd_snap.stage,
+					      NOBD_SNAP_STAGES - 1)].type;
+
+		switch (nobd_snap.state) {
+		case NOBD_SNAP_START:
+			rc = nobd_snap_marker(NOBD_SNAP_BEGIN, NOBD_EV_NONE,
+					      0, 0);
+			if (rc < 0)
+				break;
+			nobd_snap.stage = nobd_snap_stage_from(0);
+			nobd_snap.state = NOBD_SNAP_STAGE;
+			continue;
+		case NOBD_SNAP_STAGE:
+			if (nobd_snap.stage >= NOBD_SNAP_STAGES) {
+				nobd_snap.state = NOBD_SNAP_FINISH;
+				continue;
+			}
+			if (nobd_snap_stages[nobd_snap.stage].nl &&
+			    nobd_nl_seeding()) {
+				rc = -EAGAIN;
+				break;
+			}
+			rc = nobd_snap_marker(NOBD_SNAP_BEGIN, type, 0, 0);
+			if (rc < 0)
+				break;
+			budget = c->budget;
+			memset(c, 0, sizeof(*c));
+			c->id = nobd_snap.id;
+			c->budget = budget;
+			nobd_snap.state = NOBD_SNAP_WALK;
+			continue;
+		case NOBD_SNAP_WALK:
+			rc = nobd_snap_stages[nobd_snap.stage].walk(c);
+			if (rc <= 0)
+				break;
+			nobd_snap.state = NOBD_SNAP_STAGE_END;
+			continue;
+		case NOBD_SNAP_STAGE_END:
+			rc = nobd_snap_marker(NOBD_SNAP_END, type, c->count,
+					      c->lost);
+			if (rc < 0)
+				break;
+			nobd_snap.count += c->count;
+			nobd_snap.lost += c->lost;
+			nobd_snap.stage =
+				nobd_snap_stage_from(nobd_snap.stage + 1);
+			nobd_snap.state = NOBD_SNAP_STAGE;
+			continue;
+		case NOBD_SNAP_FINISH:
+			rc = nobd_snap_marker(NOBD_SNAP_END, NOBD_EV_NONE,
+					      nobd_snap.count, nobd_snap.lost);
+			if (rc < 0)
+				break;
+			pr_info("snapshot %u done, %u records %u lost\n",
+				nobd_snap.id, nobd_snap.count, nobd_snap.lost);
+			nobd_snap.state = NOBD_SNAP_IDLE;
+			continue;
+		}
+
+		/* the budget is spent or something is not ready yet */
+		if (rc < 0) {
+			nobd_snap.pauses++;
+			delay = NOBD_SNAP_PAUSE;
+		}
+		nobd_nl_queue(&nobd_snap_work, delay);
+		break;
+	}
+	mutex_unlock(&nobd_snap_lock);
+}
+
+/* called with nobd_snap_lock held */
+static int nobd_snap_start(unsigned int mask)
+{
+	if (nobd_snap.state != NOBD_SNAP_IDLE)
+		return -EBUSY;
+	nobd_snap.id++;
+	nobd_snap.mask = mask;
+	nobd_snap.stage = 0;
+	nobd_snap.count = 0;
+	nobd_snap.lost = 0;
+	nobd_snap.state = NOBD_SNAP_START;
+	nobd_nl_queue(&nobd_snap_work, 0);
+	return 0;
+}
+
+/* called with nobd_snap_lock held, the work finds it idle and stops */
+static void nobd_snap_stop(void)
+{
+	if (nobd_snap.state == NOBD_SNAP_IDLE)
+		return;
+	nobd_snap_marker(NOBD_SNAP_ABORT, NOBD_EV_NONE, nobd_snap.count,
+			 nobd_snap.lost);
+	nobd_snap.state = NOBD_SNAP_IDLE;
+}
+
+static int nobd_snap_show(struct seq_file *m, void *v)
+{
+	unsigned int i;
+
+	mutex_lock(&nobd_snap_lock);
+	seq_printf(m, "id %u\nstate %s\n", nobd_snap.id,
+		   nobd_snap.state == NOBD_SNAP_IDLE ? "idle" : "running");
+	if (nobd_snap.state != NOBD_SNAP_IDLE &&
+	    nobd_snap.stage < NOBD_SNAP_STAGES)
+		seq_printf(m, "stage %s\n",
+			   nobd_snap_stages[nobd_snap.stage].name);
+	/* the stage being walked has not been added in yet */
+	if (nobd_snap.state == NOBD_SNAP_WALK ||
+	    nobd_snap.state == NOBD_SNAP_STAGE_END)
+		seq_printf(m, "records %u\nlost %u\n",
+			   nobd_snap.count + nobd_snap.cur.count,
+			   nobd_snap.lost + nobd_snap.cur.lost);
+	else
+		seq_printf(m, "records %u\nlost %u\n", nobd_snap.count,
+			   nobd_snap.lost);
+	seq_printf(m, "pauses %lu\n", nobd_snap.pauses);
+	seq_printf(m, "# stages");
+	for (i = 0; i < NOBD_SNAP_STAGES; i++)
+		seq_printf(m, " %s", nobd_snap_stages[i].name);
+	seq_putc(m, '\n');
+	mutex_unlock(&nobd_snap_lock);
+	return 0;
+}
+
+static int nobd_snap_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nobd_snap_show, NULL);
+}
+
+/* "all" or stage names start a snapshot, "stop" aborts the running one */
+static ssize_t nobd_snap_write(struct file *file, const char __user *ubuf,
+			       size_t count, loff_t *ppos)
+{
+	char buf[64], *p, *word;
+	unsigned int mask = 0, i;
+	int err = 0;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+	for (p = buf; *p; p++) {
+		if (isspace(*p))
+			*p = ' ';
+	}
+	p = strstrip(buf);
+
+	mutex_lock(&nobd_snap_lock);
+	if (!strcmp(p, "stop")) {
+		nobd_snap_stop();
+		goto out;
+	}
+	while ((word = strsep(&p, " ")) != NULL) {
+		if (!*word)
+			continue;
+		if (!strcmp(word, "all")) {
+			mask = NOBD_SNAP_ALL;
+			continue;
+		}
+		for (i = 0; i < NOBD_SNAP_STAGES; i++) {
+			if (!strcmp(word, nobd_snap_stages[i].name))
+				break;
+		}
+		if (i == NOBD_SNAP_STAGES) {
+			err = -EINVAL;
+			goto out;
+		}
+		mask |= 1 << i;
+	}
+	err = nobd_snap_start(mask ? mask : NOBD_SNAP_ALL);
+out:
+	mutex_unlock(&nobd_snap_lock);
+
+	return err ? err : count;
+}
+
+static const struct file_operations nobd_snap_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_snap_open,
+	.read		= seq_read,
+	.write		= nobd_snap_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* needs the netlink worker and the notifiers, the walkers rely on both */
+int nobd_snap_init(void)
+{
+	if (!proc_create("snapshot", 0600, nobd_proc_dir, &nobd_snap_fops))
+		return -ENOMEM;
+	if (snap_on_load) {
+		mutex_lock(&nobd_snap_lock);
+		nobd_snap_start(NOBD_SNAP_ALL);
+		mutex_unlock(&nobd_snap_lock);
+	}
+	return 0;
+}
+
+void nobd_snap_exit(void)
+{
+	remove_proc_entry("snapshot", nobd_proc_dir);
+	mutex_lock(&nobd_snap_lock);
+	nobd_snap.state = NOBD_SNAP_IDLE;
+	mutex_unlock(&nobd_snap_lock);
+	cancel_delayed_work_sync(&nobd_snap_work);
+}
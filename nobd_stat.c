@@ -0,0 +1,203 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      Per handler call counters and latency histograms in debugfs.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "include/nobd_stat.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt) "nobd_stat: " fmt
+
+#define NOBD_ST_BUCKETS	32	/* bucket i counts [2^i, 2^(i+1)) ns */
+
+static const char *nobd_stat_names[NOBD_ST_MAX] = {
+	[NOBD_ST_CT_EVENT]	= "ct_event",
+	[NOBD_ST_NETDEV_EVENT]	= "netdev_event",
+	[NOBD_ST_NETDEV_VLAN]	= "netdev_vlan",
+	[NOBD_ST_NETDEV_BR_DEV]	= "netdev_br_dev",
+	[NOBD_ST_NETDEV_BR_IF]	= "netdev_br_if",
+	[NOBD_ST_NETDEV_ETH]	= "netdev_eth",
+	[NOBD_ST_NETDEV_PPPOX]	= "netdev_pppox",
+	[NOBD_ST_NL_DATA_READY]	= "nl_data_ready",
+	[NOBD_ST_NL_WORK]	= "nl_work",
+	[NOBD_ST_FDB_SCAN]	= "fdb_scan",
+	[NOBD_ST_PPPOE_FIND]	= "pppoe_find",
+};
+
+struct nobd_stat {
+	u64 calls;
+	u64 ns;
+	u64 max;
+	u32 hist[NOBD_ST_BUCKETS];
+};
+
+struct nobd_stat_cpu {
+	struct nobd_stat st[NOBD_ST_MAX];
+};
+
+static DEFINE_PER_CPU(struct nobd_stat_cpu, nobd_stats);
+static struct dentry *nobd_stat_dir;
+
+/*
+ * Accounts one call of handler id that began at start. sched_clock() is
+ * per cpu, a handler that slept and migrated may see it go backwards.
+ */
+void nobd_stat_end(int id, u64 start)
+{
+	u64 now = sched_clock();
+	u64 delta = now > start ? now - start : 0;
+	struct nobd_stat *s;
+	unsigned int b;
+
+	b = delta ? min_t(unsigned int, ilog2(delta), NOBD_ST_BUCKETS - 1) : 0;
+	s = &get_cpu_var(nobd_stats).st[id];
+	s->calls++;
+	s->ns += delta;
+	if (delta > s->max)
+		s->max = delta;
+	s->hist[b]++;
+	put_cpu_var(nobd_stats);
+}
+
+static void nobd_stat_sum(int id, struct nobd_stat *sum)
+{
+	int cpu, b;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		const struct nobd_stat *s = &per_cpu(nobd_stats, cpu).st[id];
+
+		sum->calls += s->calls;
+		sum->ns += s->ns;
+		if (s->max > sum->max)
+			sum->max = s->max;
+		for (b = 0; b < NOBD_ST_BUCKETS; b++)
+			sum->hist[b] += s->hist[b];
+	}
+}
+
+static int nobd_stat_handlers_show(struct seq_file *m, void *v)
+{
+	struct nobd_stat sum;
+	int id, b;
+
+	for (id = 0; id < NOBD_ST_MAX; id++) {
+		nobd_stat_sum(id, &sum);
+		seq_printf(m, "%-14s calls %llu ns %llu avg %llu max %llu\n",
+			   nobd_stat_names[id],
+			   (unsigned long long)sum.calls,
+			   (unsigned long long)sum.ns,
+			   (unsigned long long)(sum.calls ?
+				div64_u64(sum.ns, sum.calls) : 0),
+			   (unsigned long long)sum.max);
+		for (b = 0; b < NOBD_ST_BUCKETS; b++) {
+			if (sum.hist[b])
+				seq_printf(m, "  %10llu ns %u\n", 1ULL << b,
+					   sum.hist[b]);
+		}
+	}
+	return 0;
+}
+
+static int nobd_stat_handlers_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nobd_stat_handlers_show, NULL);
+}
+
+static const struct file_operations nobd_stat_handlers_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_stat_handlers_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* calls of every handler on every cpu, one line per cpu */
+static int nobd_stat_percpu_show(struct seq_file *m, void *v)
+{
+	int cpu, id;
+
+	seq_printf(m, "cpu");
+	for (id = 0; id < NOBD_ST_MAX; id++)
+		seq_printf(m, " %s", nobd_stat_names[id]);
+	seq_putc(m, '\n');
+	for_each_online_cpu(cpu) {
+		seq_printf(m, "%d", cpu);
+		for (id = 0; id < NOBD_ST_MAX; id++)
+			seq_printf(m, " %llu", (unsigned long long)
+				   per_cpu(nobd_stats, cpu).st[id].calls);
+		seq_putc(m, '\n');
+	}
+	return 0;
+}
+
+static int nobd_stat_percpu_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nobd_stat_percpu_show, NULL);
+}
+
+static const struct file_operations nobd_stat_percpu_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_stat_percpu_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* any write clears everything, calls racing with it may survive */
+static ssize_t nobd_stat_reset_write(struct file *file, const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(&per_cpu(nobd_stats, cpu), 0,
+		       sizeof(struct nobd_stat_cpu));
+	return count;
+}
+
+static const struct file_operations nobd_stat_reset_fops = {
+	.owner		= THIS_MODULE,
+	.write		= nobd_stat_reset_write,
+};
+
+/* debugfs is optional, counting goes on without it */
+int nobd_stat_init(void)
+{
+	nobd_stat_dir = debugfs_create_dir("nobd", NULL);
+	if (!nobd_stat_dir || IS_ERR(nobd_stat_dir)) {
+		pr_info("no debugfs, handler stats not exported\n");
+		nobd_stat_dir = NULL;
+		return 0;
+	}
+	debugfs_create_file("handlers", 0444, nobd_stat_dir, NULL,
+			    &nobd_stat_handlers_fops);
+	debugfs_create_file("percpu", 0444, nobd_stat_dir, NULL,
+			    &nobd_stat_percpu_fops);
+	debugfs_create_file("reset", 0200, nobd_stat_dir, NULL,
+			    &nobd_stat_reset_fops);
+
+	return 0;
+}
+
+void nobd_stat_exit(void)
+{
+	debugfs_remove_recursive(nobd_stat_dir);
+}
@@ -0,0 +1,300 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      Heavy hitters among new conntracks, count-min sketch and top-K.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/socket.h>
+
+#include "include/nobd_top.h"
+#include "include/nobd_proc.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt) "nobd_top: " fmt
+
+#define NOBD_TOP_DEPTH	4	/* rows, 16 hash bits each */
+#define NOBD_TOP_BITS	10	/* counters per sketch row, log2 */
+#define NOBD_TOP_K	16
+
+static unsigned int top_window_secs = 10;
+module_param(top_window_secs, uint, 0644);
+MODULE_PARM_DESC(top_window_secs, "seconds per /proc/nobd/ct_top window, 0 stops counting");
+
+/* whole words, hashed as such */
+struct nobd_top_key {
+	union nobd_addr	addr;
+	__be16	port;
+	u16	netns;
+	u8	proto;
+	u8	family;
+	u8	pad[2];
+};
+
+struct nobd_top_ent {
+	struct nobd_top_key key;
+	u32	est;
+};
+
+/*
+ * One dimension: its sketch counts new flows per key over the window,
+ * top holds the keys with the highest estimates seen so far and shown
+ * the ones of the last full window, estimates taken at its end.
+ */
+struct nobd_top {
+	const char *name;
+	atomic_t cm[NOBD_TOP_DEPTH][1 << NOBD_TOP_BITS];
+	struct nobd_top_ent top[NOBD_TOP_K];
+	unsigned int nr;
+	u32 min;		/* lowest est in top once it is full */
+	struct nobd_top_ent shown[NOBD_TOP_K];
+	unsigned int nr_shown;
+};
+
+enum {
+	NOBD_TOP_SRC,
+	NOBD_TOP_DST,
+	NOBD_TOP_PORT,
+	NOBD_TOP_MAX
+};
+
+static struct nobd_top nobd_top[NOBD_TOP_MAX] = {
+	[NOBD_TOP_SRC]	= { .name = "src" },
+	[NOBD_TOP_DST]	= { .name = "dst" },
+	[NOBD_TOP_PORT]	= { .name = "dport" },
+};
+
+/*
+ * top and shown of every dimension and the window start, the sketches are
+ * atomic
+ */
+static DEFINE_SPINLOCK(nobd_top_lock);
+static struct timer_list nobd_top_timer;
+static u32 nobd_top_seed[2];
+static atomic_t nobd_top_flows = ATOMIC_INIT(0);
+static unsigned long nobd_top_started;	/* jiffies the window began */
+static u32 nobd_top_shown_flows;
+static unsigned int nobd_top_shown_ms;
+static unsigned long nobd_top_shown_at;
+
+/*
+ * Adds n to the counters of key, one per row each indexed by its own 16
+ * bits of a 64 bit hash, and returns the estimate: the lowest of them.
+ * n of 0 only reads.
+ */
+static u32 nobd_top_count(struct nobd_top *t, const struct nobd_top_key *key,
+			  u32 n)
+{
+	u64 h = (u64)jhash2((const u32 *)key, sizeof(*key) / 4,
+			    nobd_top_seed[0]) << 32 |
+		jhash2((const u32 *)key, sizeof(*key) / 4, nobd_top_seed[1]);
+	u32 est = ~0U, c;
+	atomic_t *ctr;
+	int i;
+
+	for (i = 0; i < NOBD_TOP_DEPTH; i++, h >>= 16) {
+		ctr = &t->cm[i][h & ((1 << NOBD_TOP_BITS) - 1)];
+		c = n ? atomic_add_return(n, ctr) : atomic_read(ctr);
+		est = min(est, c);
+	}
+	return est;
+}
+
+static void nobd_top_offer(struct nobd_top *t, const struct nobd_top_key *key,
+			   u32 est)
+{
+	unsigned int i, lo = 0;
+
+	/* the common case, no lock: not a heavy hitter */
+	if (t->nr == NOBD_TOP_K && est <= ACCESS_ONCE(t->min))
+		return;
+
+	spin_lock_bh(&nobd_top_lock);
+	for (i = 0; i < t->nr; i++) {
+		if (!memcmp(&t->top[i].key, key, sizeof(*key))) {
+			t->top[i].est = est;
+			goto full;
+		}
+		if (t->top[i].est < t->top[lo].est)
+			lo = i;
+	}
+	if (t->nr < NOBD_TOP_K)
+		lo = t->nr++;
+	else if (est <= t->top[lo].est)
+		goto out;
+	t->top[lo].key = *key;
+	t->top[lo].est = est;
+full:
+	if (t->nr == NOBD_TOP_K) {
+		t->min = t->top[0].est;
+		for (i = 1; i < t->nr; i++)
+			t->min = min(t->min, t->top[i].est);
+	}
+out:
+	spin_unlock_bh(&nobd_top_lock);
+}
+
+/* starts a window, under nobd_top_lock so it is started once */
+static void nobd_top_arm(void)
+{
+	nobd_top_started = jiffies;
+	mod_timer(&nobd_top_timer, jiffies + top_window_secs * HZ);
+}
+
+static void nobd_top_hit(struct nobd_top *t, const struct nobd_top_key *key,
+			 u32 n)
+{
+	nobd_top_offer(t, key, nobd_top_count(t, key, n));
+}
+
+/* a new conntrack, standing for sample_n flows */
+void nobd_top_add(const struct nobd_ev_ct *rec, u16 netns)
+{
+	struct nobd_top_key key;
+	u32 n = rec->sample_n ? rec->sample_n : 1;
+
+	if (!top_window_secs)
+		return;
+	if (unlikely(!timer_pending(&nobd_top_timer))) {
+		spin_lock_bh(&nobd_top_lock);
+		if (!timer_pending(&nobd_top_timer))
+			nobd_top_arm();
+		spin_unlock_bh(&nobd_top_lock);
+	}
+	atomic_add(n, &nobd_top_flows);
+
+	memset(&key, 0, sizeof(key));
+	key.netns = netns;
+	key.family = rec->family;
+	key.addr = rec->src;
+	nobd_top_hit(&nobd_top[NOBD_TOP_SRC], &key, n);
+	key.addr = rec->dst;
+	nobd_top_hit(&nobd_top[NOBD_TOP_DST], &key, n);
+
+	memset(&key.addr, 0, sizeof(key.addr));
+	key.family = 0;
+	key.proto = rec->proto;
+	key.port = rec->dport;
+	nobd_top_hit(&nobd_top[NOBD_TOP_PORT], &key, n);
+}
+
+/*
+ * Ends the window: top goes to shown, by estimate, and the sketches start
+ * over. Flows counted while a sketch is cleared may be lost to the next
+ * window, the table is an estimate anyway.
+ */
+static void nobd_top_rotate(unsigned long unused)
+{
+	struct nobd_top_ent ent;
+	struct nobd_top *t;
+	unsigned int i, j;
+
+	spin_lock_bh(&nobd_top_lock);
+	for (t = nobd_top; t < nobd_top + NOBD_TOP_MAX; t++) {
+		for (i = 0; i < t->nr; i++) {
+			ent.key = t->top[i].key;
+			ent.est = nobd_top_count(t, &ent.key, 0);
+			for (j = i; j > 0 && t->shown[j - 1].est < ent.est; j--)
+				t->shown[j] = t->shown[j - 1];
+			t->shown[j] = ent;
+		}
+		t->nr_shown = t->nr;
+		t->nr = 0;
+		t->min = 0;
+		memset(t->cm, 0, sizeof(t->cm));
+	}
+	nobd_top_shown_flows = atomic_xchg(&nobd_top_flows, 0);
+	nobd_top_shown_ms = jiffies_to_msecs(jiffies - nobd_top_started);
+	nobd_top_shown_at = jiffies;
+	/* idle or stopped, the next new flow starts a window */
+	if (top_window_secs && nobd_top_shown_flows)
+		nobd_top_arm();
+	spin_unlock_bh(&nobd_top_lock);
+}
+
+static void nobd_top_show_key(struct seq_file *m, const struct nobd_top *t,
+			      const struct nobd_top_key *key)
+{
+	if (t == &nobd_top[NOBD_TOP_PORT])
+		seq_printf(m, "proto %u port %u", key->proto,
+			   ntohs(key->port));
+	else if (key->family == AF_INET6)
+		seq_printf(m, "%pI6c", key->addr.ip6);
+	else
+		seq_printf(m, "%pI4", &key->addr.ip);
+}
+
+static int nobd_top_show(struct seq_file *m, void *v)
+{
+	const struct nobd_top_ent *ent;
+	struct nobd_top *t;
+	unsigned int ms;
+
+	spin_lock_bh(&nobd_top_lock);
+	ms = max(nobd_top_shown_ms, 1U);
+	if (!nobd_top_shown_at) {
+		seq_printf(m, "# window %us, none ended yet\n",
+			   top_window_secs);
+		goto out;
+	}
+	seq_printf(m, "# window %ums flows %u ended %ums ago\n", ms,
+		   nobd_top_shown_flows,
+		   jiffies_to_msecs(jiffies - nobd_top_shown_at));
+	for (t = nobd_top; t < nobd_top + NOBD_TOP_MAX; t++) {
+		for (ent = t->shown; ent < t->shown + t->nr_shown; ent++) {
+			seq_printf(m, "%s ns %u ", t->name, ent->key.netns);
+			nobd_top_show_key(m, t, &ent->key);
+			seq_printf(m, " flows %u rate %llu/s\n", ent->est,
+				   (unsigned long long)div_u64((u64)ent->est *
+							       MSEC_PER_SEC, ms));
+		}
+	}
+out:
+	spin_unlock_bh(&nobd_top_lock);
+	return 0;
+}
+
+static int nobd_top_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nobd_top_show, NULL);
+}
+
+static const struct file_operations nobd_top_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nobd_top_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int nobd_top_init(void)
+{
+	get_random_bytes(nobd_top_seed, sizeof(nobd_top_seed));
+	setup_timer(&nobd_top_timer, nobd_top_rotate, 0);
+	proc_create("ct_top", 0444, nobd_proc_dir, &nobd_top_fops);
+
+	return 0;
+}
+
+/* must be called after the conntrack notifier is gone */
+void nobd_top_exit(void)
+{
+	remove_proc_entry("ct_top", nobd_proc_dir);
+	del_timer_sync(&nobd_top_timer);
+}
@@ -0,0 +1,56 @@
+#!/bin/bash
+#
+#	Network OBserving Daemon [NOBD]
+#
+#	Compares two nobd-bench.sh reports, scenario by scenario.
+#	Authors:
+#	Haim Daniel
+#
+#	This program is free software; you can redistribute it and/or
+#	modify it under the terms of the GNU General Public License
+#	as published by the Free Software Foundation; either version
+#	2 of the License, or (at your option) any later version.
+#
+# Prints every numeric key of a scenario found in both reports as
+# "scenario key old new delta%", then the two headers for reference.
+
+[ $# = 2 ] || { echo "usage: $0 OLD NEW" >&2; exit 2; }
+
+awk '
+FNR == 1 { f++ }
+/^#/ { hdr[f] = hdr[f] "\n" $0; next }
+{
+	sc = ""
+	for (i = 1; i <= NF; i++) {
+		split($i, kv, "=")
+		if (kv[1] == "scenario") {
+			sc = kv[2]
+			if (f == 2 && !(sc in seen))
+				order[++n] = sc
+			if (f == 2)
+				seen[sc] = 1
+			continue
+		}
+		v[f, sc, kv[1]] = kv[2]
+		if (f == 2 && !((sc, kv[1]) in keyed)) {
+			keyed[sc, kv[1]] = 1
+			keys[sc] = keys[sc] " " kv[1]
+		}
+	}
+}
+END {
+	printf "%-8s %-28s %14s %14s %9s\n", "scenario", "key", "old", "new", "delta"
+	for (s = 1; s <= n; s++) {
+		sc = order[s]
+		m = split(keys[sc], k, " ")
+		for (j = 1; j <= m; j++) {
+			if (!((1, sc, k[j]) in v))
+				continue
+			o = v[1, sc, k[j]]; w = v[2, sc, k[j]]
+			d = o + 0 ? sprintf("%+.1f%%", 100 * (w - o) / o) : "-"
+			printf "%-8s %-28s %14s %14s %9s\n", sc, k[j], o, w, d
+		}
+	}
+	print "\nold:" hdr[1]
+	print "\nnew:" hdr[2]
+}' "$1" "$2"
@@ -0,0 +1,274 @@
+#!/bin/bash
+#
+#	Network OBserving Daemon [NOBD]
+#
+#	Synthetic load in throwaway namespaces, one report line per scenario.
+#	Authors:
+#	Haim Daniel
+#
+#	This program is free software; you can redistribute it and/or
+#	modify it under the terms of the GNU General Public License
+#	as published by the Free Software Foundation; either version
+#	2 of the License, or (at your option) any later version.
+#
+# Needs root, the module loaded, iproute2 with bridge, iptables and
+# nobdctl/nobd-flood built ("make -C tools"). The load runs in namespace
+# nobdb-a, monitored for the run, against nobdb-b over a veth pair:
+#
+#	route	route add/del storm in nobdb-a
+#	arp	neighbour add/del churn on the veth
+#	fdb	static fdb add/del on a bridge port
+#	vlan	vlan create/destroy on the veth
+#	ct	new UDP flows from nobdb-a, tracked in nobdb-b
+#
+# Rates are operations (or flows) per second. CPU is system, irq and
+# softirq time over all cpus, the load generators included, so it only
+# compares between runs of the same scenario.
+
+set -u
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+NOBDCTL=${NOBDCTL:-$HERE/../nobdctl}
+FLOOD=${FLOOD:-$HERE/nobd-flood}
+DEBUGFS=/sys/kernel/debug/nobd
+NS_A=nobdb-a
+NS_B=nobdb-b
+
+SECS=10
+RATE=
+REPORT=
+declare -A RATES=([route]=5000 [arp]=5000 [fdb]=5000 [vlan]=200 [ct]=20000)
+
+usage() {
+	echo "usage: $0 [-d SECS] [-r RATE] [-o REPORT] [route|arp|fdb|vlan|ct]..." >&2
+	exit 2
+}
+
+while getopts "d:r:o:" opt; do
+	case $opt in
+	d) SECS=$OPTARG ;;
+	r) RATE=$OPTARG ;;
+	o) REPORT=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+SCENARIOS=${*:-route arp fdb vlan ct}
+REPORT=${REPORT:-nobd-bench-$(date +%Y%m%d-%H%M%S).txt}
+
+die() {
+	echo "$*" >&2
+	exit 1
+}
+
+[ "$(id -u)" = 0 ] || die "needs root"
+[ -d /sys/module/nobd ] || die "nobd is not loaded"
+[ -x "$NOBDCTL" ] || die "no $NOBDCTL, make -C tools"
+
+setup() {
+	ip netns add $NS_A || die "netns $NS_A"
+	ip netns add $NS_B || die "netns $NS_B"
+	ip -n $NS_A link add a0 type veth peer name b0 netns $NS_B
+	ip -n $NS_A link add br0 type bridge
+	ip -n $NS_A link add p0 type dummy
+	ip -n $NS_A link set p0 master br0
+	ip -n $NS_A addr add 10.99.0.1/24 dev a0
+	ip -n $NS_B addr add 10.99.0.2/24 dev b0
+	for l in lo a0 br0 p0; do
+		ip -n $NS_A link set $l up
+	done
+	ip -n $NS_B link set lo up
+	ip -n $NS_B link set b0 up
+	# the conntrack hooks of a namespace only run once something uses them
+	ip netns exec $NS_B iptables -A INPUT -m conntrack --ctstate NEW \
+		-j ACCEPT 2>/dev/null
+	for ns in $NS_A $NS_B; do
+		ip netns exec $ns sh -c 'echo 1 > /proc/net/nobd' ||
+			die "no /proc/net/nobd in $ns"
+	done
+}
+
+cleanup() {
+	[ -n "${CONSUMER:-}" ] && kill -INT "$CONSUMER" 2>/dev/null
+	ip netns del $NS_A 2>/dev/null
+	ip netns del $NS_B 2>/dev/null
+}
+
+# runs $3 with args "first count" every 100ms, piped into the rest
+pace() {
+	local rate=$1 gen=$2 per ticks t i=0 next now d
+	shift 2
+	per=$(( (rate + 9) / 10 ))
+	ticks=$(( SECS * 10 ))
+	next=$(date +%s%N)
+	for ((t = 0; t < ticks; t++)); do
+		$gen $i $per | "$@" >/dev/null 2>&1
+		i=$((i + per))
+		next=$((next + 100000000))
+		now=$(date +%s%N)
+		d=$((next - now))
+		((d > 0)) && sleep "$(printf '0.%09d' $d)"
+	done
+	OPS=$i
+}
+
+# 10.200.0.0/13 by index, routes and neighbours keep a window of 1024
+addr() {
+	echo "10.$((200 + ($1 >> 16 & 7))).$(($1 >> 8 & 255)).$(($1 & 255))"
+}
+
+gen_route() {
+	local k
+	for ((k = $1; k < $1 + $2; k++)); do
+		if ((k & 1)); then
+			echo "route del $(addr $(((k >> 1) - 1024 & 0x7ffff)))/32"
+		else
+			echo "route add $(addr $((k >> 1 & 0x7ffff)))/32 via 10.99.0.2"
+		fi
+	done
+}
+
+gen_arp() {
+	local k n
+	for ((k = $1; k < $1 + $2; k++)); do
+		n=$((k >> 1 & 0xffff))
+		if ((k & 1)); then
+			n=$((n - 1024 & 0xffff))
+			echo "neigh del 10.99.$((n >> 8 | 128)).$((n & 255)) dev a0"
+		else
+			printf 'neigh replace 10.99.%d.%d lladdr 02:00:00:00:%02x:%02x dev a0 nud permanent\n' \
+				$((n >> 8 | 128)) $((n & 255)) $((n >> 8)) $((n & 255))
+		fi
+	done
+}
+
+gen_fdb() {
+	local k n op
+	for ((k = $1; k < $1 + $2; k++)); do
+		n=$((k >> 1 & 0xffff))
+		op=add
+		if ((k & 1)); then
+			n=$((n - 1024 & 0xffff))
+			op=del
+		fi
+		printf 'fdb %s 02:01:00:00:%02x:%02x dev p0 master static\n' \
+			$op $((n >> 8)) $((n & 255))
+	done
+}
+
+gen_vlan() {
+	local k n
+	for ((k = $1; k < $1 + $2; k++)); do
+		n=$(((k >> 1) % 4000 + 1))
+		if ((k & 1)); then
+			echo "link del v$n"
+		else
+			echo "link add link a0 name v$n type vlan id $n"
+		fi
+	done
+}
+
+load() {
+	case $1 in
+	route) pace "$2" gen_route ip -n $NS_A -force -batch - ;;
+	arp) pace "$2" gen_arp ip -n $NS_A -force -batch - ;;
+	fdb) pace "$2" gen_fdb ip netns exec $NS_A bridge -force -batch - ;;
+	vlan) pace "$2" gen_vlan ip -n $NS_A -force -batch - ;;
+	ct)
+		[ -x "$FLOOD" ] || die "no $FLOOD, make -C tools"
+		OPS=$(ip netns exec $NS_A "$FLOOD" 10.99.0.2 "$2" "$SECS" |
+		      awk '{ print $2 }')
+		;;
+	*) die "unknown scenario $1" ;;
+	esac
+}
+
+# system, irq, softirq and all jiffies from /proc/stat
+cpu_jiffies() {
+	awk '/^cpu / { print $4 + $7 + $8, $2 + $3 + $4 + $5 + $6 + $7 + $8 }' \
+		/proc/stat
+}
+
+proc_jiffies() {
+	awk '{ print $14 + $15 }' "/proc/$1/stat" 2>/dev/null || echo 0
+}
+
+rl_dropped() {
+	awk '{ d += $9 } END { print d + 0 }' /proc/nobd/ratelimit 2>/dev/null
+}
+
+flt_dropped() {
+	awk '/dropped/ { d += $4 } END { print d + 0 }' /proc/nobd/filter 2>/dev/null
+}
+
+# calls, avg and max ns of every handler that ran, as key=value
+handlers() {
+	[ -r $DEBUGFS/handlers ] || return
+	awk '/^[a-z]/ && $3 > 0 {
+		printf " calls_%s=%s lat_%s_avg_ns=%s lat_%s_max_ns=%s",
+			$1, $3, $1, $7, $1, $9 }' $DEBUGFS/handlers
+}
+
+run() {
+	local sc=$1 rate=${RATE:-${RATES[$1]}}
+	local out cpu0 cpu1 hz rl0 fl0 cj wall0 wall1 summary
+
+	[ -w $DEBUGFS/reset ] && echo 1 > $DEBUGFS/reset
+	rl0=$(rl_dropped)
+	fl0=$(flt_dropped)
+	out=$(mktemp)
+	"$NOBDCTL" tail -q 2> "$out" &
+	CONSUMER=$!
+	sleep 0.5
+
+	cpu0=($(cpu_jiffies))
+	wall0=$(date +%s%N)
+	load "$sc" "$rate"
+	# let the workers and the consumer catch up
+	sleep 1
+	wall1=$(date +%s%N)
+	cpu1=($(cpu_jiffies))
+	cj=$(proc_jiffies $CONSUMER)
+	hz=$(getconf CLK_TCK)
+
+	kill -INT $CONSUMER
+	wait $CONSUMER
+	CONSUMER=
+	summary=$(tail -n 1 "$out")
+	rm -f "$out"
+
+	# "N records, N shown, N/s, N ring drops, N skipped"
+	set -- $summary
+	printf 'scenario=%s rate=%s secs=%s ops=%s events=%s ev_per_s=%s ring_drops=%s rl_dropped=%s flt_dropped=%s cpu_sys_pct=%s consumer_cpu_pct=%s%s\n' \
+		"$sc" "$rate" "$SECS" "$OPS" "${1:-0}" \
+		"$(awk -v n="${1:-0}" -v w=$((wall1 - wall0)) \
+			'BEGIN { printf "%.0f", n * 1e9 / w }')" \
+		"${6:-0}" $(($(rl_dropped) - rl0)) $(($(flt_dropped) - fl0)) \
+		"$(awk -v a=$((cpu1[0] - cpu0[0])) -v t=$((cpu1[1] - cpu0[1])) \
+			'BEGIN { printf "%.2f", t ? 100 * a / t : 0 }')" \
+		"$(awk -v c="$cj" -v hz="$hz" -v w=$((wall1 - wall0)) \
+			'BEGIN { printf "%.2f", 100 * c / hz * 1e9 / w }')" \
+		"$(handlers)"
+}
+
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+cleanup
+setup
+
+{
+	echo "# date $(date -u +%FT%TZ)"
+	echo "# kernel $(uname -r) cpus $(nproc)"
+	echo "# srcversion $(cat /sys/module/nobd/srcversion 2>/dev/null)"
+	echo "# git $(git -C "$HERE" describe --always --dirty 2>/dev/null)"
+	for p in /sys/module/nobd/parameters/*; do
+		echo "# param $(basename "$p") $(cat "$p" 2>/dev/null)"
+	done
+	echo "# filter $(head -n 1 /proc/nobd/filter 2>/dev/null)"
+	for sc in $SCENARIOS; do
+		echo "$sc ..." >&2
+		run "$sc"
+	done
+} > "$REPORT"
+
+echo "report in $REPORT" >&2
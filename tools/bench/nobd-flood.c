@@ -0,0 +1,103 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      nobd-flood: new UDP flows at a fixed rate, one conntrack each.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define FLOOD_TICK_NS	1000000ULL	/* pacing granularity */
+
+static unsigned long long flood_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void flood_usage(void)
+{
+	fprintf(stderr, "usage: nobd-flood DST RATE SECS [PORTS]\n"
+		"  one datagram per flow, RATE flows/s for SECS, cycling\n"
+		"  through PORTS (default 60000) destination ports from 1024,\n"
+		"  the source port moves on each cycle\n");
+	exit(2);
+}
+
+/*
+ * Every datagram goes to the next port, so each one is a new tuple as
+ * long as RATE * ct timeout stays below PORTS times the source ports used.
+ */
+int main(int argc, char **argv)
+{
+	struct sockaddr_in dst, src;
+	unsigned long long rate, secs, ports = 60000, sent = 0, errs = 0;
+	unsigned long long start, due, now, n;
+	unsigned int sport = 0;
+	int fd = -1;
+	char c = 0;
+
+	if (argc < 4)
+		flood_usage();
+	memset(&dst, 0, sizeof(dst));
+	dst.sin_family = AF_INET;
+	if (inet_pton(AF_INET, argv[1], &dst.sin_addr) != 1)
+		flood_usage();
+	rate = strtoull(argv[2], NULL, 0);
+	secs = strtoull(argv[3], NULL, 0);
+	if (argc > 4)
+		ports = strtoull(argv[4], NULL, 0);
+	if (!rate || !secs || !ports || ports > 64511)
+		flood_usage();
+
+	start = flood_now();
+	for (;;) {
+		now = flood_now();
+		if (now - start >= secs * 1000000000ULL)
+			break;
+		/* flows due by now, sent in a burst, then sleep a tick */
+		due = (now - start) * rate / 1000000000ULL;
+		for (n = sent; n < due; n++) {
+			if (n % ports == 0) {
+				/* a new source port for the next cycle */
+				if (fd >= 0)
+					close(fd);
+				fd = socket(AF_INET, SOCK_DGRAM, 0);
+				if (fd < 0) {
+					perror("socket");
+					return 1;
+				}
+				memset(&src, 0, sizeof(src));
+				src.sin_family = AF_INET;
+				src.sin_port = htons(20000 + sport++ % 40000);
+				bind(fd, (struct sockaddr *)&src, sizeof(src));
+			}
+			dst.sin_port = htons(1024 + n % ports);
+			if (sendto(fd, &c, 1, 0, (struct sockaddr *)&dst,
+				   sizeof(dst)) < 0)
+				errs++;
+		}
+		sent = due;
+		usleep(FLOOD_TICK_NS / 1000);
+	}
+	if (fd >= 0)
+		close(fd);
+	printf("flows %llu errors %llu\n", sent, errs);
+	return 0;
+}
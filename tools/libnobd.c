@@ -0,0 +1,543 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      Zero copy consumer of the /dev/nobd rings.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "libnobd.h"
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+#define NOBD_NAME(tbl, i) \
+	((i) < ARRAY_SIZE(tbl) && tbl[i] ? tbl[i] : "?")
+
+/* pos is our copy of tail, published to the kernel once per dispatch */
+struct nobd_ring {
+	struct nobd_ring_ctl *ctl;
+	const struct nobd_ev *ev;
+	__u32 pos;
+	__u32 head;
+};
+
+struct nobd {
+	int fd;
+	int epfd;
+	int flags;
+	void *map;
+	size_t map_len;
+	struct nobd_geometry geo;
+	__u32 mask;
+	struct nobd_ring *rings;
+	unsigned long long records;
+	unsigned long long skipped;
+};
+
+struct nobd *nobd_open(const char *path, int flags)
+{
+	struct epoll_event ee;
+	struct nobd *h;
+	unsigned int i;
+	int err;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return NULL;
+	h->flags = flags;
+	h->epfd = -1;
+	h->fd = open(path ? path : NOBD_DEV_PATH, O_RDWR | O_CLOEXEC);
+	if (h->fd < 0)
+		goto err;
+	if (ioctl(h->fd, NOBD_IOC_GEOMETRY, &h->geo) < 0)
+		goto err;
+	/* the records would be misread */
+	if (h->geo.version != NOBD_EV_VERSION ||
+	    h->geo.ev_size != sizeof(struct nobd_ev) || !h->geo.nr_ev ||
+	    (h->geo.nr_ev & (h->geo.nr_ev - 1))) {
+		errno = EPROTO;
+		goto err;
+	}
+	h->mask = h->geo.nr_ev - 1;
+
+	h->map_len = (size_t)h->geo.ring_bytes * h->geo.nr_rings;
+	h->map = mmap(NULL, h->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      h->fd, 0);
+	if (h->map == MAP_FAILED) {
+		h->map = NULL;
+		goto err;
+	}
+	h->rings = calloc(h->geo.nr_rings, sizeof(*h->rings));
+	if (!h->rings)
+		goto err;
+	for (i = 0; i < h->geo.nr_rings; i++) {
+		char *base = (char *)h->map + (size_t)i * h->geo.ring_bytes;
+		struct nobd_ring *r = &h->rings[i];
+
+		r->ctl = (struct nobd_ring_ctl *)base;
+		r->ev = (const struct nobd_ev *)(base + h->geo.ev_offset);
+		r->pos = __atomic_load_n(&r->ctl->tail, __ATOMIC_RELAXED);
+		r->head = r->pos;
+	}
+
+	h->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (h->epfd < 0)
+		goto err;
+	memset(&ee, 0, sizeof(ee));
+	ee.events = EPOLLIN;
+	if (epoll_ctl(h->epfd, EPOLL_CTL_ADD, h->fd, &ee) < 0)
+		goto err;
+
+	return h;
+
+err:
+	err = errno;
+	nobd_close(h);
+	errno = err;
+	return NULL;
+}
+
+void nobd_close(struct nobd *h)
+{
+	if (!h)
+		return;
+	if (h->epfd >= 0)
+		close(h->epfd);
+	if (h->map)
+		munmap(h->map, h->map_len);
+	if (h->fd >= 0)
+		close(h->fd);
+	free(h->rings);
+	free(h);
+}
+
+/* for callers with an epoll loop of their own, readable means records */
+int nobd_fd(const struct nobd *h)
+{
+	return h->fd;
+}
+
+/* 1 once something is pending, 0 on timeout, -1 with errno set */
+int nobd_wait(struct nobd *h, int timeout_ms)
+{
+	struct epoll_event ee;
+	int n;
+
+	do {
+		n = epoll_wait(h->epfd, &ee, 1, timeout_ms);
+	} while (n < 0 && errno == EINTR);
+
+	return n;
+}
+
+/* the kernel publishes head after the record, pairs with its smp_wmb() */
+static __u32 nobd_ring_head(struct nobd_ring *r)
+{
+	r->head = __atomic_load_n(&r->ctl->head, __ATOMIC_ACQUIRE);
+	return r->head;
+}
+
+/* hands the slots back, the reads must be done before the kernel reuses them */
+static void nobd_ring_release(struct nobd_ring *r)
+{
+	__atomic_store_n(&r->ctl->tail, r->pos, __ATOMIC_RELEASE);
+}
+
+static int nobd_deliver(struct nobd *h, int ring, nobd_cb cb, void *arg)
+{
+	struct nobd_ring *r = &h->rings[ring];
+	const struct nobd_ev *ev = &r->ev[r->pos & h->mask];
+	int stop = 0;
+
+	if (ev->hdr.version != NOBD_EV_VERSION)
+		h->skipped++;
+	else {
+		h->records++;
+		stop = cb(ev, ring, arg);
+	}
+	r->pos++;
+	return stop;
+}
+
+/* ring by ring, the cheapest way through when order does not matter */
+static int nobd_dispatch_rings(struct nobd *h, int max, nobd_cb cb,
+			       void *arg)
+{
+	unsigned int i;
+	int n = 0, stop = 0;
+
+	for (i = 0; i < h->geo.nr_rings && n < max && !stop; i++) {
+		struct nobd_ring *r = &h->rings[i];
+		__u32 head = nobd_ring_head(r);
+
+		if (r->pos == head)
+			continue;
+		while (r->pos != head && n < max && !stop) {
+			stop = nobd_deliver(h, i, cb, arg);
+			n++;
+		}
+		nobd_ring_release(r);
+	}
+	return n;
+}
+
+/*
+ * Oldest record first over every ring. Heads are read once per call, so a
+ * record published meanwhile on another cpu may come in the next call
+ * after one with a higher seq.
+ */
+static int nobd_dispatch_ordered(struct nobd *h, int max, nobd_cb cb,
+				 void *arg)
+{
+	unsigned int i;
+	int n = 0, stop = 0, best;
+	__u32 seq = 0;
+
+	for (i = 0; i < h->geo.nr_rings; i++)
+		nobd_ring_head(&h->rings[i]);
+
+	while (n < max && !stop) {
+		best = -1;
+		for (i = 0; i < h->geo.nr_rings; i++) {
+			struct nobd_ring *r = &h->rings[i];
+			__u32 s;
+
+			if (r->pos == r->head)
+				continue;
+			s = r->ev[r->pos & h->mask].hdr.seq;
+			if (best < 0 || (__s32)(s - seq) < 0) {
+				best = i;
+				seq = s;
+			}
+		}
+		if (best < 0)
+			break;
+		stop = nobd_deliver(h, best, cb, arg);
+		n++;
+	}
+
+	for (i = 0; i < h->geo.nr_rings; i++)
+		nobd_ring_release(&h->rings[i]);
+	return n;
+}
+
+/*
+ * Calls cb for up to max pending records without waiting, and returns how
+ * many it was called for.
+ */
+int nobd_dispatch(struct nobd *h, int max, nobd_cb cb, void *arg)
+{
+	if (max <= 0)
+		max = 1 << 30;
+	if (h->flags & NOBD_F_ORDERED)
+		return nobd_dispatch_ordered(h, max, cb, arg);
+	return nobd_dispatch_rings(h, max, cb, arg);
+}
+
+void nobd_get_stats(const struct nobd *h, struct nobd_stats *st)
+{
+	unsigned int i;
+
+	memset(st, 0, sizeof(*st));
+	st->records = h->records;
+	st->skipped = h->skipped;
+	st->nr_rings = h->geo.nr_rings;
+	st->nr_ev = h->geo.nr_ev;
+	for (i = 0; i < h->geo.nr_rings; i++) {
+		const struct nobd_ring *r = &h->rings[i];
+
+		st->ring_drops += r->ctl->drops;
+		st->backlog += __atomic_load_n(&r->ctl->head,
+					       __ATOMIC_RELAXED) - r->pos;
+	}
+}
+
+static const char *nobd_types[NOBD_EV_MAX] = {
+	[NOBD_EV_CT]	= "ct",
+	[NOBD_EV_ROUTE]	= "route",
+	[NOBD_EV_NEIGH]	= "neigh",
+	[NOBD_EV_LINK]	= "link",
+	[NOBD_EV_FDB]	= "fdb",
+	[NOBD_EV_VLAN]	= "vlan",
+	[NOBD_EV_PPPOE]	= "pppoe",
+	[NOBD_EV_DROPS]	= "drops",
+	[NOBD_EV_SNAP]	= "snap",
+};
+
+static const char *nobd_ops[] = {
+	[NOBD_OP_NEW]		= "new",
+	[NOBD_OP_DEL]		= "del",
+	[NOBD_OP_MOVE]		= "move",
+	[NOBD_OP_CHANGE]	= "change",
+};
+
+static const char *nobd_ct_ops[] = {
+	[NOBD_CT_NEW]		= "new",
+	[NOBD_CT_DESTROY]	= "destroy",
+	[NOBD_CT_RELATED]	= "related",
+	[NOBD_CT_HELPER]	= "helper",
+	[NOBD_CT_TIMEOUT]	= "timeout",
+	[NOBD_CT_SHORT]		= "short",
+	[NOBD_CT_CLOSED]	= "closed",
+};
+
+static const char *nobd_link_ops[] = {
+	[NOBD_LINK_REGISTER]	= "register",
+	[NOBD_LINK_UNREGISTER]	= "unregister",
+	[NOBD_LINK_UP]		= "up",
+	[NOBD_LINK_DOWN]	= "down",
+	[NOBD_LINK_GOING_DOWN]	= "going_down",
+	[NOBD_LINK_CHANGE]	= "change",
+	[NOBD_LINK_BIND]	= "bind",
+	[NOBD_LINK_UNBIND]	= "unbind",
+};
+
+static const char *nobd_link_classes[] = {
+	[NOBD_CLASS_ETH]	= "eth",
+	[NOBD_CLASS_BRIDGE]	= "br",
+	[NOBD_CLASS_BRPORT]	= "brport",
+	[NOBD_CLASS_VLAN]	= "vlan",
+	[NOBD_CLASS_PPP]	= "ppp",
+};
+
+static const char *nobd_rl_names[NOBD_RL_MAX] = {
+	[NOBD_RL_CT_NEW]	= "ct_new",
+	[NOBD_RL_CT_DESTROY]	= "ct_destroy",
+	[NOBD_RL_ROUTE]		= "route",
+	[NOBD_RL_NEIGH]		= "neigh",
+	[NOBD_RL_LINK]		= "link",
+	[NOBD_RL_FDB]		= "fdb",
+	[NOBD_RL_PPPOE]		= "pppoe",
+	[NOBD_RL_VLAN]		= "vlan",
+};
+
+static const char *nobd_snap_ops[] = {
+	[NOBD_SNAP_BEGIN]	= "begin",
+	[NOBD_SNAP_END]		= "end",
+	[NOBD_SNAP_ABORT]	= "abort",
+};
+
+const char *nobd_type_name(unsigned int type)
+{
+	if (type == NOBD_EV_NONE)
+		return "all";
+	return NOBD_NAME(nobd_types, type);
+}
+
+/* as in /proc/nobd/events, with the port as in [::1]:80 when given */
+static void nobd_addr_format(char *buf, size_t len, __u8 family,
+			     const union nobd_addr *addr, int port)
+{
+	char a[INET6_ADDRSTRLEN];
+
+	if (!inet_ntop(family == AF_INET6 ? AF_INET6 : AF_INET, addr->b, a,
+		       sizeof(a)))
+		strcpy(a, "?");
+	if (family == AF_INET6 && port >= 0)
+		snprintf(buf, len, "[%s]:%u", a, port);
+	else if (port >= 0)
+		snprintf(buf, len, "%s:%u", a, port);
+	else
+		snprintf(buf, len, "%s", a);
+}
+
+static const char *nobd_mac(char *buf, const __u8 *mac)
+{
+	sprintf(buf, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2],
+		mac[3], mac[4], mac[5]);
+	return buf;
+}
+
+/* snprintf() at offset at of buf, returns the new offset as it would be */
+static int nobd_append(char *buf, size_t len, int at, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (at < 0)
+		return at;
+	va_start(ap, fmt);
+	if ((size_t)at < len)
+		n = vsnprintf(buf + at, len - at, fmt, ap);
+	else
+		n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	return n < 0 ? n : at + n;
+}
+
+/*
+ * One line, without a newline, the same as /proc/nobd/events but for the
+ * cpu. Returns what snprintf() would.
+ */
+int nobd_ev_format(const struct nobd_ev *ev, char *buf, size_t len)
+{
+	char a[64], b[64], m[18];
+	int n, i;
+
+	n = nobd_append(buf, len, 0, "%u %llu.%06llu ns%u ", ev->hdr.seq,
+			(unsigned long long)(ev->hdr.ts / 1000000000ULL),
+			(unsigned long long)(ev->hdr.ts % 1000000000ULL / 1000),
+			ev->hdr.netns);
+
+	switch (ev->hdr.type) {
+	case NOBD_EV_CT:
+		nobd_addr_format(a, sizeof(a), ev->ct.family, &ev->ct.src,
+				 ntohs(ev->ct.sport));
+		nobd_addr_format(b, sizeof(b), ev->ct.family, &ev->ct.dst,
+				 ntohs(ev->ct.dport));
+		n = nobd_append(buf, len, n, "ct %s proto %u %s -> %s",
+				NOBD_NAME(nobd_ct_ops, ev->ct.op),
+				ev->ct.proto, a, b);
+		if (ev->ct.helper)
+			n = nobd_append(buf, len, n, " helper #%u",
+					ev->ct.helper);
+		if (ev->ct.count > 1)
+			n = nobd_append(buf, len, n, " x%u", ev->ct.count);
+		if (ev->ct.sample_n > 1)
+			n = nobd_append(buf, len, n, " 1/%u", ev->ct.sample_n);
+		if (ev->ct.duration)
+			n = nobd_append(buf, len, n, " %ums", ev->ct.duration);
+		break;
+	case NOBD_EV_ROUTE:
+		nobd_addr_format(a, sizeof(a), ev->route.family,
+				 &ev->route.dst, -1);
+		nobd_addr_format(b, sizeof(b), ev->route.family,
+				 &ev->route.gw, -1);
+		n = nobd_append(buf, len, n,
+				"route %s %s/%u gw %s oif %u table %u",
+				NOBD_NAME(nobd_ops, ev->route.op), a,
+				ev->route.dst_len, b, ev->route.oif,
+				ev->route.table);
+		break;
+	case NOBD_EV_NEIGH:
+		nobd_addr_format(a, sizeof(a), ev->neigh.family, &ev->neigh.ip,
+				 -1);
+		n = nobd_append(buf, len, n,
+				"neigh %s %s lladdr %s if %u state 0x%02x",
+				NOBD_NAME(nobd_ops, ev->neigh.op), a,
+				nobd_mac(m, ev->neigh.lladdr),
+				ev->neigh.ifindex, ev->neigh.state);
+		if (ev->neigh.flaps)
+			n = nobd_append(buf, len, n, " flaps %u",
+					ev->neigh.flaps);
+		break;
+	case NOBD_EV_LINK:
+		n = nobd_append(buf, len, n, "link %s %s %.16s if %u master %u",
+				NOBD_NAME(nobd_link_classes, ev->link.class),
+				NOBD_NAME(nobd_link_ops, ev->link.op),
+				ev->link.name, ev->link.ifindex,
+				ev->link.master);
+		break;
+	case NOBD_EV_FDB:
+		n = nobd_append(buf, len, n,
+				"fdb %s br %u %s port %u local %u static %u age %u",
+				NOBD_NAME(nobd_ops, ev->fdb.op),
+				ev->fdb.br_ifindex, nobd_mac(m, ev->fdb.mac),
+				ev->fdb.port_ifindex,
+				!!(ev->fdb.flags & NOBD_FDB_LOCAL),
+				!!(ev->fdb.flags & NOBD_FDB_STATIC),
+				ev->fdb.age);
+		if (ev->fdb.op == NOBD_OP_MOVE)
+			n = nobd_append(buf, len, n, " from %u",
+					ev->fdb.old_port_ifindex);
+		break;
+	case NOBD_EV_VLAN:
+		n = nobd_append(buf, len, n, "vlan %s %.16s if %u vid %u real %u",
+				NOBD_NAME(nobd_link_ops, ev->vlan.op),
+				ev->vlan.name, ev->vlan.ifindex, ev->vlan.vid,
+				ev->vlan.real_ifindex);
+		break;
+	case NOBD_EV_PPPOE:
+		n = nobd_append(buf, len, n,
+				"pppoe %s if %u sid %u remote %s dev %u ch %u pid %u",
+				NOBD_NAME(nobd_link_ops, ev->pppoe.op),
+				ev->pppoe.ifindex, ntohs(ev->pppoe.sid),
+				nobd_mac(m, ev->pppoe.remote),
+				ev->pppoe.pppoe_ifindex, ev->pppoe.chan,
+				ev->pppoe.pid);
+		break;
+	case NOBD_EV_DROPS:
+		n = nobd_append(buf, len, n, "drops %ums",
+				ev->drops.interval_ms);
+		for (i = 0; i < NOBD_RL_MAX; i++) {
+			if (ev->drops.dropped[i])
+				n = nobd_append(buf, len, n, " %s %u",
+						nobd_rl_names[i],
+						ev->drops.dropped[i]);
+		}
+		break;
+	case NOBD_EV_SNAP:
+		n = nobd_append(buf, len, n, "snap %s %s id %u",
+				NOBD_NAME(nobd_snap_ops, ev->snap.op),
+				nobd_type_name(ev->snap.what), ev->snap.id);
+		if (ev->snap.op != NOBD_SNAP_BEGIN)
+			n = nobd_append(buf, len, n, " records %u lost %u",
+					ev->snap.count, ev->snap.lost);
+		break;
+	default:
+		n = nobd_append(buf, len, n, "type %u", ev->hdr.type);
+		break;
+	}
+
+	return n;
+}
+
+/* writes text to /proc/nobd/name, 0 or -1 with errno set */
+int nobd_proc_write(const char *name, const char *text)
+{
+	char path[256];
+	ssize_t n;
+	int fd, err;
+
+	snprintf(path, sizeof(path), "%s/%s", NOBD_PROC_PATH, name);
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	n = write(fd, text, strlen(text));
+	err = errno;
+	close(fd);
+	if (n < 0) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+/* copies /proc/nobd/name to fd */
+int nobd_proc_cat(const char *name, int fd)
+{
+	char path[256], buf[4096];
+	ssize_t n;
+	int in;
+
+	snprintf(path, sizeof(path), "%s/%s", NOBD_PROC_PATH, name);
+	in = open(path, O_RDONLY | O_CLOEXEC);
+	if (in < 0)
+		return -1;
+	while ((n = read(in, buf, sizeof(buf))) > 0) {
+		if (write(fd, buf, n) != n) {
+			n = -1;
+			break;
+		}
+	}
+	close(in);
+	return n < 0 ? -1 : 0;
+}
@@ -0,0 +1,45 @@
+#ifndef LIBNOBD_H
+#define LIBNOBD_H
+
+/*
+ * Userspace side of /dev/nobd. The rings are mapped read/write and records
+ * are handed to the caller in place, a record stays valid until the
+ * callback that got it returns.
+ */
+
+#include <stddef.h>
+#include "nobd_ev.h"
+
+#define NOBD_DEV_PATH		"/dev/" NOBD_DEV_NAME
+#define NOBD_PROC_PATH		"/proc/nobd"
+
+/* nobd_open() flags */
+#define NOBD_F_ORDERED		0x01	/* merge the rings by seq */
+
+struct nobd;
+
+/* called for every record, a non zero return stops the dispatch */
+typedef int (*nobd_cb)(const struct nobd_ev *ev, int ring, void *arg);
+
+struct nobd_stats {
+	unsigned long long records;	/* handed to callbacks */
+	unsigned long long skipped;	/* of an unknown version */
+	unsigned long long ring_drops;	/* the rings had no room, per kernel */
+	unsigned int nr_rings;
+	unsigned int nr_ev;		/* per ring */
+	unsigned int backlog;		/* records not read yet, all rings */
+};
+
+struct nobd *nobd_open(const char *path, int flags);
+void nobd_close(struct nobd *h);
+int nobd_fd(const struct nobd *h);
+int nobd_wait(struct nobd *h, int timeout_ms);
+int nobd_dispatch(struct nobd *h, int max, nobd_cb cb, void *arg);
+void nobd_get_stats(const struct nobd *h, struct nobd_stats *st);
+
+const char *nobd_type_name(unsigned int type);
+int nobd_ev_format(const struct nobd_ev *ev, char *buf, size_t len);
+
+int nobd_proc_write(const char *name, const char *text);
+int nobd_proc_cat(const char *name, int fd);
+#endif /* LIBNOBD_H */
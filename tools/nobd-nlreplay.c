@@ -0,0 +1,783 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      nobd-nlreplay: the module's netlink parsers against recorded or
+ *      generated rtnetlink streams, for checking and timing them.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+#include <linux/if_link.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define REPLAY_TSC	1
+#endif
+
+#include "libnobd.h"
+#include "nobd_nl_parse.h"
+
+/*
+ * A stream file is a run of datagrams, each a host order __u32 length
+ * followed by that many bytes, as read off an rtnetlink socket.
+ */
+#define REPLAY_DGRAM	8192
+
+struct replay_buf {
+	char *p;
+	size_t len;
+	size_t cap;
+};
+
+struct replay_stream {
+	struct replay_buf data;		/* the datagrams, length prefixed */
+	unsigned long dgrams;
+	unsigned long msgs;
+};
+
+static volatile sig_atomic_t replay_stop;
+
+static void replay_sig(int sig)
+{
+	(void)sig;
+	replay_stop = 1;
+}
+
+static void replay_usage(void)
+{
+	fprintf(stderr,
+		"usage: nobd-nlreplay record [-d] [-n DGRAMS] FILE\n"
+		"       nobd-nlreplay gen [-s SEED] MSGS FILE\n"
+		"       nobd-nlreplay dump [-a] FILE\n"
+		"       nobd-nlreplay bench [-a] [-i PASSES] FILE|-g MSGS\n"
+		"       nobd-nlreplay check\n"
+		"\n"
+		"record  rtnetlink notifications until ^C, -d dumps the tables first\n"
+		"gen     a synthetic mix of route, neighbour and bridge port messages\n"
+		"dump    print what the parsers make of a stream\n"
+		"bench   time the parse loop over a stream, -a as with no_arp\n"
+		"check   run the parsers against known messages\n");
+	exit(2);
+}
+
+static void *replay_grow(struct replay_buf *b, size_t len)
+{
+	void *p;
+
+	if (b->len + len > b->cap) {
+		b->cap = (b->len + len) * 2;
+		b->p = realloc(b->p, b->cap);
+		if (!b->p) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	p = b->p + b->len;
+	memset(p, 0, len);
+	b->len += len;
+	return p;
+}
+
+/* message building, NLMSG_ALIGN'ed like the kernel lays them out */
+static struct nlmsghdr *replay_msg(struct replay_buf *b, __u16 type,
+				   const void *hdr, size_t hdrlen)
+{
+	struct nlmsghdr *nlh;
+	size_t off = b->len;
+
+	replay_grow(b, NLMSG_LENGTH(NLMSG_ALIGN(hdrlen)));
+	nlh = (struct nlmsghdr *)(b->p + off);
+	nlh->nlmsg_len = NLMSG_LENGTH(hdrlen);
+	nlh->nlmsg_type = type;
+	memcpy(NLMSG_DATA(nlh), hdr, hdrlen);
+	return nlh;
+}
+
+static void replay_attr(struct replay_buf *b, struct nlmsghdr **nlh,
+			__u16 type, const void *data, size_t len)
+{
+	size_t off = (char *)*nlh - b->p;
+	struct rtattr *rta;
+
+	/* the message may move with the buffer */
+	rta = replay_grow(b, RTA_SPACE(len));
+	*nlh = (struct nlmsghdr *)(b->p + off);
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+	(*nlh)->nlmsg_len = NLMSG_ALIGN((*nlh)->nlmsg_len) + RTA_SPACE(len);
+}
+
+static struct nlmsghdr *replay_route(struct replay_buf *b, __u16 type,
+				     int family, const void *dst, int dst_len,
+				     const void *gw, __u32 oif)
+{
+	struct nlmsghdr *nlh;
+	struct rtmsg rtm;
+	int alen = family == AF_INET ? 4 : 16;
+
+	memset(&rtm, 0, sizeof(rtm));
+	rtm.rtm_family = family;
+	rtm.rtm_dst_len = dst_len;
+	rtm.rtm_table = RT_TABLE_MAIN;
+	rtm.rtm_protocol = RTPROT_STATIC;
+	rtm.rtm_type = RTN_UNICAST;
+	nlh = replay_msg(b, type, &rtm, sizeof(rtm));
+	replay_attr(b, &nlh, RTA_TABLE, &(__u32){ RT_TABLE_MAIN }, 4);
+	if (dst)
+		replay_attr(b, &nlh, RTA_DST, dst, alen);
+	if (gw)
+		replay_attr(b, &nlh, RTA_GATEWAY, gw, alen);
+	replay_attr(b, &nlh, RTA_OIF, &oif, 4);
+	return nlh;
+}
+
+static struct nlmsghdr *replay_neigh(struct replay_buf *b, __u16 type,
+				     int family, const void *ip, int ifindex,
+				     const void *mac, __u16 state)
+{
+	struct nlmsghdr *nlh;
+	struct ndmsg ndm;
+
+	memset(&ndm, 0, sizeof(ndm));
+	ndm.ndm_family = family;
+	ndm.ndm_ifindex = ifindex;
+	ndm.ndm_state = state;
+	nlh = replay_msg(b, type, &ndm, sizeof(ndm));
+	replay_attr(b, &nlh, NDA_DST, ip, family == AF_INET ? 4 : 16);
+	if (mac)
+		replay_attr(b, &nlh, NDA_LLADDR, mac, 6);
+	replay_attr(b, &nlh, NDA_CACHEINFO, &(struct nda_cacheinfo){ 0 },
+		    sizeof(struct nda_cacheinfo));
+	return nlh;
+}
+
+static struct nlmsghdr *replay_link(struct replay_buf *b, __u16 type,
+				    int family, int ifindex, const char *name,
+				    __u32 master)
+{
+	struct nlmsghdr *nlh;
+	struct ifinfomsg ifi;
+
+	memset(&ifi, 0, sizeof(ifi));
+	ifi.ifi_family = family;
+	ifi.ifi_index = ifindex;
+	nlh = replay_msg(b, type, &ifi, sizeof(ifi));
+	replay_attr(b, &nlh, IFLA_IFNAME, name, strlen(name) + 1);
+	replay_attr(b, &nlh, IFLA_MTU, &(__u32){ 1500 }, 4);
+	if (master)
+		replay_attr(b, &nlh, IFLA_MASTER, &master, 4);
+	return nlh;
+}
+
+/* closes the datagram started at dgram_off, filling in its length */
+static void replay_dgram_end(struct replay_stream *s, size_t dgram_off)
+{
+	__u32 len = s->data.len - dgram_off - sizeof(__u32);
+
+	memcpy(s->data.p + dgram_off, &len, sizeof(len));
+	s->dgrams++;
+}
+
+/*
+ * Half the messages are IPv4 routes, then neighbours, IPv6 routes and
+ * bridge ports, adds and dels taking turns so the stream looks like churn,
+ * in datagrams of up to REPLAY_DGRAM bytes.
+ */
+static void replay_gen(struct replay_stream *s, unsigned long msgs,
+		       unsigned int seed)
+{
+	size_t dgram = 0;
+	unsigned long i;
+	char name[16];
+
+	srand(seed);
+	for (i = 0; i < msgs; i++) {
+		unsigned int r = rand(), k = i >> 1 & 0xffff;
+		__u16 del = i & 1;
+		__u8 a6[16] = { 0x20, 0x01, 0x0d, 0xb8 };
+		__u8 mac[6] = { 0x02, 0, 0, 0, k >> 8, k & 0xff };
+		__u32 a4 = htonl(0x0ac80000 | k), gw4 = htonl(0x0a630002);
+
+		if (!i || s->data.len - dgram > REPLAY_DGRAM - 256) {
+			if (i)
+				replay_dgram_end(s, dgram);
+			dgram = s->data.len;
+			replay_grow(&s->data, sizeof(__u32));
+		}
+		switch (r % 10) {
+		case 0 ... 4:
+			replay_route(&s->data, RTM_NEWROUTE + del, AF_INET,
+				     &a4, 32, &gw4, 2 + r % 8);
+			break;
+		case 5 ... 7:
+			replay_neigh(&s->data, RTM_NEWNEIGH + del, AF_INET,
+				     &a4, 2, del ? NULL : mac,
+				     del ? NUD_FAILED : NUD_REACHABLE);
+			break;
+		case 8:
+			a6[6] = k >> 8;
+			a6[7] = k;
+			replay_route(&s->data, RTM_NEWROUTE + del, AF_INET6,
+				     a6, 64, NULL, 2);
+			break;
+		default:
+			snprintf(name, sizeof(name), "p%u", k);
+			replay_link(&s->data, RTM_NEWLINK + del, AF_BRIDGE,
+				    100 + k, name, 3);
+			break;
+		}
+		s->msgs++;
+	}
+	if (msgs)
+		replay_dgram_end(s, dgram);
+}
+
+static int replay_load(struct replay_stream *s, const char *path)
+{
+	struct replay_buf *b = &s->data;
+	FILE *f = fopen(path, "r");
+	size_t n, off;
+	__u32 len;
+
+	if (!f)
+		return -1;
+	while ((n = fread(replay_grow(b, 65536), 1, 65536, f)) > 0)
+		b->len -= 65536 - n;
+	b->len -= 65536;
+	fclose(f);
+
+	for (off = 0; off + sizeof(len) <= b->len; off += sizeof(len) + len) {
+		memcpy(&len, b->p + off, sizeof(len));
+		if (off + sizeof(len) + len > b->len) {
+			errno = EINVAL;
+			return -1;
+		}
+		s->dgrams++;
+	}
+	return 0;
+}
+
+/* calls fn for every message, walked as nobd_nl_rcv() does */
+static unsigned long replay_walk(struct replay_stream *s, int flags,
+				 void (*fn)(int kind, struct nobd_ev *ev,
+					    void *arg),
+				 void *arg)
+{
+	unsigned long msgs = 0;
+	struct nobd_ev ev;
+	size_t off;
+	__u32 len;
+
+	for (off = 0; off + sizeof(len) <= s->data.len;
+	     off += sizeof(len) + len) {
+		struct nlmsghdr *nlh;
+		int left, kind;
+
+		memcpy(&len, s->data.p + off, sizeof(len));
+		nlh = (struct nlmsghdr *)(s->data.p + off + sizeof(len));
+		for (left = len; NLMSG_OK(nlh, left);
+		     nlh = NLMSG_NEXT(nlh, left)) {
+			msgs++;
+			kind = nobd_nl_parse(nlh, &ev, flags);
+			if (fn)
+				fn(kind, &ev, arg);
+			if (kind == NOBD_NL_DONE || kind == NOBD_NL_ERROR)
+				break;
+		}
+	}
+	return msgs;
+}
+
+static const char *replay_kind[NOBD_NL_MAX] = {
+	[NOBD_NL_SKIP]	= "skip",
+	[NOBD_NL_DONE]	= "done",
+	[NOBD_NL_ERROR]	= "error",
+	[NOBD_NL_ROUTE]	= "route",
+	[NOBD_NL_LINK]	= "link",
+	[NOBD_NL_NEIGH]	= "neigh",
+};
+
+static void replay_print(int kind, struct nobd_ev *ev, void *arg)
+{
+	char line[256];
+
+	(void)arg;
+	if (kind == NOBD_NL_ROUTE || kind == NOBD_NL_LINK ||
+	    kind == NOBD_NL_NEIGH) {
+		nobd_ev_format(ev, line, sizeof(line));
+		printf("%s\n", line);
+	} else {
+		printf("%s\n", replay_kind[kind]);
+	}
+}
+
+static void replay_count(int kind, struct nobd_ev *ev, void *arg)
+{
+	unsigned long *counts = arg;
+
+	(void)ev;
+	counts[kind]++;
+}
+
+static int replay_request(int fd, __u16 type, __u8 family, __u32 seq)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct rtgenmsg g;
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.g));
+	req.nlh.nlmsg_type = type;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = seq;
+	req.g.rtgen_family = family;
+	return send(fd, &req, req.nlh.nlmsg_len, 0);
+}
+
+static int replay_record(int argc, char **argv)
+{
+	static const struct {
+		__u16 type;
+		__u8 family;
+	} dumps[] = {
+		{ RTM_GETROUTE, AF_UNSPEC },
+		{ RTM_GETNEIGH, AF_UNSPEC },
+		{ RTM_GETLINK, AF_BRIDGE },
+	};
+	struct sockaddr_nl addr;
+	struct sigaction sa;
+	unsigned long max = 0, n = 0;
+	char buf[65536];
+	unsigned int i;
+	int c, fd, dump = 0, left = 0;
+	FILE *f;
+	__u32 len;
+
+	while ((c = getopt(argc, argv, "dn:")) != -1) {
+		switch (c) {
+		case 'd':
+			dump = 1;
+			break;
+		case 'n':
+			max = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			replay_usage();
+		}
+	}
+	if (optind >= argc)
+		replay_usage();
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if (fd < 0) {
+		perror("socket");
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK | RTMGRP_NEIGH | RTMGRP_IPV4_ROUTE |
+		RTMGRP_IPV6_ROUTE;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+	f = fopen(argv[optind], "w");
+	if (!f) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	/* no SA_RESTART, recv() has to return on ^C */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = replay_sig;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	/* one dump at a time, the next once NLMSG_DONE of this one is in */
+	i = 0;
+	if (dump && replay_request(fd, dumps[0].type, dumps[0].family, 1) > 0)
+		left = 1;
+	while (!replay_stop && (!max || n < max)) {
+		ssize_t r = recv(fd, buf, sizeof(buf), 0);
+		struct nlmsghdr *nlh;
+		int l;
+
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			/* ENOBUFS, an overrun, is what the module resyncs on */
+			perror("recv");
+			if (errno == ENOBUFS)
+				continue;
+			break;
+		}
+		len = r;
+		fwrite(&len, sizeof(len), 1, f);
+		fwrite(buf, 1, len, f);
+		n++;
+		if (!left)
+			continue;
+		for (nlh = (struct nlmsghdr *)buf, l = r; NLMSG_OK(nlh, l);
+		     nlh = NLMSG_NEXT(nlh, l)) {
+			if (nlh->nlmsg_type != NLMSG_DONE &&
+			    nlh->nlmsg_type != NLMSG_ERROR)
+				continue;
+			left = 0;
+			if (++i < sizeof(dumps) / sizeof(dumps[0]) &&
+			    replay_request(fd, dumps[i].type, dumps[i].family,
+					   i + 1) > 0)
+				left = 1;
+			break;
+		}
+	}
+	fclose(f);
+	close(fd);
+	fprintf(stderr, "%lu datagrams\n", n);
+	return 0;
+}
+
+static int replay_gen_cmd(int argc, char **argv)
+{
+	struct replay_stream s;
+	unsigned int seed = 1;
+	FILE *f;
+	int c;
+
+	while ((c = getopt(argc, argv, "s:")) != -1) {
+		if (c != 's')
+			replay_usage();
+		seed = strtoul(optarg, NULL, 0);
+	}
+	if (optind + 2 > argc)
+		replay_usage();
+	memset(&s, 0, sizeof(s));
+	replay_gen(&s, strtoul(argv[optind], NULL, 0), seed);
+	f = fopen(argv[optind + 1], "w");
+	if (!f || fwrite(s.data.p, 1, s.data.len, f) != s.data.len) {
+		perror(argv[optind + 1]);
+		return 1;
+	}
+	fclose(f);
+	fprintf(stderr, "%lu messages in %lu datagrams\n", s.msgs, s.dgrams);
+	return 0;
+}
+
+static int replay_dump(int argc, char **argv)
+{
+	struct replay_stream s;
+	int c, flags = 0;
+
+	while ((c = getopt(argc, argv, "a")) != -1) {
+		if (c != 'a')
+			replay_usage();
+		flags |= NOBD_NL_NO_NEIGH;
+	}
+	if (optind >= argc)
+		replay_usage();
+	memset(&s, 0, sizeof(s));
+	if (replay_load(&s, argv[optind]) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	replay_walk(&s, flags, replay_print, NULL);
+	return 0;
+}
+
+static unsigned long long replay_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The walk with no callback is what gets timed, a pass with replay_count()
+ * before it only reports the mix. Cycles are the TSC, so they are
+ * reference cycles wherever the clock scales.
+ */
+static int replay_bench(int argc, char **argv)
+{
+	unsigned long counts[NOBD_NL_MAX] = { 0 };
+	unsigned long passes = 100, gen = 0, msgs = 0, i;
+	unsigned long long t0, t1, c0 = 0, c1 = 0;
+	struct replay_stream s;
+	int c, flags = 0;
+
+	while ((c = getopt(argc, argv, "ai:g:")) != -1) {
+		switch (c) {
+		case 'a':
+			flags |= NOBD_NL_NO_NEIGH;
+			break;
+		case 'i':
+			passes = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			gen = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			replay_usage();
+		}
+	}
+	memset(&s, 0, sizeof(s));
+	if (gen) {
+		replay_gen(&s, gen, 1);
+	} else if (optind >= argc) {
+		replay_usage();
+	} else if (replay_load(&s, argv[optind]) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (!passes)
+		passes = 1;
+
+	replay_walk(&s, flags, replay_count, counts);
+	t0 = replay_ns();
+#ifdef REPLAY_TSC
+	c0 = __rdtsc();
+#endif
+	for (i = 0; i < passes; i++)
+		msgs += replay_walk(&s, flags, NULL, NULL);
+#ifdef REPLAY_TSC
+	c1 = __rdtsc();
+#endif
+	t1 = replay_ns();
+
+	printf("datagrams %lu msgs %lu passes %lu\n", s.dgrams,
+	       msgs / passes, passes);
+	for (i = 0; i < NOBD_NL_MAX; i++)
+		printf("%s %lu ", replay_kind[i], counts[i]);
+	printf("\n");
+	if (!msgs)
+		return 0;
+	printf("%.1f ns/msg %.0f msgs/s", (double)(t1 - t0) / msgs,
+	       msgs * 1e9 / (t1 - t0));
+	if (c1)
+		printf(" %.1f cycles/msg", (double)(c1 - c0) / msgs);
+	printf("\n");
+	return 0;
+}
+
+static int replay_failed;
+
+#define replay_expect(name, cond) do {				\
+	if (!(cond)) {						\
+		fprintf(stderr, "FAIL %s: %s\n", name, #cond);	\
+		replay_failed++;				\
+	}							\
+} while (0)
+
+/* one message in a buffer of its own, parsed */
+static int replay_one(struct replay_buf *b, struct nobd_ev *ev, int flags)
+{
+	return nobd_nl_parse((struct nlmsghdr *)b->p, ev, flags);
+}
+
+static int replay_check(void)
+{
+	__u8 d4[4] = { 10, 1, 2, 0 }, g4[4] = { 10, 0, 0, 1 };
+	__u8 d6[16] = { 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 1 };
+	__u8 mac[6] = { 0x02, 0x11, 0x22, 0x33, 0x44, 0x55 };
+	unsigned long counts[NOBD_NL_MAX] = { 0 };
+	struct replay_buf b = { 0 };
+	struct replay_stream s;
+	struct nlmsghdr *nlh;
+	struct rtmsg rtm;
+	struct nobd_ev ev;
+	size_t dgram;
+	int kind, ok = 0;
+
+#define RESET()	(b.len = 0, memset(&ev, 0xa5, sizeof(ev)))
+
+	RESET();
+	replay_route(&b, RTM_NEWROUTE, AF_INET, d4, 24, g4, 7);
+	kind = replay_one(&b, &ev, 0);
+	replay_expect("route4", kind == NOBD_NL_ROUTE);
+	replay_expect("route4", ev.hdr.type == NOBD_EV_ROUTE);
+	replay_expect("route4", ev.route.op == NOBD_OP_NEW);
+	replay_expect("route4", ev.route.family == AF_INET);
+	replay_expect("route4", ev.route.dst_len == 24);
+	replay_expect("route4", ev.route.table == RT_TABLE_MAIN);
+	replay_expect("route4", !memcmp(&ev.route.dst.ip, d4, 4));
+	replay_expect("route4", !ev.route.dst.ip6[1]);
+	replay_expect("route4", !memcmp(&ev.route.gw.ip, g4, 4));
+	replay_expect("route4", ev.route.oif == 7);
+	ok++;
+
+	RESET();
+	replay_route(&b, RTM_DELROUTE, AF_INET6, d6, 64, NULL, 2);
+	kind = replay_one(&b, &ev, 0);
+	replay_expect("route6", kind == NOBD_NL_ROUTE);
+	replay_expect("route6", ev.route.op == NOBD_OP_DEL);
+	replay_expect("route6", ev.route.family == AF_INET6);
+	replay_expect("route6", !memcmp(ev.route.dst.b, d6, 16));
+	replay_expect("route6", !ev.route.gw.ip6[0] && !ev.route.gw.ip6[3]);
+	ok++;
+
+	RESET();
+	nlh = replay_route(&b, RTM_NEWROUTE, AF_INET6, d6, 128, NULL, 2);
+	((struct rtmsg *)NLMSG_DATA(nlh))->rtm_flags |= RTM_F_CLONED;
+	replay_expect("route6 cache", replay_one(&b, &ev, 0) == NOBD_NL_SKIP);
+	ok++;
+
+	RESET();
+	nlh = replay_route(&b, RTM_NEWROUTE, AF_INET, d4, 24, NULL, 2);
+	((struct rtmsg *)NLMSG_DATA(nlh))->rtm_family = AF_DECnet;
+	replay_expect("route other", replay_one(&b, &ev, 0) == NOBD_NL_SKIP);
+	ok++;
+
+	/* a header cut short must not be read past */
+	RESET();
+	memset(&rtm, 0, sizeof(rtm));
+	rtm.rtm_family = AF_INET;
+	nlh = replay_msg(&b, RTM_NEWROUTE, &rtm, sizeof(rtm));
+	nlh->nlmsg_len = NLMSG_LENGTH(2);
+	replay_expect("route short", replay_one(&b, &ev, 0) == NOBD_NL_SKIP);
+	ok++;
+
+	/* an attribute too short for its type reads as zero */
+	RESET();
+	nlh = replay_msg(&b, RTM_NEWROUTE, &rtm, sizeof(rtm));
+	replay_attr(&b, &nlh, RTA_OIF, "\x07", 1);
+	kind = replay_one(&b, &ev, 0);
+	replay_expect("route short attr", kind == NOBD_NL_ROUTE);
+	replay_expect("route short attr", ev.route.oif == 0);
+	ok++;
+
+	RESET();
+	replay_link(&b, RTM_NEWLINK, AF_BRIDGE, 12, "eth1", 3);
+	kind = replay_one(&b, &ev, 0);
+	replay_expect("brport", kind == NOBD_NL_LINK);
+	replay_expect("brport", ev.hdr.type == NOBD_EV_LINK);
+	replay_expect("brport", ev.link.op == NOBD_LINK_BIND);
+	replay_expect("brport", ev.link.class == NOBD_CLASS_BRPORT);
+	replay_expect("brport", ev.link.ifindex == 12);
+	replay_expect("brport", ev.link.master == 3);
+	replay_expect("brport", !strcmp(ev.link.name, "eth1"));
+	ok++;
+
+	RESET();
+	replay_link(&b, RTM_DELLINK, AF_BRIDGE, 12,
+		    "a-name-well-over-ifnamsiz", 0);
+	kind = replay_one(&b, &ev, 0);
+	replay_expect("brport long", kind == NOBD_NL_LINK);
+	replay_expect("brport long", ev.link.op == NOBD_LINK_UNBIND);
+	replay_expect("brport long", ev.link.master == 0);
+	replay_expect("brport long",
+		      !strcmp(ev.link.name, "a-name-well-ove"));
+	ok++;
+
+	RESET();
+	replay_link(&b, RTM_NEWLINK, AF_UNSPEC, 12, "eth1", 0);
+	replay_expect("link", replay_one(&b, &ev, 0) == NOBD_NL_SKIP);
+	ok++;
+
+	RESET();
+	replay_neigh(&b, RTM_NEWNEIGH, AF_INET, g4, 4, mac, NUD_REACHABLE);
+	kind = replay_one(&b, &ev, 0);
+	replay_expect("neigh4", kind == NOBD_NL_NEIGH);
+	replay_expect("neigh4", ev.hdr.type == NOBD_EV_NEIGH);
+	replay_expect("neigh4", ev.neigh.op == NOBD_OP_NEW);
+	replay_expect("neigh4", ev.neigh.family == AF_INET);
+	replay_expect("neigh4", ev.neigh.ifindex == 4);
+	replay_expect("neigh4", ev.neigh.state == NUD_REACHABLE);
+	replay_expect("neigh4", !memcmp(&ev.neigh.ip.ip, g4, 4));
+	replay_expect("neigh4", !memcmp(ev.neigh.lladdr, mac, 6));
+	replay_expect("neigh4", !ev.neigh.flaps);
+	ok++;
+
+	RESET();
+	replay_neigh(&b, RTM_DELNEIGH, AF_INET6, d6, 4, NULL, NUD_FAILED);
+	kind = replay_one(&b, &ev, 0);
+	replay_expect("neigh6", kind == NOBD_NL_NEIGH);
+	replay_expect("neigh6", ev.neigh.op == NOBD_OP_DEL);
+	replay_expect("neigh6", !memcmp(ev.neigh.ip.b, d6, 16));
+	replay_expect("neigh6", !ev.neigh.lladdr[0] && !ev.neigh.lladdr[5]);
+	ok++;
+
+	RESET();
+	replay_neigh(&b, RTM_NEWNEIGH, AF_INET, g4, 4, mac, NUD_REACHABLE);
+	replay_expect("no_arp",
+		      replay_one(&b, &ev, NOBD_NL_NO_NEIGH) == NOBD_NL_SKIP);
+	ok++;
+
+	RESET();
+	replay_msg(&b, NLMSG_DONE, &(int){ 0 }, sizeof(int));
+	replay_expect("done", replay_one(&b, &ev, 0) == NOBD_NL_DONE);
+	RESET();
+	replay_msg(&b, NLMSG_ERROR, &(struct nlmsgerr){ .error = -ENOBUFS },
+		   sizeof(struct nlmsgerr));
+	replay_expect("error", replay_one(&b, &ev, 0) == NOBD_NL_ERROR);
+	ok++;
+
+	/* a multipart datagram stops at NLMSG_DONE, the next one is read */
+	memset(&s, 0, sizeof(s));
+	dgram = s.data.len;
+	replay_grow(&s.data, sizeof(__u32));
+	replay_route(&s.data, RTM_NEWROUTE, AF_INET, d4, 24, g4, 7);
+	replay_neigh(&s.data, RTM_NEWNEIGH, AF_INET, g4, 4, mac, NUD_STALE);
+	replay_msg(&s.data, NLMSG_DONE, &(int){ 0 }, sizeof(int));
+	replay_route(&s.data, RTM_NEWROUTE, AF_INET, d4, 24, g4, 7);
+	replay_dgram_end(&s, dgram);
+	dgram = s.data.len;
+	replay_grow(&s.data, sizeof(__u32));
+	replay_link(&s.data, RTM_NEWLINK, AF_BRIDGE, 12, "eth1", 3);
+	replay_dgram_end(&s, dgram);
+	replay_expect("walk", replay_walk(&s, 0, replay_count, counts) == 4);
+	replay_expect("walk", counts[NOBD_NL_ROUTE] == 1);
+	replay_expect("walk", counts[NOBD_NL_NEIGH] == 1);
+	replay_expect("walk", counts[NOBD_NL_DONE] == 1);
+	replay_expect("walk", counts[NOBD_NL_LINK] == 1);
+	ok++;
+
+	/* the generator's own stream parses to what it put in */
+	memset(&s, 0, sizeof(s));
+	memset(counts, 0, sizeof(counts));
+	replay_gen(&s, 10000, 1);
+	replay_walk(&s, 0, replay_count, counts);
+	replay_expect("gen", s.dgrams > 1);
+	replay_expect("gen", !counts[NOBD_NL_SKIP]);
+	replay_expect("gen", counts[NOBD_NL_ROUTE] + counts[NOBD_NL_NEIGH] +
+		      counts[NOBD_NL_LINK] == s.msgs);
+	ok++;
+#undef RESET
+
+	printf("%d cases, %d failed\n", ok, replay_failed);
+	return replay_failed ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+		replay_usage();
+	if (!strcmp(argv[1], "record"))
+		return replay_record(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "gen"))
+		return replay_gen_cmd(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "dump"))
+		return replay_dump(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "bench"))
+		return replay_bench(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "check"))
+		return replay_check();
+	replay_usage();
+	return 2;
+}
@@ -0,0 +1,251 @@
+/*
+ *	Network OBserving Daemon [NOBD]
+ *
+ *      nobdctl: tail the rings, set the filter, show the counters.
+ *      Authors:
+ *	Haim Daniel
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "libnobd.h"
+
+#define NOBD_BATCH	4096
+
+static volatile sig_atomic_t nobdctl_stop;
+
+struct nobdctl_tail {
+	unsigned long long left;	/* records to go, 0 for no limit */
+	unsigned int types;		/* bit per enum nobd_ev_type, 0 for all */
+	int quiet;
+	int cpu;
+	unsigned long long seen;
+};
+
+static void nobdctl_sig(int sig)
+{
+	nobdctl_stop = 1;
+}
+
+static void nobdctl_usage(void)
+{
+	fprintf(stderr,
+		"usage: nobdctl tail [-o] [-q] [-c] [-n COUNT] [-t TYPE]... [-s STAGES] [-f EXPR]\n"
+		"       nobdctl filter [EXPR]   show or set the kernel filter, \"\" clears it\n"
+		"       nobdctl snapshot [STAGES|stop]\n"
+		"       nobdctl stats\n"
+		"\n"
+		"tail  -o  merge the rings by seq    -q  count only, print a summary\n"
+		"      -c  prefix the ring (cpu)     -n  stop after COUNT records\n"
+		"      -t  only records of TYPE      -s  request a snapshot once attached\n"
+		"      -f  set the kernel filter first\n");
+	exit(2);
+}
+
+static int nobdctl_type(const char *name)
+{
+	unsigned int i;
+
+	for (i = NOBD_EV_NONE + 1; i < NOBD_EV_MAX; i++) {
+		if (!strcmp(name, nobd_type_name(i)))
+			return i;
+	}
+	return -1;
+}
+
+static int nobdctl_print(const struct nobd_ev *ev, int ring, void *arg)
+{
+	struct nobdctl_tail *t = arg;
+	char line[256];
+
+	if (t->types && !(t->types & (1U << ev->hdr.type)))
+		return 0;
+	t->seen++;
+	if (!t->quiet) {
+		nobd_ev_format(ev, line, sizeof(line));
+		if (t->cpu)
+			printf("cpu%d %s\n", ring, line);
+		else
+			printf("%s\n", line);
+	}
+	if (t->left && !--t->left)
+		return 1;
+	return 0;
+}
+
+static double nobdctl_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int nobdctl_tail(int argc, char **argv)
+{
+	struct nobdctl_tail t;
+	struct nobd_stats st;
+	const char *snap = NULL, *expr = NULL;
+	struct nobd *h;
+	int flags = 0, c, type, limited;
+	double start;
+
+	memset(&t, 0, sizeof(t));
+	while ((c = getopt(argc, argv, "oqcn:t:s:f:")) != -1) {
+		switch (c) {
+		case 'o':
+			flags |= NOBD_F_ORDERED;
+			break;
+		case 'q':
+			t.quiet = 1;
+			break;
+		case 'c':
+			t.cpu = 1;
+			break;
+		case 'n':
+			t.left = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			type = nobdctl_type(optarg);
+			if (type < 0) {
+				fprintf(stderr, "unknown type %s\n", optarg);
+				return 2;
+			}
+			t.types |= 1U << type;
+			break;
+		case 's':
+			snap = optarg;
+			break;
+		case 'f':
+			expr = optarg;
+			break;
+		default:
+			nobdctl_usage();
+		}
+	}
+	limited = t.left != 0;
+
+	if (expr && nobd_proc_write("filter", expr) < 0) {
+		perror("filter");
+		return 1;
+	}
+	h = nobd_open(NULL, flags);
+	if (!h) {
+		perror(NOBD_DEV_PATH);
+		return 1;
+	}
+	/* after attaching, so none of it goes by unread */
+	if (snap && nobd_proc_write("snapshot", snap) < 0)
+		perror("snapshot");
+
+	signal(SIGINT, nobdctl_sig);
+	signal(SIGTERM, nobdctl_sig);
+	setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+	start = nobdctl_now();
+	while (!nobdctl_stop && !(limited && !t.left)) {
+		if (nobd_dispatch(h, NOBD_BATCH, nobdctl_print, &t) > 0)
+			continue;
+		fflush(stdout);
+		if (nobd_wait(h, 1000) < 0 && errno != EINTR) {
+			perror("wait");
+			break;
+		}
+	}
+	fflush(stdout);
+
+	nobd_get_stats(h, &st);
+	if (t.quiet || nobdctl_stop)
+		fprintf(stderr, "%llu records, %llu shown, %.0f/s, "
+			"%llu ring drops, %llu skipped\n", st.records, t.seen,
+			st.records / (nobdctl_now() - start), st.ring_drops,
+			st.skipped);
+	nobd_close(h);
+	return 0;
+}
+
+static int nobdctl_filter(int argc, char **argv)
+{
+	if (argc < 2)
+		return nobd_proc_cat("filter", 1) < 0 ? (perror("filter"), 1) : 0;
+	if (nobd_proc_write("filter", argv[1]) < 0) {
+		perror("filter");
+		return 1;
+	}
+	return 0;
+}
+
+static int nobdctl_snapshot(int argc, char **argv)
+{
+	char text[256] = "";
+	int i;
+
+	if (argc < 2)
+		return nobd_proc_cat("snapshot", 1) < 0 ?
+			(perror("snapshot"), 1) : 0;
+	for (i = 1; i < argc; i++) {
+		strncat(text, argv[i], sizeof(text) - strlen(text) - 2);
+		strcat(text, " ");
+	}
+	if (nobd_proc_write("snapshot", text) < 0) {
+		perror("snapshot");
+		return 1;
+	}
+	return 0;
+}
+
+/* the rings, only while no one else consumes them, then the proc counters */
+static int nobdctl_stats(void)
+{
+	static const char *files[] = {
+		"ratelimit", "nl_stats", "netns", "snapshot", "filter",
+	};
+	struct nobd_stats st;
+	struct nobd *h;
+	unsigned int i;
+
+	h = nobd_open(NULL, 0);
+	if (h) {
+		nobd_get_stats(h, &st);
+		printf("== rings\nrings %u\nrecords %u\nbacklog %u\n"
+		       "drops %llu\n", st.nr_rings, st.nr_ev, st.backlog,
+		       st.ring_drops);
+		nobd_close(h);
+	} else {
+		printf("== rings\n%s: %s\n", NOBD_DEV_PATH, strerror(errno));
+	}
+	fflush(stdout);
+	for (i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+		printf("== %s\n", files[i]);
+		fflush(stdout);
+		if (nobd_proc_cat(files[i], 1) < 0)
+			printf("%s\n", strerror(errno));
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+		nobdctl_usage();
+	if (!strcmp(argv[1], "tail"))
+		return nobdctl_tail(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "filter"))
+		return nobdctl_filter(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "snapshot"))
+		return nobdctl_snapshot(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "stats"))
+		return nobdctl_stats();
+	nobdctl_usage();
+	return 2;
+}